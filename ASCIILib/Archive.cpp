@@ -0,0 +1,257 @@
+#include "Archive.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "FilePaths.h"
+#include "Log.h"
+
+
+namespace
+{
+    // ARCHIVE FORMAT
+    //
+    // All numbers are little-endian.
+    //
+    // Header: magic "APAK", Uint16 version, Uint16 reserved, Uint32 file
+    // count, Uint32 index size in bytes.
+    //
+    // Index, one entry per file: Uint32 path length, Uint64 data offset from
+    // the start of the archive, Uint64 data size, Sint64 modified time, then
+    // the UTF-8 path without a terminator.
+    //
+    // Data: the contents of every file, each starting on a multiple of
+    // kDataAlignment.
+    const char kArchiveMagic[4] = { 'A', 'P', 'A', 'K' };
+    const Uint16 kArchiveVersion = 1;
+    const size_t kHeaderSize = 16;
+    const size_t kEntrySize = 28;
+    const Uint64 kDataAlignment = 16;
+
+    Uint64 ReadLE(const Uint8* bytes, int count)
+    {
+        Uint64 value = 0;
+        for (int i = count - 1; i >= 0; --i)
+        {
+            value = (value << 8) | bytes[i];
+        }
+        return value;
+    }
+
+    void WriteLE(vector<Uint8>& bytes, Uint64 value, int count)
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            bytes.push_back((Uint8) (value >> (i * 8)));
+        }
+    }
+
+    Uint64 Align(Uint64 offset)
+    {
+        return (offset + kDataAlignment - 1) / kDataAlignment * kDataAlignment;
+    }
+
+    // Size of a file on disk, or -1 if it can't be opened
+    Sint64 FileSize(const string& path)
+    {
+        FILE* file = fopen(path.c_str(), "rb");
+        if (!file)
+        {
+            return -1;
+        }
+
+        fseek(file, 0, SEEK_END);
+        Sint64 size = ftell(file);
+        fclose(file);
+        return size;
+    }
+
+    // Append a file's contents to an open archive
+    bool CopyFile(const string& path, FILE* archive)
+    {
+        FILE* file = fopen(path.c_str(), "rb");
+        if (!file)
+        {
+            return false;
+        }
+
+        char buffer[65536];
+        size_t read;
+        bool copied = true;
+
+        while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        {
+            if (fwrite(buffer, 1, read, archive) != read)
+            {
+                copied = false;
+                break;
+            }
+        }
+
+        fclose(file);
+        return copied;
+    }
+}
+
+
+ascii::Archive::Archive(string path)
+    : mFile(path), mOpen(false)
+{
+    if (!mFile.isOpen())
+    {
+        return;
+    }
+
+    const Uint8* data = mFile.data();
+    size_t size = mFile.size();
+
+    if (size < kHeaderSize || memcmp(data, kArchiveMagic, 4) != 0)
+    {
+        Log::Error("File is not a content archive: " + path);
+        return;
+    }
+
+    if (ReadLE(data + 4, 2) != kArchiveVersion)
+    {
+        Log::Error("Content archive was packed for a different version of the format: " + path);
+        return;
+    }
+
+    Uint32 count = (Uint32) ReadLE(data + 8, 4);
+    Uint32 indexSize = (Uint32) ReadLE(data + 12, 4);
+
+    if (indexSize > size - kHeaderSize)
+    {
+        Log::Error("Content archive index is truncated: " + path);
+        return;
+    }
+
+    const Uint8* pos = data + kHeaderSize;
+    const Uint8* indexEnd = pos + indexSize;
+
+    mEntries.reserve(count);
+
+    for (Uint32 i = 0; i < count; ++i)
+    {
+        if ((size_t) (indexEnd - pos) < kEntrySize)
+        {
+            Log::Error("Content archive index is truncated: " + path);
+            mEntries.clear();
+            return;
+        }
+
+        Uint32 pathLength = (Uint32) ReadLE(pos, 4);
+
+        Entry entry;
+        entry.offset = ReadLE(pos + 4, 8);
+        entry.size = ReadLE(pos + 12, 8);
+        entry.modifiedTime = (Sint64) ReadLE(pos + 20, 8);
+        pos += kEntrySize;
+
+        if ((size_t) (indexEnd - pos) < pathLength
+                || entry.offset > size || entry.size > size - entry.offset)
+        {
+            Log::Error("Content archive has a malformed index: " + path);
+            mEntries.clear();
+            return;
+        }
+
+        mEntries[string((const char*) pos, pathLength)] = entry;
+        pos += pathLength;
+    }
+
+    mOpen = true;
+}
+
+bool ascii::Archive::find(const string& path, const Uint8** outData, size_t* outSize,
+        Sint64* outModifiedTime)
+{
+    auto it = mEntries.find(path);
+    if (it == mEntries.end())
+    {
+        return false;
+    }
+
+    *outData = mFile.data() + it->second.offset;
+    *outSize = (size_t) it->second.size;
+    if (outModifiedTime)
+    {
+        *outModifiedTime = it->second.modifiedTime;
+    }
+    return true;
+}
+
+//static
+bool ascii::Archive::Write(string archivePath, const vector<string>& files)
+{
+    // Lay out the index first, so the files can be streamed in after it
+    vector<Uint8> index;
+    vector<Uint64> offsets;
+
+    Uint64 indexSize = 0;
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        indexSize += kEntrySize + files[i].size();
+    }
+
+    Uint64 offset = Align(kHeaderSize + indexSize);
+
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        Sint64 size = FileSize(files[i]);
+        if (size < 0)
+        {
+            Log::Error("Failed to open file to pack: " + files[i]);
+            return false;
+        }
+
+        WriteLE(index, files[i].size(), 4);
+        WriteLE(index, offset, 8);
+        WriteLE(index, (Uint64) size, 8);
+        WriteLE(index, (Uint64) FileModifiedTime(files[i]), 8);
+        index.insert(index.end(), files[i].begin(), files[i].end());
+
+        offsets.push_back(offset);
+        offset = Align(offset + size);
+    }
+
+    vector<Uint8> header(kArchiveMagic, kArchiveMagic + 4);
+    WriteLE(header, kArchiveVersion, 2);
+    WriteLE(header, 0, 2); // reserved
+    WriteLE(header, files.size(), 4);
+    WriteLE(header, index.size(), 4);
+
+    FILE* archive = fopen(archivePath.c_str(), "wb");
+    if (!archive)
+    {
+        Log::Error("Content archive could not be opened for writing: " + archivePath);
+        return false;
+    }
+
+    bool written = fwrite(header.data(), 1, header.size(), archive) == header.size()
+        && fwrite(index.data(), 1, index.size(), archive) == index.size();
+
+    for (size_t i = 0; i < files.size() && written; ++i)
+    {
+        // Pad up to where the file's data starts
+        static const char padding[kDataAlignment] = { 0 };
+        long position = ftell(archive);
+        written = position >= 0 && (Uint64) position <= offsets[i]
+            && fwrite(padding, 1, offsets[i] - position, archive) == offsets[i] - position
+            && CopyFile(files[i], archive);
+
+        if (!written)
+        {
+            Log::Error("Failed to pack file: " + files[i]);
+        }
+    }
+
+    written = fclose(archive) == 0 && written;
+
+    if (!written)
+    {
+        Log::Error("Failed to write content archive: " + archivePath);
+    }
+
+    return written;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+#include <SDL.h>
+
+#include "MappedFile.h"
+
+namespace ascii
+{
+
+    // A read-only pack of content files, mapped into memory whole so that
+    // each file can be used straight from the mapping. Files are looked up
+    // by the relative path they were packed under, like
+    // "content/images/title.png"
+    class Archive
+    {
+        public:
+            Archive(string path);
+
+            // Check if the archive was opened and its index was valid
+            bool isOpen() { return mOpen; }
+
+            // Find a packed file. Its contents stay valid for as long as the
+            // Archive does. The modified time is that of the file when it
+            // was packed
+            bool find(const string& path, const Uint8** outData, size_t* outSize,
+                    Sint64* outModifiedTime=NULL);
+
+            // Number of files packed
+            size_t size() { return mEntries.size(); }
+
+            // Pack the given files into a new archive. Each is stored under
+            // the path it is given by
+            static bool Write(string archivePath, const vector<string>& files);
+
+        private:
+            struct Entry
+            {
+                Uint64 offset;
+                Uint64 size;
+                Sint64 modifiedTime;
+            };
+
+            MappedFile mFile;
+            bool mOpen;
+            unordered_map<string, Entry> mEntries;
+    };
+
+}
@@ -3,26 +3,34 @@
 const int kMaxColorValue = 255;
 
 ascii::Color::Color(int r, int g, int b)
-	: r(r), g(g), b(b), isNone(false)
+	: r(r), g(g), b(b), isNone(false), isIndexed(false)
 {
 }
 
 ascii::Color::Color(float r, float g, float b)
 	: r(r * kMaxColorValue), g(g * kMaxColorValue), b(b * kMaxColorValue),
-    isNone(false)
+    isNone(false), isIndexed(false)
 {
 }
 
 ascii::Color::Color()
-	: r(0), g(0), b(0), isNone(false)
+	: r(0), g(0), b(0), isNone(false), isIndexed(false)
 {
 }
 
 ascii::Color::Color(void* ptr)
-    : r(0), g(0), b(0), isNone(true)
+    : r(0), g(0), b(0), isNone(true), isIndexed(false)
 {
 }
 
+//static
+ascii::Color ascii::Color::Indexed(Uint8 index)
+{
+    Color color(index, 0, 0);
+    color.isIndexed = true;
+    return color;
+}
+
 //static
 const Uint8 ascii::Color::kAlpha = 255;
 
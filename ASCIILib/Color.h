@@ -27,6 +27,11 @@ namespace ascii
 			/// </summary>
 			Color();
 
+			/// <summary>
+			/// Constructs a color which refers to an entry of the palette it is drawn with, instead of holding RGB values itself.
+			/// </summary>
+			static Color Indexed(Uint8 index);
+
         private:
             // Create a "none" color
             Color(void* ptr);
@@ -80,12 +85,15 @@ namespace ascii
 			operator SDL_Color();
 
 			Uint8 r, g, b;
-            bool isNone;
+            // Flags share one byte, so that cells stay small. An indexed
+            // color keeps its palette index in r
+            bool isNone : 1;
+            bool isIndexed : 1;
 	};
 
 	inline bool operator==(const Color& c1, const Color& c2)
 	{
-		return c1.r == c2.r && c1.g == c2.g && c1.b == c2.b;
+		return c1.r == c2.r && c1.g == c2.g && c1.b == c2.b && c1.isIndexed == c2.isIndexed;
 	}
 
 	inline bool operator<(const Color& c1, const Color& c2)
@@ -105,7 +113,7 @@ namespace ascii
 			return c1.b < c2.b;
 		}
 
-		return false;
+		return c1.isIndexed < c2.isIndexed;
 	}
 
 };
@@ -4,6 +4,9 @@
 #include "FilePaths.h"
 
 #include "Game.h"
+#include "GlobalArgs.h"
+#include "Profiler.h"
+#include "VirtualFS.h"
 using namespace ascii;
 
 
@@ -15,19 +18,33 @@ namespace
     const string MUSIC_DIRECTORY("content/music/");
     const string SURFACE_DIRECTORY("content/surfaces/");
     const string STYLE_DIRECTORY("content/styles/");
+
+    // Default time UpdateContent() may spend handing over loaded assets
+    const int kDefaultLoadBudgetMS = 4;
 }
 
 
 ascii::ContentManager::ContentManager(Game* game)
     : mpGame(game), mpSoundManager(game->soundManager()),
-    mpTextManager(game->textManager()) 
+    mpTextManager(game->textManager()), mpWorkers(NULL),
+    mLoadBudgetMS(kDefaultLoadBudgetMS)
 {
     mpStyleManager = new StyleManager();
     mpSurfaceManager = new SurfaceManager();
+
+    SetAsyncLoading(GlobalArgs::Enabled("async-content"));
 }
 
 ascii::ContentManager::~ContentManager()
 {
+    // Stop the workers before throwing away what they were loading
+    delete mpWorkers;
+    for (auto it = mPendingLoads.begin(); it != mPendingLoads.end(); ++it)
+    {
+        (*it)->cancelled = true;
+        FinalizeLoad(*it);
+    }
+
     delete mpStyleManager;
     delete mpSurfaceManager;
 }
@@ -39,6 +56,8 @@ ascii::ImageCache* ascii::ContentManager::imageCache()
 
 void ascii::ContentManager::RequireContentGroup(string groupFile, bool locked)
 {
+    PROFILE_SCOPE("ContentManager::RequireContentGroup");
+
     // Load the group from its handle relative to the groups directory
     groupFile = FileAccessPath(GROUPS_DIRECTORY + groupFile);
     // Parse the group structure from the JSON
@@ -52,6 +71,8 @@ void ascii::ContentManager::RequireContentGroup(string groupFile, bool locked)
 
 void ascii::ContentManager::RequireContentGroup(string groupName, Json::Value& groupJson, bool locked)
 {
+    PROFILE_SCOPE("ContentManager::RequireContentGroup");
+
     // Parse a ContentGroup from the given JSON element
     ContentGroup group = ParseContentGroup(groupJson, locked);
     // Store the content group by the given name
@@ -60,7 +81,12 @@ void ascii::ContentManager::RequireContentGroup(string groupName, Json::Value& g
 
 void ascii::ContentManager::ReleaseContentGroup(string groupName, bool lockOverride)
 {
-    ContentGroup group = mContentGroups[groupName];
+    PROFILE_SCOPE("ContentManager::ReleaseContentGroup");
+
+    auto it = mContentGroups.find(groupName);
+    if (it == mContentGroups.end()) return;
+
+    ContentGroup group = it->second;
 
     if (group.locked && !lockOverride) return;
 
@@ -69,7 +95,7 @@ void ascii::ContentManager::ReleaseContentGroup(string groupName, bool lockOverr
     mReleasedGroups.push_back(group);
     // Remove the content group referenced by the given asset name from the map
     // of required groups
-    mContentGroups.erase(groupName);
+    mContentGroups.erase(it);
 }
 
 void ascii::ContentManager::ClearContent()
@@ -87,135 +113,191 @@ void ascii::ContentManager::ClearContent()
 
 void ascii::ContentManager::UpdateContent()
 {
-    // Gather the required content from every group that has already been
-    // loaded
-    ContentGroup oldContent;
-    // Gather all content which should not be unloaded
-    ContentGroup neededContent;
+    PROFILE_SCOPE("ContentManager::UpdateContent");
 
-    for (auto it = mContentGroups.begin(); it != mContentGroups.end(); ++it)
-    {
-        oldContent += it->second;
-        neededContent += it->second;
-    }
+    mLastLoaded = ContentGroup();
+    mLastFreed = ContentGroup();
 
-    // Gather the required content from every group that has newly been added
-    // and must be acquired if necessary
-    ContentGroup requiredContent;
+    // Count the references of newly required groups first, so that assets
+    // they share with released groups are kept rather than freed and loaded
+    // again
     for (auto it = mRequiredGroups.begin(); it != mRequiredGroups.end(); ++it)
     {
-        requiredContent += it->second;
+        AcquireGroup(it->second, &mLastLoaded);
+        PinGroup(it->second, true);
 
-        // Add this content to the retained content group, to prevent any of it
-        // from being released unnecessarily
-        neededContent += it->second;
+        // Requiring a group again replaces its old version
+        auto loaded = mContentGroups.find(it->first);
+        if (loaded != mContentGroups.end())
+        {
+            mReleasedGroups.push_back(loaded->second);
+        }
+
+        // Add every newly required group to the map of retained groups
+        mContentGroups[it->first] = it->second;
     }
 
-    // Gather the content released by every group that has been newly removed
-    // and must be unloaded if necessary
-    ContentGroup releasedContent;
+    mRequiredGroups.clear();
+
     for (auto it = mReleasedGroups.begin(); it != mReleasedGroups.end(); ++it)
     {
-        releasedContent += *it;
+        ReleaseGroup(*it, &mLastFreed);
+        PinGroup(*it, false);
     }
 
-    // Free everything from released groups that is no longer referenced by
-    // another group
-    ProcessHandleList(releasedContent.images, neededContent.images, &ascii::ContentManager::FreeImage);
-    ProcessHandleList(releasedContent.sounds, neededContent.sounds, &ascii::ContentManager::FreeSound);
-    ProcessHandleList(releasedContent.soundGroups, neededContent.soundGroups,
-                      &ascii::ContentManager::FreeSoundGroup);
-    ProcessHandleList(releasedContent.tracks, neededContent.tracks, &ascii::ContentManager::FreeTrack);
-
-    ProcessHandleList(releasedContent.surfaces, neededContent.surfaces,
-                      &ascii::ContentManager::FreeSurface);
+    mReleasedGroups.clear();
 
-    ProcessHandleList(releasedContent.styles, neededContent.styles, &ascii::ContentManager::FreeStyle);
-    ProcessHandleList(releasedContent.textFiles, neededContent.textFiles,
-                      &ascii::ContentManager::FreeText);
+    // Free everything no group references anymore
+    ProcessHandleList(mLastFreed.images, &ascii::ContentManager::FreeImage);
+    ProcessHandleList(mLastFreed.sounds, &ascii::ContentManager::FreeSound);
+    ProcessHandleList(mLastFreed.soundGroups, &ascii::ContentManager::FreeSoundGroup);
+    ProcessHandleList(mLastFreed.tracks, &ascii::ContentManager::FreeTrack);
+    ProcessHandleList(mLastFreed.surfaces, &ascii::ContentManager::FreeSurface);
+    ProcessHandleList(mLastFreed.styles, &ascii::ContentManager::FreeStyle);
+    ProcessHandleList(mLastFreed.textFiles, &ascii::ContentManager::FreeText);
+
+    // Load everything which was first referenced by a newly required group
+    ProcessHandleList(mLastLoaded.images, &ascii::ContentManager::LoadImage);
+    ProcessHandleList(mLastLoaded.sounds, &ascii::ContentManager::LoadSound);
+    ProcessHandleList(mLastLoaded.soundGroups, &ascii::ContentManager::LoadSoundGroup);
+    ProcessHandleList(mLastLoaded.tracks, &ascii::ContentManager::LoadTrack);
+    ProcessHandleList(mLastLoaded.surfaces, &ascii::ContentManager::LoadSurface);
+    ProcessHandleList(mLastLoaded.styles, &ascii::ContentManager::LoadStyle);
+    ProcessHandleList(mLastLoaded.textFiles, &ascii::ContentManager::LoadText);
+
+    // Hand over assets which finished loading in the background
+    if (!mPendingLoads.empty())
+    {
+        FinalizeLoads(true);
+    }
+}
 
-    mReleasedGroups.clear();
+void ascii::ContentManager::ProcessHandleList(HandleList& handleList, AssetProcessor process)
+{
+    for (auto it = handleList.begin(); it != handleList.end(); ++it)
+    {
+        (this->*process)(*it);
+    }
+}
 
-    // Load everything that is referenced in a newly required group
-    ProcessHandleList(requiredContent.images, oldContent.images, &ascii::ContentManager::LoadImage);
-    ProcessHandleList(requiredContent.sounds, oldContent.sounds, &ascii::ContentManager::LoadSound);
-    ProcessHandleList(requiredContent.soundGroups, oldContent.soundGroups,
-                      &ascii::ContentManager::LoadSoundGroup);
-    ProcessHandleList(requiredContent.tracks, oldContent.tracks, &ascii::ContentManager::LoadTrack);
-    ProcessHandleList(requiredContent.surfaces, oldContent.surfaces,
-                      &ascii::ContentManager::LoadSurface);
-    ProcessHandleList(requiredContent.styles, oldContent.styles, &ascii::ContentManager::LoadStyle);
-    ProcessHandleList(requiredContent.textFiles, oldContent.textFiles,
-                      &ascii::ContentManager::LoadText);
-
-    // Add every newly required group to the map of retained groups
-    for (auto it = mRequiredGroups.begin(); it != mRequiredGroups.end(); ++it)
+//static
+HandleList& ascii::ContentManager::Handles(ContentGroup& group, AssetType type)
+{
+    switch (type)
     {
-        mContentGroups[it->first] = it->second;
+        case kImageAsset: return group.images;
+        case kSoundAsset: return group.sounds;
+        case kSoundGroupAsset: return group.soundGroups;
+        case kTrackAsset: return group.tracks;
+        case kSurfaceAsset: return group.surfaces;
+        case kStyleAsset: return group.styles;
+        default: return group.textFiles;
     }
+}
 
-    mRequiredGroups.clear();
+void ascii::ContentManager::AcquireGroup(ContentGroup& group, ContentGroup* outAcquired)
+{
+    for (int type = 0; type < kAssetTypeCount; ++type)
+    {
+        mRegistries[type].Acquire(Handles(group, (AssetType) type),
+                &Handles(*outAcquired, (AssetType) type));
+    }
+}
 
-    // TODO debug print content still retained after updating
-    ContentGroup stillRetainedContent;
-    for (auto it = mContentGroups.begin(); it != mContentGroups.end(); ++it)
+void ascii::ContentManager::ReleaseGroup(ContentGroup& group, ContentGroup* outReleased)
+{
+    for (int type = 0; type < kAssetTypeCount; ++type)
     {
-        stillRetainedContent += it->second;
+        mRegistries[type].Release(Handles(group, (AssetType) type),
+                &Handles(*outReleased, (AssetType) type));
     }
 }
 
-void ascii::ContentManager::ProcessHandleList(HandleList& handleList,
-        HandleList& retainedHandles, AssetProcessor process)
+void ascii::ContentManager::PinGroup(ContentGroup& group, bool pin)
 {
-    // Check every handle in the given list
-    for (auto it = handleList.begin(); it != handleList.end(); ++it)
+    if (!group.locked) return;
+
+    for (auto it = group.images.begin(); it != group.images.end(); ++it)
     {
-        // Search the complete required handle list, and process the asset if its
-        // handle is not found
-        auto beg = retainedHandles.begin();
-        auto end = retainedHandles.end();
+        if (pin) imageCache()->pinTexture(HandleToName(*it));
+        else imageCache()->unpinTexture(HandleToName(*it));
+    }
 
-        if (find(beg, end, *it) == end)
-        {
-            (this->*process)(*it);
-        }
+    for (auto it = group.sounds.begin(); it != group.sounds.end(); ++it)
+    {
+        if (pin) mpSoundManager->pinSound(HandleToName(*it));
+        else mpSoundManager->unpinSound(HandleToName(*it));
+    }
+
+    for (auto it = group.soundGroups.begin(); it != group.soundGroups.end(); ++it)
+    {
+        if (pin) mpSoundManager->pinSoundGroup(HandleToName(*it));
+        else mpSoundManager->unpinSoundGroup(HandleToName(*it));
     }
 }
 
 void ascii::ContentManager::LoadImage(Handle imageHandle)
 {
-    imageHandle = FileAccessPath(IMAGE_DIRECTORY + imageHandle);
-    imageCache()->loadTexture(HandleToName(imageHandle), imageHandle.c_str()); 
+    PROFILE_SCOPE("ContentManager::LoadImage");
+
+    string path = FileAccessPath(IMAGE_DIRECTORY + imageHandle);
+    if (mpWorkers)
+    {
+        QueueLoad(kImageAsset, imageHandle, path);
+        return;
+    }
+
+    imageCache()->loadTexture(HandleToName(path), path.c_str()); 
 }
 
 void ascii::ContentManager::FreeImage(Handle imageHandle)
 {
+    if (CancelLoad(kImageAsset, imageHandle)) return;
+
     imageCache()->freeTexture(HandleToName(imageHandle));
 }
 
 void ascii::ContentManager::LoadSound(Handle soundHandle)
 {
-    soundHandle = FileAccessPath(SOUND_DIRECTORY + soundHandle);
-    mpSoundManager->loadSound(HandleToName(soundHandle), soundHandle.c_str());
+    PROFILE_SCOPE("ContentManager::LoadSound");
+
+    string path = FileAccessPath(SOUND_DIRECTORY + soundHandle);
+    if (mpWorkers)
+    {
+        QueueLoad(kSoundAsset, soundHandle, path);
+        return;
+    }
+
+    mpSoundManager->loadSound(HandleToName(path), path.c_str());
 }
 
 void ascii::ContentManager::FreeSound(Handle soundHandle)
 {
+    if (CancelLoad(kSoundAsset, soundHandle)) return;
+
     soundHandle = SOUND_DIRECTORY + soundHandle;
     mpSoundManager->freeSound(HandleToName(soundHandle));
 }
 
 void ascii::ContentManager::LoadSoundGroup(Handle groupHandle)
 {
+    PROFILE_SCOPE("ContentManager::LoadSoundGroup");
+
     // Retrieve the name of the group and its enclosing directory.
     // Sound files will be loaded into the group from the enclosing directory
     // of the sound group JSON.
     string groupName = HandleToName(groupHandle);
     string groupDirectory = HandleDirectory(groupHandle);
 
+    string path = FileAccessPath(SOUND_DIRECTORY + groupHandle);
+    if (mpWorkers)
+    {
+        QueueLoad(kSoundGroupAsset, groupHandle, path);
+        return;
+    }
+
     // Load the sound group as JSON
-    groupHandle = FileAccessPath(SOUND_DIRECTORY + groupHandle);
-    Json::Value* groupJsonPtr = Json::Load(groupHandle);
+    Json::Value* groupJsonPtr = Json::Load(path);
     Json::Value groupJson = *groupJsonPtr;
 
     // Retrieve the list element "sounds"
@@ -237,50 +319,371 @@ void ascii::ContentManager::LoadSoundGroup(Handle groupHandle)
 
 void ascii::ContentManager::FreeSoundGroup(Handle groupHandle)
 {
+    if (CancelLoad(kSoundGroupAsset, groupHandle)) return;
+
     mpSoundManager->freeSoundGroup(HandleToName(groupHandle));
 }
 
 void ascii::ContentManager::LoadTrack(Handle trackHandle)
 {
-    trackHandle = FileAccessPath(MUSIC_DIRECTORY + trackHandle);
-    mpSoundManager->loadTrack(HandleToName(trackHandle), trackHandle.c_str());
+    PROFILE_SCOPE("ContentManager::LoadTrack");
+
+    string path = FileAccessPath(MUSIC_DIRECTORY + trackHandle);
+    if (mpWorkers)
+    {
+        QueueLoad(kTrackAsset, trackHandle, path);
+        return;
+    }
+
+    mpSoundManager->loadTrack(HandleToName(path), path.c_str());
 }
 
 void ascii::ContentManager::FreeTrack(Handle trackHandle)
 {
+    if (CancelLoad(kTrackAsset, trackHandle)) return;
+
     mpSoundManager->freeTrack(HandleToName(trackHandle));
 }
 
 void ascii::ContentManager::LoadSurface(Handle surfaceHandle)
 {
-    surfaceHandle = FileAccessPath(SURFACE_DIRECTORY + surfaceHandle);
-    Log::Print(surfaceHandle);
-    mpSurfaceManager->LoadSurface(HandleToName(surfaceHandle), surfaceHandle);
+    PROFILE_SCOPE("ContentManager::LoadSurface");
+
+    string path = FileAccessPath(SURFACE_DIRECTORY + surfaceHandle);
+    Log::Debug(path);
+    if (mpWorkers)
+    {
+        QueueLoad(kSurfaceAsset, surfaceHandle, path);
+        return;
+    }
+
+    mpSurfaceManager->LoadSurface(HandleToName(path), path);
 }
 
 void ascii::ContentManager::FreeSurface(Handle surfaceHandle)
 {
+    if (CancelLoad(kSurfaceAsset, surfaceHandle)) return;
+
     mpSurfaceManager->FreeSurface(HandleToName(surfaceHandle));
 }
 
 void ascii::ContentManager::LoadStyle(Handle styleHandle)
 {
-    styleHandle = FileAccessPath(STYLE_DIRECTORY + styleHandle);
-    mpStyleManager->LoadStyle(HandleToName(styleHandle), styleHandle);
+    PROFILE_SCOPE("ContentManager::LoadStyle");
+
+    string path = FileAccessPath(STYLE_DIRECTORY + styleHandle);
+    if (mpWorkers)
+    {
+        QueueLoad(kStyleAsset, styleHandle, path);
+        return;
+    }
+
+    mpStyleManager->LoadStyle(HandleToName(path), path);
 }
 
 void ascii::ContentManager::FreeStyle(Handle styleHandle)
 {
+    if (CancelLoad(kStyleAsset, styleHandle)) return;
+
     mpStyleManager->FreeStyle(HandleToName(styleHandle));
 }
 
 void ascii::ContentManager::LoadText(Handle textHandle)
 {
+    PROFILE_SCOPE("ContentManager::LoadText");
+
+    if (mpWorkers)
+    {
+        QueueLoad(kTextAsset, textHandle, mpTextManager->FilePath(textHandle));
+        return;
+    }
+
     mpTextManager->LoadFile(textHandle);
 }
 
 void ascii::ContentManager::FreeText(Handle textHandle)
 {
+    if (CancelLoad(kTextAsset, textHandle)) return;
+
     mpTextManager->UnloadFile(textHandle);
 }
 
+
+void ascii::ContentManager::SetAsyncLoading(bool async)
+{
+    if (async == AsyncLoading())
+    {
+        return;
+    }
+
+    if (async)
+    {
+        mpWorkers = new WorkerPool();
+    }
+    else
+    {
+        FinishLoading();
+        delete mpWorkers;
+        mpWorkers = NULL;
+    }
+}
+
+bool ascii::ContentManager::ContentGroupLoaded(string groupName)
+{
+    auto it = mContentGroups.find(groupName);
+    if (it == mContentGroups.end())
+    {
+        return false;
+    }
+
+    if (mLoadsInFlight.empty())
+    {
+        return true;
+    }
+
+    ContentGroup& group = it->second;
+    return !HandlesLoading(kImageAsset, group.images)
+        && !HandlesLoading(kSoundAsset, group.sounds)
+        && !HandlesLoading(kSoundGroupAsset, group.soundGroups)
+        && !HandlesLoading(kTrackAsset, group.tracks)
+        && !HandlesLoading(kSurfaceAsset, group.surfaces)
+        && !HandlesLoading(kStyleAsset, group.styles)
+        && !HandlesLoading(kTextAsset, group.textFiles);
+}
+
+bool ascii::ContentManager::HandlesLoading(AssetType type, HandleList& handles)
+{
+    for (auto it = handles.begin(); it != handles.end(); ++it)
+    {
+        if (mLoadsInFlight.find(LoadKey(type, *it)) != mLoadsInFlight.end())
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ascii::ContentManager::FinishLoading()
+{
+    PROFILE_SCOPE("ContentManager::FinishLoading");
+
+    while (!mPendingLoads.empty())
+    {
+        FinalizeLoads(false);
+
+        if (!mPendingLoads.empty())
+        {
+            SDL_Delay(1);
+        }
+    }
+}
+
+void ascii::ContentManager::QueueLoad(AssetType type, Handle handle, string path)
+{
+    PendingLoad* load = new PendingLoad();
+    load->type = type;
+    load->handle = handle;
+    load->name = HandleToName(path);
+    load->path = path;
+    load->imageFormat = imageCache()->textureFormat();
+    load->decodeAudio = mpSoundManager->isEnabled();
+
+    mPendingLoads.push_back(load);
+    mLoadsInFlight[LoadKey(type, handle)] = load;
+
+    mpWorkers->Submit([load]() { DecodeAsset(load); });
+}
+
+bool ascii::ContentManager::CancelLoad(AssetType type, Handle handle)
+{
+    auto it = mLoadsInFlight.find(LoadKey(type, handle));
+    if (it == mLoadsInFlight.end())
+    {
+        return false;
+    }
+
+    it->second->cancelled = true;
+    mLoadsInFlight.erase(it);
+    return true;
+}
+
+//static
+void ascii::ContentManager::DecodeAsset(PendingLoad* load)
+{
+    PROFILE_SCOPE("ContentManager::DecodeAsset");
+
+    switch (load->type)
+    {
+        case kImageAsset:
+            load->image = DecodedImage::Load(load->path, load->imageFormat);
+            break;
+
+        case kSoundAsset:
+            if (load->decodeAudio)
+            {
+                load->sound = Mix_LoadWAV_RW(VirtualFS::Open(load->path), 1);
+                if (!load->sound)
+                {
+                    Log::Error("Failed to load sound " + load->path);
+                    Log::SDLError();
+                }
+            }
+            break;
+
+        case kSoundGroupAsset:
+            if (load->decodeAudio)
+            {
+                // Sound files are loaded from the directory of the group JSON
+                string groupDirectory = HandleDirectory(load->handle);
+
+                Json::Value* groupJson = Json::Load(load->path);
+                Json::Value sounds = (*groupJson)["sounds"];
+
+                for (Json::ArrayIndex idx = 0; idx < sounds.size(); ++idx)
+                {
+                    string soundPath = FileAccessPath(SOUND_DIRECTORY + groupDirectory + sounds[idx].asString());
+
+                    Mix_Chunk* sound = Mix_LoadWAV_RW(VirtualFS::Open(soundPath), 1);
+                    if (!sound)
+                    {
+                        Log::Error("Failed to load sound for group '" + load->name + "': " + soundPath);
+                    }
+                    load->groupSounds.push_back(sound);
+                    load->groupSoundPaths.push_back(soundPath);
+                }
+
+                delete groupJson;
+            }
+            break;
+
+        case kTrackAsset:
+            if (load->decodeAudio)
+            {
+                load->track = Mix_LoadMUS_RW(VirtualFS::Open(load->path), 1);
+                if (!load->track)
+                {
+                    Log::Error("Failed to load music file: " + load->path);
+                    Log::SDLError();
+                }
+            }
+            break;
+
+        case kSurfaceAsset:
+            load->surface = SurfaceManager::LoadSurfaceFile(load->path);
+            break;
+
+        case kStyleAsset:
+            load->style = DialogStyle::FromFile(load->path);
+            break;
+
+        case kTextAsset:
+            Log::Print("Loading text file: " + load->path);
+            load->json = Json::Load(load->path);
+            break;
+
+        default:
+            break;
+    }
+
+    load->decoded.store(true, memory_order_release);
+}
+
+void ascii::ContentManager::FinalizeLoads(bool limited)
+{
+    PROFILE_SCOPE("ContentManager::FinalizeLoads");
+
+    Uint64 start = SDL_GetPerformanceCounter();
+    Uint64 budget = (Uint64) mLoadBudgetMS * SDL_GetPerformanceFrequency() / 1000;
+
+    // Loads finish in any order, so hand over whichever are ready, keeping
+    // the rest in the order they were queued
+    size_t kept = 0;
+    bool spent = false;
+
+    for (size_t i = 0; i < mPendingLoads.size(); ++i)
+    {
+        PendingLoad* load = mPendingLoads[i];
+
+        if (spent || !load->decoded.load(memory_order_acquire))
+        {
+            mPendingLoads[kept++] = load;
+            continue;
+        }
+
+        FinalizeLoad(load);
+
+        spent = limited && SDL_GetPerformanceCounter() - start >= budget;
+    }
+
+    mPendingLoads.resize(kept);
+}
+
+void ascii::ContentManager::FinalizeLoad(PendingLoad* load)
+{
+    if (load->cancelled)
+    {
+        // Nothing decoded yet is safe to free too, as the load's worker is
+        // either finished or was stopped
+        delete load->image;
+        Mix_FreeChunk(load->sound);
+        for (auto it = load->groupSounds.begin(); it != load->groupSounds.end(); ++it)
+        {
+            Mix_FreeChunk(*it);
+        }
+        Mix_FreeMusic(load->track);
+        delete load->surface;
+        delete load->style;
+        delete load->json;
+
+        delete load;
+        return;
+    }
+
+    mLoadsInFlight.erase(LoadKey(load->type, load->handle));
+
+    switch (load->type)
+    {
+        case kImageAsset:
+            imageCache()->addTexture(load->name, load->image, load->path);
+            break;
+
+        case kSoundAsset:
+            if (load->decodeAudio)
+            {
+                mpSoundManager->addSound(load->name, load->sound, load->path);
+            }
+            break;
+
+        case kSoundGroupAsset:
+            for (size_t i = 0; i < load->groupSounds.size(); ++i)
+            {
+                mpSoundManager->addGroupSound(load->name, load->groupSounds[i], load->groupSoundPaths[i]);
+            }
+            break;
+
+        case kTrackAsset:
+            if (load->decodeAudio)
+            {
+                mpSoundManager->addTrack(load->name, load->track);
+            }
+            break;
+
+        case kSurfaceAsset:
+            mpSurfaceManager->AddSurface(load->name, load->surface);
+            break;
+
+        case kStyleAsset:
+            mpStyleManager->AddStyle(load->name, load->style);
+            break;
+
+        case kTextAsset:
+            mpTextManager->AddFile(load->handle, load->json);
+            break;
+
+        default:
+            break;
+    }
+
+    delete load;
+}
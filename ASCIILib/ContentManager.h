@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <vector>
 #include <algorithm>
 using namespace std;
@@ -14,6 +15,7 @@ using namespace ascii;
 
 #include "content.h"
 #include "json.h"
+#include "WorkerPool.h"
 
 namespace ascii
 {
@@ -50,17 +52,38 @@ namespace ascii
             // are now required
             void UpdateContent();
 
+            // Assets the last UpdateContent() call started loading, and the
+            // ones it freed
+            const ContentGroup& LoadedLastUpdate() { return mLastLoaded; }
+            const ContentGroup& FreedLastUpdate() { return mLastFreed; }
+
+            // In async mode, files are read and decoded on worker threads.
+            // Each call to UpdateContent() then hands whatever is ready to
+            // the sub-managers, for up to the load budget, so requiring a
+            // group never freezes the game. Off by default, or on with the
+            // "async-content" global arg
+            void SetAsyncLoading(bool async);
+            bool AsyncLoading() { return mpWorkers != NULL; }
+            // Milliseconds UpdateContent() may spend handing over loaded
+            // assets. At least one is handed over per call
+            void SetLoadBudget(int ms) { mLoadBudgetMS = ms; }
+
+            // Whether every asset of a required group is loaded. False until
+            // UpdateContent() has been called after requiring it
+            bool ContentGroupLoaded(string groupName);
+            // Whether any asset is still being loaded
+            bool LoadingContent() { return !mPendingLoads.empty(); }
+            // Wait for every asset being loaded and hand them all over
+            void FinishLoading();
+
             SoundManager* soundManager() { return mpSoundManager; }
             SurfaceManager* surfaceManager() { return mpSurfaceManager; }
             StyleManager* styleManager() { return mpStyleManager; }
             TextManager* textManager() { return mpTextManager; }
             ImageCache* imageCache();
         private:
-            // Process a handle list. If any handle from the first list is not
-            // present in the second one, the AssetProcessor function will be
-            // called with the handle as the only argument
-            void ProcessHandleList(HandleList& handleList,
-                    HandleList& retainedHandles, AssetProcessor process);
+            // Call the AssetProcessor function with every handle in the list
+            void ProcessHandleList(HandleList& handleList, AssetProcessor process);
 
             // Asset loaders and unloaders
             void LoadImage(Handle imageHandle);
@@ -78,6 +101,77 @@ namespace ascii
             void LoadText(Handle textHandle);
             void FreeText(Handle textHandle);
 
+            enum AssetType
+            {
+                kImageAsset,
+                kSoundAsset,
+                kSoundGroupAsset,
+                kTrackAsset,
+                kSurfaceAsset,
+                kStyleAsset,
+                kTextAsset,
+                kAssetTypeCount
+            };
+
+            // The handle list of the given type of asset in a group
+            static HandleList& Handles(ContentGroup& group, AssetType type);
+
+            // Count references to every asset of a group, adding those which
+            // weren't referenced before to outAcquired
+            void AcquireGroup(ContentGroup& group, ContentGroup* outAcquired);
+            // Drop references to every asset of a group, adding those which
+            // are no longer referenced to outReleased
+            void ReleaseGroup(ContentGroup& group, ContentGroup* outReleased);
+            // Keep the images and sounds of a locked group from being
+            // evicted by their caches' memory budgets, or stop keeping them
+            void PinGroup(ContentGroup& group, bool pin);
+
+            // An asset being loaded in async mode. Only the worker decoding
+            // it touches the results until decoded is set
+            struct PendingLoad
+            {
+                PendingLoad()
+                    : imageFormat(0), decodeAudio(false), cancelled(false), decoded(false),
+                    image(NULL), sound(NULL), track(NULL), surface(NULL),
+                    style(NULL), json(NULL) { }
+
+                AssetType type;
+                Handle handle;
+                AssetName name;
+                string path;
+                Uint32 imageFormat;
+                bool decodeAudio;
+                // Set when the asset is freed before it finishes loading
+                bool cancelled;
+                atomic<bool> decoded;
+
+                DecodedImage* image;
+                Mix_Chunk* sound;
+                vector<Mix_Chunk*> groupSounds;
+                vector<string> groupSoundPaths;
+                Mix_Music* track;
+                Surface* surface;
+                DialogStyle* style;
+                Json::Value* json;
+            };
+
+            typedef pair<AssetType, Handle> LoadKey;
+
+            // Start decoding an asset on the worker threads
+            void QueueLoad(AssetType type, Handle handle, string path);
+            // Read and decode an asset. Runs on a worker thread
+            static void DecodeAsset(PendingLoad* load);
+            // Hand over decoded assets, until the budget is spent if limited
+            void FinalizeLoads(bool limited);
+            // Hand a decoded asset to its sub-manager and delete the load,
+            // or throw the asset away if it was cancelled
+            void FinalizeLoad(PendingLoad* load);
+            // Keep an asset which is still loading from being handed over.
+            // Returns false if it isn't loading
+            bool CancelLoad(AssetType type, Handle handle);
+            // Whether any handle of the list is still loading
+            bool HandlesLoading(AssetType type, HandleList& handles);
+
             // Sub-Managers
             Game* mpGame;
             SoundManager* mpSoundManager;
@@ -88,5 +182,18 @@ namespace ascii
             map<string, ContentGroup> mContentGroups;
             map<string, ContentGroup> mRequiredGroups;
             vector<ContentGroup> mReleasedGroups;
+
+            // How many of the groups in mContentGroups reference each asset
+            HandleRegistry mRegistries[kAssetTypeCount];
+            ContentGroup mLastLoaded;
+            ContentGroup mLastFreed;
+
+            // Async loading
+            WorkerPool* mpWorkers;
+            int mLoadBudgetMS;
+            // Loads in the order they were queued, including cancelled ones
+            vector<PendingLoad*> mPendingLoads;
+            // Loads which haven't been handed over or cancelled yet
+            map<LoadKey, PendingLoad*> mLoadsInFlight;
     };
 }
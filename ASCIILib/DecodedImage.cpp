@@ -0,0 +1,431 @@
+#include "DecodedImage.h"
+
+#include <atomic>
+#include <stdio.h>
+#include <string.h>
+#include <sstream>
+
+#include <SDL_image.h>
+
+#include "FilePaths.h"
+#include "Log.h"
+#include "MappedFile.h"
+#include "Profiler.h"
+#include "VirtualFS.h"
+
+
+namespace
+{
+    // CACHE FILE FORMAT
+    //
+    // Header numbers are little-endian. Pixels are stored in the machine's
+    // own byte order, as the cache never leaves the machine it was made on.
+    //
+    // Header: magic "IMGC", Uint16 version, Uint16 flags, Uint32 pixel
+    // format, Uint32 width, Uint32 height, Uint32 pitch, Uint32 color key,
+    // Sint64 modified time of the source image, Uint32 source path length,
+    // Uint32 pixel data size.
+    //
+    // Then the source path without a terminator, and the pixel data, which
+    // is either raw rows or run-length encoded pixels.
+    const char kCacheMagic[4] = { 'I', 'M', 'G', 'C' };
+    const Uint16 kCacheVersion = 1;
+    const size_t kHeaderSize = 44;
+    const char* kCacheExtension = ".imgc";
+
+    const Uint16 kCompressedFlag = 1 << 0;
+    const Uint16 kBlendedFlag = 1 << 1;
+
+    // Longest run or literal span in the run-length encoding
+    const size_t kMaxSpan = 128;
+
+    // Only the first failure to write the cache is worth a warning
+    atomic<bool> sWarnedWriteFailure(false);
+
+    Uint64 ReadLE(const Uint8* bytes, int count)
+    {
+        Uint64 value = 0;
+        for (int i = count - 1; i >= 0; --i)
+        {
+            value = (value << 8) | bytes[i];
+        }
+        return value;
+    }
+
+    void WriteLE(vector<Uint8>& bytes, Uint64 value, int count)
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            bytes.push_back((Uint8) (value >> (i * 8)));
+        }
+    }
+
+    // Pack a color key into one number, so that no key differs from none
+    Uint32 PackColorKey(const Color& colorKey)
+    {
+        if (colorKey.isNone)
+        {
+            return 0;
+        }
+
+        return (1 << 24) | (colorKey.r << 16) | (colorKey.g << 8) | colorKey.b;
+    }
+
+    // Name of an image's cache file, from a 64-bit FNV-1a hash of its path.
+    // Collisions are caught by the path stored in the file
+    string CacheFilename(const string& path)
+    {
+        Uint64 hash = 14695981039346656037ULL;
+        for (size_t i = 0; i < path.size(); ++i)
+        {
+            hash ^= (Uint8) path[i];
+            hash *= 1099511628211ULL;
+        }
+
+        char name[17];
+        snprintf(name, sizeof(name), "%08x%08x", (Uint32) (hash >> 32), (Uint32) hash);
+        return string(name) + kCacheExtension;
+    }
+
+    // Run-length encode 32-bit pixels. Each span starts with a byte whose
+    // high bit marks a run of one repeated pixel, and whose low bits hold
+    // the span's length minus one. Literal spans are followed by all their
+    // pixels, runs by just the one
+    void EncodeRuns(const Uint32* pixels, size_t count, vector<Uint8>& out)
+    {
+        size_t i = 0;
+
+        while (i < count)
+        {
+            size_t run = 1;
+            while (i + run < count && run < kMaxSpan && pixels[i + run] == pixels[i])
+            {
+                ++run;
+            }
+
+            if (run > 1)
+            {
+                out.push_back((Uint8) (0x80 | (run - 1)));
+                const Uint8* pixel = (const Uint8*) &pixels[i];
+                out.insert(out.end(), pixel, pixel + 4);
+                i += run;
+                continue;
+            }
+
+            // Gather pixels until the next run starts
+            size_t start = i;
+            do
+            {
+                ++i;
+            } while (i < count && i - start < kMaxSpan
+                    && !(i + 1 < count && pixels[i + 1] == pixels[i]));
+
+            out.push_back((Uint8) (i - start - 1));
+            const Uint8* literal = (const Uint8*) &pixels[start];
+            out.insert(out.end(), literal, literal + (i - start) * 4);
+        }
+    }
+
+    // Returns false if the data doesn't decode to exactly count pixels
+    bool DecodeRuns(const Uint8* data, size_t size, Uint32* pixels, size_t count)
+    {
+        const Uint8* end = data + size;
+        size_t i = 0;
+
+        while (data < end)
+        {
+            Uint8 header = *data++;
+            size_t span = (header & 0x7F) + 1;
+
+            if (span > count - i)
+            {
+                return false;
+            }
+
+            if (header & 0x80)
+            {
+                if (end - data < 4)
+                {
+                    return false;
+                }
+
+                Uint32 pixel;
+                memcpy(&pixel, data, 4);
+                data += 4;
+
+                for (size_t j = 0; j < span; ++j)
+                {
+                    pixels[i++] = pixel;
+                }
+            }
+            else
+            {
+                if ((size_t) (end - data) < span * 4)
+                {
+                    return false;
+                }
+
+                memcpy(&pixels[i], data, span * 4);
+                data += span * 4;
+                i += span;
+            }
+        }
+
+        return i == count;
+    }
+}
+
+string ascii::DecodedImage::sCacheDirectory;
+SDL_SpinLock ascii::DecodedImage::sCacheDirectoryLock = 0;
+
+//static
+ascii::DecodedImage* ascii::DecodedImage::Load(string path, Uint32 format, Color colorKey)
+{
+    PROFILE_SCOPE("DecodedImage::Load");
+
+    string cacheDirectory = CacheDirectory();
+    string cachePath;
+    Sint64 modifiedTime = -1;
+
+    if (!cacheDirectory.empty())
+    {
+        modifiedTime = VirtualFS::ModifiedTime(path);
+        cachePath = cacheDirectory + CacheFilename(path);
+
+        if (modifiedTime != -1)
+        {
+            DecodedImage* image = ReadCache(cachePath, path, modifiedTime, format, colorKey);
+            if (image)
+            {
+                return image;
+            }
+        }
+    }
+
+    SDL_Surface* surface = IMG_Load_RW(VirtualFS::Open(path), 1);
+    if (!surface)
+    {
+        Log::Error("Failed to load texture: " + path);
+        Log::SDLError();
+        return NULL;
+    }
+
+    DecodedImage* image = FromSurface(surface, format, colorKey);
+
+    if (image && modifiedTime != -1)
+    {
+        image->writeCache(cachePath, path, modifiedTime, colorKey);
+    }
+
+    return image;
+}
+
+//static
+ascii::DecodedImage* ascii::DecodedImage::FromSurface(SDL_Surface* surface, Uint32 format,
+        Color colorKey)
+{
+    if (!surface)
+    {
+        return NULL;
+    }
+
+    if (!colorKey.isNone)
+    {
+        SDL_SetColorKey(surface, SDL_ENABLE, colorKey.ToUint32(surface->format));
+    }
+
+    // Same test SDL uses when it creates a texture from a surface
+    Uint32 key;
+    bool blended = SDL_GetColorKey(surface, &key) == 0
+        || surface->format->Amask != 0;
+
+    // Conversion to a format with alpha turns the color key into
+    // transparent pixels
+    SDL_Surface* converted = SDL_ConvertSurfaceFormat(surface, format, 0);
+    SDL_FreeSurface(surface);
+
+    if (!converted)
+    {
+        Log::Error("Failed to convert image to the texture format");
+        Log::SDLError();
+        return NULL;
+    }
+
+    DecodedImage* image = new DecodedImage();
+    image->width = converted->w;
+    image->height = converted->h;
+    image->pitch = converted->w * 4;
+    image->format = format;
+    image->blended = blended;
+    image->pixels.resize((size_t) image->pitch * image->height);
+
+    SDL_LockSurface(converted);
+    for (int y = 0; y < image->height; ++y)
+    {
+        memcpy(&image->pixels[(size_t) y * image->pitch],
+                (const Uint8*) converted->pixels + (size_t) y * converted->pitch,
+                image->pitch);
+    }
+    SDL_UnlockSurface(converted);
+    SDL_FreeSurface(converted);
+
+    return image;
+}
+
+//static
+void ascii::DecodedImage::SetCacheDirectory(string directory)
+{
+    if (!directory.empty() && directory[directory.size() - 1] != '/'
+            && directory[directory.size() - 1] != '\\')
+    {
+        directory += PATH_SEPARATOR;
+    }
+
+    SDL_AtomicLock(&sCacheDirectoryLock);
+    sCacheDirectory = directory;
+    SDL_AtomicUnlock(&sCacheDirectoryLock);
+}
+
+//static
+string ascii::DecodedImage::CacheDirectory()
+{
+    SDL_AtomicLock(&sCacheDirectoryLock);
+    string directory = sCacheDirectory;
+    SDL_AtomicUnlock(&sCacheDirectoryLock);
+    return directory;
+}
+
+//static
+ascii::DecodedImage* ascii::DecodedImage::ReadCache(const string& cachePath, const string& path,
+        Sint64 modifiedTime, Uint32 format, Color colorKey)
+{
+    MappedFile file(cachePath);
+
+    if (!file.isOpen() || file.size() < kHeaderSize)
+    {
+        return NULL;
+    }
+
+    const Uint8* data = file.data();
+
+    if (memcmp(data, kCacheMagic, 4) != 0 || ReadLE(data + 4, 2) != kCacheVersion)
+    {
+        return NULL;
+    }
+
+    Uint16 flags = (Uint16) ReadLE(data + 6, 2);
+    Uint32 cachedFormat = (Uint32) ReadLE(data + 8, 4);
+    Uint32 width = (Uint32) ReadLE(data + 12, 4);
+    Uint32 height = (Uint32) ReadLE(data + 16, 4);
+    Uint32 pitch = (Uint32) ReadLE(data + 20, 4);
+    Uint32 cachedKey = (Uint32) ReadLE(data + 24, 4);
+    Sint64 cachedTime = (Sint64) ReadLE(data + 28, 8);
+    Uint32 pathLength = (Uint32) ReadLE(data + 36, 4);
+    Uint32 dataSize = (Uint32) ReadLE(data + 40, 4);
+
+    // Anything that would have changed the decode makes the cache stale
+    if (cachedFormat != format || cachedKey != PackColorKey(colorKey)
+            || cachedTime != modifiedTime || pathLength != path.size()
+            || pitch < width * 4 || pitch % 4 != 0
+            || file.size() - kHeaderSize < (Uint64) pathLength + dataSize
+            || memcmp(data + kHeaderSize, path.data(), pathLength) != 0)
+    {
+        return NULL;
+    }
+
+    const Uint8* pixelData = data + kHeaderSize + pathLength;
+    size_t pixelsSize = (size_t) pitch * height;
+
+    DecodedImage* image = new DecodedImage();
+    image->width = width;
+    image->height = height;
+    image->pitch = pitch;
+    image->format = format;
+    image->blended = (flags & kBlendedFlag) != 0;
+    image->pixels.resize(pixelsSize);
+
+    bool valid;
+    if (flags & kCompressedFlag)
+    {
+        valid = pixelsSize == 0
+            || DecodeRuns(pixelData, dataSize, (Uint32*) &image->pixels[0], pixelsSize / 4);
+    }
+    else
+    {
+        valid = dataSize == pixelsSize;
+        if (valid && pixelsSize > 0)
+        {
+            memcpy(&image->pixels[0], pixelData, pixelsSize);
+        }
+    }
+
+    if (!valid)
+    {
+        Log::Warning("Ignoring corrupt image cache file: " + cachePath);
+        delete image;
+        return NULL;
+    }
+
+    return image;
+}
+
+void ascii::DecodedImage::writeCache(const string& cachePath, const string& path,
+        Sint64 modifiedTime, Color colorKey)
+{
+    PROFILE_SCOPE("DecodedImage::writeCache");
+
+    // Pixel art compresses well. Photos don't, and are kept raw
+    vector<Uint8> encoded;
+    if (!pixels.empty())
+    {
+        EncodeRuns((const Uint32*) &pixels[0], pixels.size() / 4, encoded);
+    }
+    bool compressed = encoded.size() < pixels.size();
+    const vector<Uint8>& pixelData = compressed ? encoded : pixels;
+
+    vector<Uint8> header(kCacheMagic, kCacheMagic + 4);
+    WriteLE(header, kCacheVersion, 2);
+    WriteLE(header, (compressed ? kCompressedFlag : 0) | (blended ? kBlendedFlag : 0), 2);
+    WriteLE(header, format, 4);
+    WriteLE(header, width, 4);
+    WriteLE(header, height, 4);
+    WriteLE(header, pitch, 4);
+    WriteLE(header, PackColorKey(colorKey), 4);
+    WriteLE(header, (Uint64) modifiedTime, 8);
+    WriteLE(header, path.size(), 4);
+    WriteLE(header, pixelData.size(), 4);
+
+    // Write under a name of this thread's own first, so that no other
+    // loader ever reads a half-written file
+    stringstream tempPath;
+    tempPath << cachePath << "." << SDL_ThreadID() << ".tmp";
+
+    MakeDirectory(cachePath.substr(0, cachePath.find_last_of("/\\")));
+
+    FILE* file = fopen(tempPath.str().c_str(), "wb");
+    bool written = file
+        && fwrite(header.data(), 1, header.size(), file) == header.size()
+        && fwrite(path.data(), 1, path.size(), file) == path.size()
+        && fwrite(pixelData.data(), 1, pixelData.size(), file) == pixelData.size();
+
+    if (file)
+    {
+        written = fclose(file) == 0 && written;
+    }
+
+#ifdef _WIN32
+    // Renaming can't replace an existing file on Windows
+    remove(cachePath.c_str());
+#endif
+    written = written && rename(tempPath.str().c_str(), cachePath.c_str()) == 0;
+
+    if (!written)
+    {
+        remove(tempPath.str().c_str());
+
+        if (!sWarnedWriteFailure.exchange(true))
+        {
+            Log::Warning("Failed to write image cache file: " + cachePath);
+        }
+    }
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <string>
+#include <vector>
+using namespace std;
+
+#include <SDL.h>
+
+#include "Color.h"
+
+namespace ascii
+{
+
+    // An image decoded into the pixel format textures are created in, with
+    // its color key already turned into transparency, ready to be uploaded.
+    //
+    // Decodes are kept in an on-disk cache keyed by the image's path and
+    // modified time, so a PNG or JPG is only decompressed again after it
+    // changes
+    class DecodedImage
+    {
+        public:
+            // Decode an image, or read it back from the cache. Returns NULL
+            // if the image couldn't be loaded. The format must be a 32-bit
+            // format with alpha. Safe to call from any thread
+            static DecodedImage* Load(string path, Uint32 format,
+                    Color colorKey=Color::None);
+
+            // Convert an image which was already decoded, freeing the
+            // surface. Nothing is cached
+            static DecodedImage* FromSurface(SDL_Surface* surface, Uint32 format,
+                    Color colorKey=Color::None);
+
+            // Where cached decodes are kept. Caching is off while this is
+            // empty, which it is by default
+            static void SetCacheDirectory(string directory);
+            static string CacheDirectory();
+
+            int width;
+            int height;
+            int pitch;
+            Uint32 format;
+            // Whether the image has any transparency to blend
+            bool blended;
+            vector<Uint8> pixels;
+
+        private:
+            DecodedImage() { }
+
+            // Read a cached decode. Returns NULL if there is none, or it's
+            // out of date
+            static DecodedImage* ReadCache(const string& cachePath, const string& path,
+                    Sint64 modifiedTime, Uint32 format, Color colorKey);
+            void writeCache(const string& cachePath, const string& path,
+                    Sint64 modifiedTime, Color colorKey);
+
+            static string sCacheDirectory;
+            static SDL_SpinLock sCacheDirectoryLock;
+    };
+
+}
@@ -4,6 +4,7 @@
 
 #include "Surface.h"
 #include "Game.h"
+#include "Profiler.h"
 using namespace ascii;
 
 
@@ -12,7 +13,7 @@ Rectangle ascii::DialogScene::msLastFrame = Rectangle();
 
 
 ascii::DialogScene::DialogScene(DialogStyle* style, Game* game)
-    : mStyle(style), mCurrentFrame(0), mFilled(false), mSaveLineBreak(false),
+    : mStyle(style), mCurrentFrame(0), mFilled(false), mSaveLineBreak(false), mHiding(false),
     mpGame(game),
     // Dialog bubbles stretch downward by default
     mStretchDirection(STRETCH_DOWN),
@@ -173,6 +174,8 @@ void ascii::DialogScene::SetBubbleFrame(UnicodeString paragraph)
 
 void ascii::DialogScene::AddWord(UnicodeString word)
 {
+    PROFILE_SCOPE("DialogScene::AddWord");
+
     DialogFrame* nextFrame = FrameForWord(word);
 
     if (nextFrame)
@@ -326,6 +329,8 @@ int ascii::DialogScene::RevealedLetters()
 
 void ascii::DialogScene::RevealLetters(int amount)
 {
+    PROFILE_SCOPE("DialogScene::RevealLetters");
+
     // Reveal letters from every text frame that has letters to reveal,
     // in case there are multiple revealing words simultaneously
     for (auto it = mFrames.begin(); it != mFrames.end(); ++it)
@@ -371,10 +376,14 @@ void ascii::DialogScene::HideLetters(int amount)
         int cellsBeforeHide = (maxWidth - pFrame->Width()) / 2;
         pFrame->HideLetters(amount, cellsBeforeHide);
     }
+
+    mHiding = true;
 }
 
 void ascii::DialogScene::Draw(Graphics& graphics, Preferences* config)
 {
+    PROFILE_SCOPE("DialogScene::Draw");
+
     // Draw dynamically sized frames based on the style's frame style,
     // if it has one
     for (auto it = mFrameSurfaces.begin(); it != mFrameSurfaces.end(); ++it)
@@ -390,6 +399,14 @@ void ascii::DialogScene::Draw(Graphics& graphics, Preferences* config)
     {
         it->Draw(graphics, config);
     }
+
+    // Letters are revealed and hidden a few at a time by the game's updates,
+    // so an idle game loop has to keep running until they're done
+    mHiding = mHiding && !AllWordsHidden();
+    if (mHiding || !AllWordsRevealed())
+    {
+        mpGame->ScheduleWakeup(0);
+    }
 }
 
 void ascii::DialogScene::DrawCursor(Graphics& graphics)
@@ -163,6 +163,8 @@ class DialogScene
         bool mSaveLineBreak;
         // Flag to wait and clear this scene before adding more words
         bool mFilled;
+        // Whether letters were hidden since the scene was last fully hidden
+        bool mHiding;
 
         StretchDirection mStretchDirection;
 
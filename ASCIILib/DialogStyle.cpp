@@ -8,6 +8,7 @@
 #include "FilePaths.h"
 #include "content.h"
 #include "parsing.h"
+#include "SurfaceManager.h"
 
 
 // Static redeclarations
@@ -150,7 +151,7 @@ ascii::DialogStyle* ascii::DialogStyle::FromFile(string path)
 
         // Load the frame surface
         string framePath = "content/surfaces/" + frameHandle;
-        Surface* frameSurface = Surface::FromFile(FileAccessPath(framePath).c_str());
+        Surface* frameSurface = SurfaceManager::LoadSurfaceFile(FileAccessPath(framePath));
 
         /* The frame surface must have odd-numbered dimensions,
          * because the edges and center of the frame are defined in the surface
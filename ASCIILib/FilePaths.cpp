@@ -1,5 +1,12 @@
 #include "FilePaths.h"
 
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
 #ifdef MAC
 namespace mac
 {
@@ -35,3 +42,44 @@ string ascii::FileAccessPath(string path)
 #endif
 	return path;
 }
+
+Sint64 ascii::FileModifiedTime(string path)
+{
+#ifdef _WIN32
+    struct _stat64 info;
+    if (_stat64(path.c_str(), &info) != 0)
+    {
+        return -1;
+    }
+#else
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0)
+    {
+        return -1;
+    }
+#endif
+
+    return (Sint64) info.st_mtime;
+}
+
+bool ascii::MakeDirectory(string path)
+{
+    // Create each directory along the path in turn
+    for (size_t end = path.find_first_of("/\\", 1); ; end = path.find_first_of("/\\", end + 1))
+    {
+        string directory = path.substr(0, end);
+
+#ifdef _WIN32
+        _mkdir(directory.c_str());
+#else
+        mkdir(directory.c_str(), 0777);
+#endif
+
+        if (end == string::npos)
+        {
+            break;
+        }
+    }
+
+    return FileModifiedTime(path) != -1;
+}
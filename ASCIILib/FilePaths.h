@@ -6,6 +6,8 @@
 #include <stdlib.h>
 using namespace std;
 
+#include <SDL.h>
+
 // Unix includes
 #if defined( MAC ) || defined( LINUX )
 #include <dirent.h>
@@ -177,4 +179,12 @@ string GetWorkingDirectory();
 // appropriate path for accessing the file on the current operating system
 string FileAccessPath(string path);
 
+// Retrieve when the file at the given path was last modified, in seconds
+// since the epoch, or -1 if it doesn't exist
+Sint64 FileModifiedTime(string path);
+
+// Create a directory, along with any of its parents which are missing.
+// Returns false if it still doesn't exist afterward
+bool MakeDirectory(string path);
+
 }
@@ -1,33 +1,232 @@
 #include "FileReader.h"
 
 #include <cstdio>
-#include "unicode/ustdio.h"
+
+#include <SDL.h>
 
 #include "Log.h"
+#include "VirtualFS.h"
 using namespace ascii;
 
+// Plain ASCII is copied 16 bytes at a time with SSE2 where it's available.
+// Every x86-64 CPU has it, so there is no need to check at runtime
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ASCIILIB_SSE2_READER
+#include <emmintrin.h>
+#endif
+
+
+namespace
+{
+    const int kBlockSize = 16;
+
+    const UChar kReplacementChar = 0xFFFD;
+
+    // Index of the lowest set bit of a nonzero mask
+    int LowestBit(int mask)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_ctz((unsigned int) mask);
+#else
+        int bit = 0;
+        while (!(mask & (1 << bit)))
+        {
+            ++bit;
+        }
+        return bit;
+#endif
+    }
+
+    // Widen the next block of input into UTF-16, and return how many of its
+    // bytes are plain ASCII that need no special treatment. Only those count
+    // as copied. The rest are left for the character-at-a-time path. There
+    // must be at least one byte readable past the block, for checking double
+    // spaces across its end, and room for a whole block in dest
+    int CopyAsciiBlock(const Uint8* src, UChar* dest, bool lintSpaces)
+    {
+#ifdef ASCIILIB_SSE2_READER
+        __m128i block = _mm_loadu_si128((const __m128i*) src);
+
+        __m128i zero = _mm_setzero_si128();
+        _mm_storeu_si128((__m128i*) dest, _mm_unpacklo_epi8(block, zero));
+        _mm_storeu_si128((__m128i*) (dest + 8), _mm_unpackhi_epi8(block, zero));
+
+        int copied = kBlockSize;
 
-map<UChar, bool> ascii::FileReader::charsEncountered;
+        int nonAscii = _mm_movemask_epi8(block);
+        if (nonAscii != 0)
+        {
+            copied = LowestBit(nonAscii);
+        }
+
+        if (lintSpaces)
+        {
+            // Compare each byte and the byte after it against spaces at once.
+            // The first space of a pair is kept, the second one is skipped
+            __m128i spaces = _mm_set1_epi8(' ');
+            __m128i next = _mm_loadu_si128((const __m128i*) (src + 1));
+            __m128i doubled = _mm_and_si128(_mm_cmpeq_epi8(block, spaces), _mm_cmpeq_epi8(next, spaces));
+
+            int doubledMask = _mm_movemask_epi8(doubled);
+            if (doubledMask != 0 && LowestBit(doubledMask) + 1 < copied)
+            {
+                copied = LowestBit(doubledMask) + 1;
+            }
+        }
+
+        return copied;
+#else
+        int copied = 0;
+        for (; copied < kBlockSize; ++copied)
+        {
+            if (src[copied] >= 0x80)
+            {
+                break;
+            }
+
+            dest[copied] = src[copied];
+
+            if (lintSpaces && src[copied] == ' ' && src[copied+1] == ' ')
+            {
+                ++copied;
+                break;
+            }
+        }
+        return copied;
+#endif
+    }
+
+    // Decode one UTF-8 sequence starting at src, returning how many bytes it
+    // used. Malformed sequences (overlong forms, surrogates, stray
+    // continuation bytes, truncation) decode to U+FFFD, consuming as much of
+    // the sequence as was valid, the same way ICU's converter does
+    int DecodeUTF8(const Uint8* src, const Uint8* end, Uint32* codePoint)
+    {
+        Uint8 lead = src[0];
+
+        if (lead < 0x80)
+        {
+            *codePoint = lead;
+            return 1;
+        }
+
+        int length;
+        Uint32 value;
+        // The second byte's range rules out overlong forms, surrogates and
+        // values past U+10FFFF
+        Uint8 secondMin = 0x80;
+        Uint8 secondMax = 0xBF;
+
+        if (lead >= 0xC2 && lead <= 0xDF)
+        {
+            length = 2;
+            value = lead & 0x1F;
+        }
+        else if (lead >= 0xE0 && lead <= 0xEF)
+        {
+            length = 3;
+            value = lead & 0x0F;
+            if (lead == 0xE0) secondMin = 0xA0;
+            if (lead == 0xED) secondMax = 0x9F;
+        }
+        else if (lead >= 0xF0 && lead <= 0xF4)
+        {
+            length = 4;
+            value = lead & 0x07;
+            if (lead == 0xF0) secondMin = 0x90;
+            if (lead == 0xF4) secondMax = 0x8F;
+        }
+        else
+        {
+            *codePoint = kReplacementChar;
+            return 1;
+        }
+
+        for (int i = 1; i < length; ++i)
+        {
+            Uint8 min = i == 1 ? secondMin : 0x80;
+            Uint8 max = i == 1 ? secondMax : 0xBF;
+
+            if (src + i >= end || src[i] < min || src[i] > max)
+            {
+                *codePoint = kReplacementChar;
+                return i;
+            }
+            value = (value << 6) | (src[i] & 0x3F);
+        }
+
+        *codePoint = value;
+        return length;
+    }
+
+    // Finds the line and column of positions in a file, only when a message
+    // needs them. Each search continues from the last one, so the file is
+    // only scanned once no matter how many positions are looked up
+    struct LineCounter
+    {
+        LineCounter(const Uint8* begin)
+            : position(begin), lineStart(begin), line(1) { }
+
+        void Locate(const Uint8* target, int* outLine, int* outColumn)
+        {
+            for (; position < target; ++position)
+            {
+                if (*position == '\n')
+                {
+                    ++line;
+                    lineStart = position + 1;
+                }
+            }
+
+            // Count characters, not bytes, by skipping continuation bytes
+            int column = 1;
+            for (const Uint8* c = lineStart; c < target; ++c)
+            {
+                if ((*c & 0xC0) != 0x80)
+                {
+                    ++column;
+                }
+            }
+
+            *outLine = line;
+            *outColumn = column;
+        }
+
+        const Uint8* position;
+        const Uint8* lineStart;
+        int line;
+    };
+}
+
+
+bitset<65536> ascii::FileReader::charsEncountered;
+SDL_SpinLock ascii::FileReader::sCharsEncounteredLock = 0;
 void ascii::FileReader::PrintEncounteredChars()
 {
+    SDL_AtomicLock(&sCharsEncounteredLock);
+    bitset<65536> chars = charsEncountered;
+    SDL_AtomicUnlock(&sCharsEncounteredLock);
+
     UnicodeString str;
-    for (auto it = charsEncountered.begin(); it != charsEncountered.end(); ++it)
+    for (size_t i = 0; i < chars.size(); ++i)
     {
-        UChar uchar = it->first;
-        str += uchar;
+        if (chars[i])
+        {
+            str += (UChar) i;
+        }
     }
     Log::Print(str);
 }
 
 
 ascii::FileReader::FileReader(string path, bool runtimeLinting)
-    : mRuntimeLinting(runtimeLinting)
+    : mRuntimeLinting(runtimeLinting), mSwapsAscii(false)
 {
     Initialize(path);
 }
 
 ascii::FileReader::FileReader(string path, string characterSwapsPath, bool runtimeLinting)
-    : mRuntimeLinting(runtimeLinting)
+    : mRuntimeLinting(runtimeLinting), mSwapsAscii(false)
 {
     // Read the list of character swaps from the character swaps file,
     // if there is one
@@ -44,8 +243,8 @@ ascii::FileReader::FileReader(string path, string characterSwapsPath, bool runti
 
         if (idx == characterSwapsStr.length())
         {
-        Log::Print("Initializing character swap: " + charToSwap + " for " + charToUse);
-        Log::Print("Remaining swaps: " + characterSwapsStr);
+        Log::Debug("Initializing character swap: " + charToSwap + " for " + charToUse);
+        Log::Debug("Remaining swaps: " + characterSwapsStr);
 
         mCharacterSwaps[UnicodeString(charToSwap)] = charToUse;
             break;
@@ -53,18 +252,27 @@ ascii::FileReader::FileReader(string path, string characterSwapsPath, bool runti
 
         characterSwapsStr = UnicodeString(characterSwapsStr, idx+1);
 
-        Log::Print("Initializing character swap: " + charToSwap + " for " + charToUse);
-        Log::Print("Remaining swaps: " + characterSwapsStr);
+        Log::Debug("Initializing character swap: " + charToSwap + " for " + charToUse);
+        Log::Debug("Remaining swaps: " + characterSwapsStr);
 
         mCharacterSwaps[UnicodeString(charToSwap)] = charToUse;
     }
 
-    //mForbiddenCharacters.trim(); // Trim the trailing newline
+    // Only single characters can be matched while reading
+    if (!mCharacterSwaps.empty())
+    {
+        mSwappable.assign(65536, false);
 
-    //Log::Print("Loading file ", false);
-    //Log::Print(path, false);
-    //Log::Print(" with forbidden characters: ", false);
-    //Log::Print(mForbiddenCharacters);
+        for (auto it = mCharacterSwaps.begin(); it != mCharacterSwaps.end(); ++it)
+        {
+            if (it->first.length() == 1)
+            {
+                UChar swapped = it->first[0];
+                mSwappable[swapped] = true;
+                mSwapsAscii = mSwapsAscii || swapped < 0x80;
+            }
+        }
+    }
 
     Initialize(path);
 }
@@ -77,18 +285,15 @@ void FileReader::Initialize(string path)
     // If the file exists, parse each line from the file
     if (mExists)
     {
-        ParseLines(contents, path);
+        ParseLines(contents);
     }
 }
 
 UnicodeString ascii::FileReader::ReadContents(string path)
 {
-    // Open the file
-    //Log("Opening file: " + path);
-    UFILE* ufile = u_fopen(path.c_str(), "r", NULL, "UTF-8");
-
-    // Check if the file exists and was opened properly
-    mExists = (ufile != NULL);
+    // Get the whole file at once, straight from its archive if it's packed
+    VirtualFile file(path);
+    mExists = file.isOpen();
 
     // Output a warning if the file wasn't found
     if (!mExists)
@@ -96,196 +301,175 @@ UnicodeString ascii::FileReader::ReadContents(string path)
         Log::Print("Possible error: Tried to open nonexistent file: " + path);
         return UnicodeString("");
     }
-    else
+
+    const Uint8* src = file.data();
+    const Uint8* end = src + file.size();
+
+    // Check if the UTF-8 Byte Order Mark is present, and strip it
+    if (file.size() >= 3 && src[0] == 0xEF && src[1] == 0xBB && src[2] == 0xBF)
     {
-        // Retrieve the size of the file
-        long fileSize = 0;
-        FILE* file = u_fgetfile(ufile);
-        fseek(file, 0, SEEK_END);
-        fileSize = ftell(file);
-        u_frewind(ufile);
+        Log::Warning("File contains UTF-8 byte order mark: " + path);
+        src += 3;
+    }
 
-        // Prepare enough space to read the entire string plus termination
-        UChar* contents = new UChar[fileSize + 1];
+    // A UTF-8 file never has more UTF-16 code units than bytes. Only swaps
+    // can make the contents grow past that
+    vector<UChar> contents(end - src + 1);
+    size_t index = 0;
 
-        // Read every character
-        long index = 0;
+    bool lintSpaces = mRuntimeLinting;
+    bool checkSwaps = !mSwappable.empty();
+    // Swaps of plain ASCII characters can't use the fast path at all
+    bool fastPath = !mSwapsAscii;
 
-        // Keep a working count of which line and character we're reading
-        int line = 1;
-        int lineCharacter = 0;
+    LineCounter lines(src);
 
-        while (!u_feof(ufile))
+    // Files can be read on more than one thread at once, so characters are
+    // gathered here and merged into charsEncountered when done
+    bitset<65536> encountered;
+
+    while (src < end)
+    {
+        // Copy plain ASCII in blocks, as long as that can't skip over a
+        // double space which started in the last block
+        if (fastPath && end - src > kBlockSize
+            && !(lintSpaces && index > 0 && contents[index-1] == UChar(' ') && *src == ' '))
         {
-            UChar nextChar = u_fgetc(ufile);
+            int copied = CopyAsciiBlock(src, &contents[index], lintSpaces);
+            src += copied;
+            index += copied;
 
-            // Make sure we never read two spaces in a row
-            if (mRuntimeLinting && index > 0 && contents[index-1] == UChar(' ') && nextChar == UChar(' '))
+            if (copied == kBlockSize)
             {
-                // Shrink the size by 1
-                
-//                Log::Print("Double space encountered at line ", false);
-//                Log::Print(line, false);
-//                Log::Print(" column ", false);
-//                Log::Print(lineCharacter, false);
-//                Log::Print(" of file ", false);
-//                Log::Print(path, false);
-//                Log::Print(". Skipping it");
-                
-                
-                UChar* newContents = ResizeContents(contents, &fileSize, fileSize - 1);
-                delete[] contents;
-                contents = newContents;
-                
-                ++lineCharacter;
                 continue;
             }
-            
-            // Make sure none of the characters we read are forbidden. Swap
-            // them with better ones if they are
-            if (mCharacterSwaps.find(UnicodeString(nextChar)) != mCharacterSwaps.end())
-            {
-                Log::Print(UnicodeString("Forbidden character '") + UnicodeString(nextChar) + UnicodeString("' found in file: ") + UnicodeString::fromUTF8(path));
-                // Print the line where we found it
-                Log::Print("Line: ", false);
-                Log::Print(line);
-                // And which column of the line
-                Log::Print("Column: ", false);
-                Log::Print(lineCharacter);
-
-                if (mRuntimeLinting)
-                {
-                    // Swap it for a more acceptable phrase
-                    UnicodeString useInstead = mCharacterSwaps[UnicodeString(nextChar)];
+        }
 
-                    Log::Print("Using " + useInstead + " instead");
+        // Otherwise, decode one character at a time
+        const Uint8* charStart = src;
+        Uint32 codePoint;
+        src += DecodeUTF8(src, end, &codePoint);
 
-                    // If the swap version is just a single character we don't need
-                    // to change anything
-                    if (useInstead.length() == 1)
-                    {
-                        nextChar = useInstead[0];
-                    }
-                    else
-                    {
-                        // Otherwise we need to expand the array we're using to
-                        // store the contents
-                        UChar* newContents = ResizeContents(contents, &fileSize, fileSize + useInstead.length()); // omit the +1 because useInstead's first char is already counted in filesize
-                        delete[] contents;
-                        contents = newContents;
-                    
-
-                        // Now add the replacement characters to the string
-                        for (int idx = 0; idx < useInstead.length(); ++idx)
-                        {
-                            Log::Print("Including the use instead phrase");
-                            contents[index++] = useInstead[idx];
-                            charsEncountered[useInstead[idx]] = true;
-
-                            //newlines won't be included in the swap phrases
-                            ++lineCharacter;
-                        }
-
-                        continue;
-                    }
-                }
-            }
+        // Characters outside the Basic Multilingual Plane become surrogate
+        // pairs, which are never swapped or linted
+        if (codePoint > 0xFFFF)
+        {
+            codePoint -= 0x10000;
+            UChar high = (UChar) (0xD800 + (codePoint >> 10));
+            UChar low = (UChar) (0xDC00 + (codePoint & 0x3FF));
+
+            contents[index++] = high;
+            contents[index++] = low;
+            encountered[high] = true;
+            encountered[low] = true;
+            continue;
+        }
 
-            // Add the character to the contents we're reading
-            contents[index++] = nextChar;
+        UChar nextChar = (UChar) codePoint;
 
-            // Mark that this character was found in one of the files, for
-            // debugging/font dev purposes
-            charsEncountered[nextChar] = true;
-            if (nextChar == UChar('}'))
-            {
-                Log::Print("Yeah it does happen");
-            }
+        // Make sure we never read two spaces in a row
+        if (lintSpaces && index > 0 && contents[index-1] == UChar(' ') && nextChar == UChar(' '))
+        {
+            continue;
+        }
 
-            // Update the current position in the file
-            if (nextChar == '\n')
+        // Make sure none of the characters we read are forbidden. Swap
+        // them with better ones if they are
+        if (checkSwaps && mSwappable[nextChar])
+        {
+            int line, column;
+            lines.Locate(charStart, &line, &column);
+
+            Log::Print(UnicodeString("Forbidden character '") + UnicodeString(nextChar) + UnicodeString("' found in file: ") + UnicodeString::fromUTF8(path));
+            // Print the line where we found it
+            Log::Print("Line: ", false);
+            Log::Print(line);
+            // And which column of the line
+            Log::Print("Column: ", false);
+            Log::Print(column);
+
+            if (mRuntimeLinting)
             {
-                ++line;
-                lineCharacter = 0;
-            }
-            ++lineCharacter;
-        }
+                // Swap it for a more acceptable phrase
+                const UnicodeString& useInstead = mCharacterSwaps[UnicodeString(nextChar)];
 
-        // Add the string termination
-        contents[index] = '\0';
+                Log::Debug("Using " + useInstead + " instead");
 
-        // Create a UnicodeString object
-        UnicodeString contentsUString(contents);
-        // Clean up the memory used to read the UChars
-        delete[] contents;
-        // Close the file
-        u_fclose(ufile);
+                // Make room for the phrase on top of the rest of the file
+                size_t needed = index + useInstead.length() + (end - src) + 1;
+                if (needed > contents.size())
+                {
+                    contents.resize(needed);
+                }
 
-        // Check if the UTF-8 Bit Order Mark is present
-		UChar a, b, c;
-		a = contentsUString[0];
-		b = contentsUString[1];
-		c = contentsUString[2];
+                for (int i = 0; i < useInstead.length(); ++i)
+                {
+                    contents[index++] = useInstead[i];
+                    if (useInstead[i] >= 0x80)
+                    {
+                        encountered[useInstead[i]] = true;
+                    }
+                }
 
+                continue;
+            }
+        }
 
-        if(!(a!=(UChar)0xEF || b!=(UChar)0xBB || c!=(UChar)0xBF))
-        {
-            Log::Error("Warning. File contains UTF-8 bit order mark: " + path);
+        // Add the character to the contents we're reading
+        contents[index++] = nextChar;
 
-            // Strip the BOM
-            contentsUString = contentsUString.tempSubString(3);//UnicodeString(contentsUString, 3);
+        // Mark that this character was found in one of the files, for
+        // debugging/font dev purposes. Every font has plain ASCII
+        if (nextChar >= 0x80)
+        {
+            encountered[nextChar] = true;
         }
+    }
 
-        return contentsUString;
+    if (encountered.any())
+    {
+        SDL_AtomicLock(&sCharsEncounteredLock);
+        charsEncountered |= encountered;
+        SDL_AtomicUnlock(&sCharsEncounteredLock);
     }
-}
 
-UChar* ascii::FileReader::ResizeContents(UChar* contents, long* fileSize, int newSize)
-{
-    UChar* newContents = new UChar[newSize];
-    copy(contents, contents + newSize, newContents);
-    
-    *fileSize = newSize + 1;
-    
-    contents = newContents;
-    
-    return newContents;
+    return UnicodeString(&contents[0], (int32_t) index);
 }
 
-
-void ascii::FileReader::ParseLines(UnicodeString contents, string path)
+void ascii::FileReader::ParseLines(const UnicodeString& contents)
 {
+    const UChar* chars = contents.getBuffer();
     int numChars = contents.length();
-    if (numChars > 0)
-    {
-        // Split the file contents by line endings
-        UnicodeString line = "";
-        for (int i = 0; i < numChars; ++i)
-        {
-            UChar nextChar = contents[i];
 
-            // Store the characters that are chained together as a line
-            if (nextChar == '\n' || nextChar == 0)
-            {
-                line += nextChar;
+    // Split the file contents by line endings, copying each run of
+    // characters between carriage returns in one go
+    UnicodeString line;
+    int runStart = 0;
+    for (int i = 0; i < numChars; ++i)
+    {
+        UChar nextChar = chars[i];
 
-                mLines.push_back(line);
-                line = "";
-            }
-            else if (nextChar == '\r')
-            {
-                continue;
-            }
-            else
-            {
-                line += nextChar;
-            }
+        if (nextChar == '\r')
+        {
+            line.append(chars, runStart, i - runStart);
+            runStart = i + 1;
         }
+        // Store the characters that are chained together as a line
+        else if (nextChar == '\n' || nextChar == 0)
+        {
+            line.append(chars, runStart, i + 1 - runStart);
+            runStart = i + 1;
 
-        // Make sure the last line is included
-        if (line.length() != 0)
             mLines.push_back(line);
+            line.remove();
+        }
     }
+
+    line.append(chars, runStart, numChars - runStart);
+
+    // Make sure the last line is included
+    if (line.length() != 0)
+        mLines.push_back(line);
 }
 
 
@@ -5,8 +5,12 @@
 #include <sstream>
 #include <deque>
 #include <map>
+#include <vector>
+#include <bitset>
 using namespace std;
 
+#include <SDL.h>
+
 #include "unicode/utypes.h"
 #include "unicode/unistr.h"
 using namespace icu;
@@ -41,26 +45,29 @@ namespace ascii
             // Return a string containing all text in the file being read.
             string FullContents();
 
-            // Print a string of every unicode character so far encountered while
-            // reading a file
+            // Print a string of every non-ASCII unicode character so far
+            // encountered while reading a file
             static void PrintEncounteredChars();
 
         private:
-            static map<UChar, bool> charsEncountered;
+            static bitset<65536> charsEncountered;
+            static SDL_SpinLock sCharsEncounteredLock;
             bool mRuntimeLinting;
         
             void Initialize(string path);
             // Retrieve the full UTF-8 contents
             UnicodeString ReadContents(string path);
             // Parse the UTF-8 contents of a file into individual lines of text
-            void ParseLines(UnicodeString contents, string path);
+            void ParseLines(const UnicodeString& contents);
 
-            UChar* ResizeContents(UChar* contents, long* fileSize, int newSize);
-        
             deque<UnicodeString> mLines;
             bool mExists;
 
             map<UnicodeString, UnicodeString> mCharacterSwaps;
+            // Flat lookup of which single characters have swaps, so that
+            // reading doesn't search the map for every character
+            vector<bool> mSwappable;
+            bool mSwapsAscii;
     };
 
 }
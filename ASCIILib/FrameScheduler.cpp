@@ -0,0 +1,202 @@
+#include "FrameScheduler.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+namespace
+{
+    // Updates are never more than this many frames behind. Past that, time
+    // is let go of instead of catching up, so one slow frame can't cause a
+    // run of slower ones
+    const int kMaxStepsPerFrame = 5;
+
+    // Leave this much of a wait to spinning, to make up for how late sleeps
+    // can wake up
+    const double kSpinMarginMS = 2.0;
+
+    // Number of frames kept for stats
+    const size_t kStatsFrames = 600;
+
+    const int kDefaultFrameCap = 60;
+}
+
+Uint64 ascii::FrameScheduler::sWakeup = 0;
+
+ascii::FrameScheduler::FrameScheduler()
+    : mFrequency(SDL_GetPerformanceFrequency()),
+    mFrameCap(0), mFrameTicks(0), mStepsPerSecond(0), mStepTicks(0),
+    mVsync(false), mFrameStart(0), mAccumulator(0), mStepRemainderMS(0),
+    mInterpolation(1), mIdleTicks(0), mIdleMS(0), mFrameTimes(kStatsFrames, 0), mNextFrameTime(0),
+    mFramesMeasured(0), mDropped(kStatsFrames, false)
+{
+    setFrameCap(kDefaultFrameCap);
+}
+
+void ascii::FrameScheduler::setFrameCap(int framesPerSecond)
+{
+    mFrameCap = max(framesPerSecond, 0);
+    mFrameTicks = ticksPerSecond(mFrameCap);
+}
+
+void ascii::FrameScheduler::setFixedTimestep(int stepsPerSecond)
+{
+    mStepsPerSecond = max(stepsPerSecond, 0);
+    mStepTicks = ticksPerSecond(mStepsPerSecond);
+    mAccumulator = 0;
+    mStepRemainderMS = 0;
+    mInterpolation = 1;
+}
+
+void ascii::FrameScheduler::start()
+{
+    mFrameStart = SDL_GetPerformanceCounter();
+    mAccumulator = 0;
+    mStepRemainderMS = 0;
+}
+
+int ascii::FrameScheduler::beginFrame()
+{
+    Uint64 now = SDL_GetPerformanceCounter();
+    Uint64 elapsed = now - mFrameStart;
+    mFrameStart = now;
+
+    // Idle time isn't a slow frame, so updates catch up with all of it
+    Uint64 idleTicks = min(mIdleTicks, elapsed);
+    mIdleMS = (int) (idleTicks * 1000 / mFrequency);
+    mIdleTicks = 0;
+
+    if (mStepTicks)
+    {
+        mAccumulator = min(mAccumulator + elapsed - idleTicks, mStepTicks * kMaxStepsPerFrame) + idleTicks;
+    }
+
+    return (int) (elapsed * 1000 / mFrequency);
+}
+
+int ascii::FrameScheduler::takeSteps()
+{
+    if (!mStepTicks)
+    {
+        return 0;
+    }
+
+    int steps = (int) (mAccumulator / mStepTicks);
+    mAccumulator -= steps * mStepTicks;
+    mInterpolation = (float) mAccumulator / (float) mStepTicks;
+
+    return steps;
+}
+
+int ascii::FrameScheduler::stepMS()
+{
+    double exactMS = 1000.0 / mStepsPerSecond + mStepRemainderMS;
+    int ms = (int) exactMS;
+    mStepRemainderMS = exactMS - ms;
+    return ms;
+}
+
+void ascii::FrameScheduler::endFrame()
+{
+    if (mFrameTicks && !mVsync)
+    {
+        waitUntil(mFrameStart + mFrameTicks);
+    }
+
+    // Measure the whole frame, including the wait, as the player sees it
+    Uint64 frameTicks = SDL_GetPerformanceCounter() - mFrameStart;
+    float frameMS = (float) ((double) frameTicks * 1000.0 / mFrequency);
+
+    mFrameTimes[mNextFrameTime] = frameMS;
+    mDropped[mNextFrameTime] = mFrameTicks && frameTicks * 2 > mFrameTicks * 3;
+    mNextFrameTime = (mNextFrameTime + 1) % kStatsFrames;
+    mFramesMeasured = min(mFramesMeasured + 1, (int) kStatsFrames);
+}
+
+void ascii::FrameScheduler::idle(int maxMS)
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+
+    if (sWakeup)
+    {
+        if (start >= sWakeup)
+        {
+            sWakeup = 0;
+            return;
+        }
+
+        // Round up, so the wakeup isn't missed by a fraction of a millisecond
+        int wakeupMS = (int) (((sWakeup - start) * 1000 + mFrequency - 1) / mFrequency);
+        maxMS = min(maxMS, wakeupMS);
+    }
+
+    SDL_WaitEventTimeout(NULL, maxMS);
+
+    Uint64 end = SDL_GetPerformanceCounter();
+    mIdleTicks += end - start;
+
+    if (sWakeup && end >= sWakeup)
+    {
+        sWakeup = 0;
+    }
+}
+
+//static
+void ascii::FrameScheduler::ScheduleWakeup(int ms)
+{
+    Uint64 wakeup = SDL_GetPerformanceCounter() + (Uint64) max(ms, 0) * SDL_GetPerformanceFrequency() / 1000;
+
+    if (!sWakeup || wakeup < sWakeup)
+    {
+        sWakeup = wakeup;
+    }
+}
+
+void ascii::FrameScheduler::waitUntil(Uint64 counter)
+{
+    Uint64 now = SDL_GetPerformanceCounter();
+
+    if (now >= counter)
+    {
+        return;
+    }
+
+    double remainingMS = (double) (counter - now) * 1000.0 / mFrequency;
+
+    if (remainingMS > kSpinMarginMS)
+    {
+        SDL_Delay((Uint32) (remainingMS - kSpinMarginMS));
+    }
+
+    while (SDL_GetPerformanceCounter() < counter)
+    {
+    }
+}
+
+ascii::FrameTimeStats ascii::FrameScheduler::stats()
+{
+    FrameTimeStats stats;
+    stats.frames = mFramesMeasured;
+
+    if (mFramesMeasured == 0)
+    {
+        return stats;
+    }
+
+    // Until the ring fills, the measured frames are at its start
+    vector<float> times(mFrameTimes.begin(), mFrameTimes.begin() + mFramesMeasured);
+
+    double total = 0;
+    for (size_t i = 0; i < times.size(); ++i)
+    {
+        total += times[i];
+        stats.droppedFrames += mDropped[i] ? 1 : 0;
+    }
+    stats.meanMS = total / times.size();
+
+    size_t p99 = (size_t) ceil(times.size() * 0.99) - 1;
+    nth_element(times.begin(), times.begin() + p99, times.end());
+    stats.p99MS = times[p99];
+
+    return stats;
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <vector>
+using namespace std;
+
+#include <SDL.h>
+
+namespace ascii
+{
+    // Frame times over the last few seconds of running
+    struct FrameTimeStats
+    {
+        FrameTimeStats() : frames(0), meanMS(0), p99MS(0), droppedFrames(0) { }
+
+        // Number of frames measured
+        int frames;
+        double meanMS;
+        // 99% of frames took this long or less
+        double p99MS;
+        // Frames which ran more than half a frame over the target frame time
+        int droppedFrames;
+    };
+
+    // Paces Game's loop using SDL's high resolution counter.
+    //
+    // By default, the game updates once per frame with the time since the
+    // last frame, at up to 60 frames per second. With a fixed timestep, the
+    // game instead updates in steps of exactly the same length, as many as
+    // have come due, and draws as often as the frame cap allows. Drawing can
+    // then interpolate between the last two steps using interpolation().
+    //
+    // Waiting for the next frame sleeps for most of the time left, then spins
+    // for the rest, because sleeping is only accurate to a millisecond or
+    // two. With vsync, presenting the frame does the waiting instead.
+    class FrameScheduler
+    {
+        public:
+            FrameScheduler();
+
+            // Most frames to draw per second, or 0 for no limit
+            void setFrameCap(int framesPerSecond);
+            int frameCap() { return mFrameCap; }
+
+            // Fixed updates per second, or 0 to update once per frame
+            void setFixedTimestep(int stepsPerSecond);
+            int fixedTimestep() { return mStepsPerSecond; }
+
+            // When presenting waits for vsync, frames aren't paced by waiting
+            void setVsync(bool vsync) { mVsync = vsync; }
+            bool vsync() { return mVsync; }
+
+            // Reset the clock, before the first frame
+            void start();
+
+            // Start timing a new frame. Returns the milliseconds which passed
+            // since the last frame began
+            int beginFrame();
+
+            // With a fixed timestep, the number of steps which have come due
+            // this frame. Call stepMS() before each of them
+            int takeSteps();
+            // Length of the next step in whole milliseconds. Steps alternate
+            // between lengths so that they add up to the exact rate
+            int stepMS();
+
+            // How far between the last step and the next the frame is being
+            // drawn, from 0 to 1. Always 1 without a fixed timestep
+            float interpolation() { return mInterpolation; }
+
+            // Finish timing the frame and wait until the next one is due
+            void endFrame();
+
+            // Wait for an event, without taking it from the queue, for up to
+            // the given time or until a scheduled wakeup. Time spent idle is
+            // handed to the next frame's updates in full
+            void idle(int maxMS);
+            // Stop idling after the given time, if nothing else comes first.
+            // Anything animating on a timer, like a Tween, can call this
+            // without a Game to reach
+            static void ScheduleWakeup(int ms);
+            // Milliseconds spent idle since the frame before this one
+            int idleMS() { return mIdleMS; }
+
+            FrameTimeStats stats();
+
+        private:
+            // Sleep, then spin, until the counter reaches the given value
+            void waitUntil(Uint64 counter);
+
+            Uint64 ticksPerSecond(int rate) { return rate > 0 ? mFrequency / rate : 0; }
+
+            Uint64 mFrequency;
+
+            int mFrameCap;
+            Uint64 mFrameTicks;
+            int mStepsPerSecond;
+            Uint64 mStepTicks;
+            bool mVsync;
+
+            Uint64 mFrameStart;
+            Uint64 mAccumulator;
+            double mStepRemainderMS;
+            float mInterpolation;
+
+            Uint64 mIdleTicks;
+            int mIdleMS;
+            // Counter value of the earliest scheduled wakeup, or 0 for none
+            static Uint64 sWakeup;
+
+            // Recent frame times in milliseconds, used as a ring
+            vector<float> mFrameTimes;
+            size_t mNextFrameTime;
+            int mFramesMeasured;
+            vector<bool> mDropped;
+    };
+}
@@ -4,18 +4,66 @@
 #include <algorithm>
 #include <SDL_image.h>
 
+#include "DecodedImage.h"
+#include "FilePaths.h"
 #include "Log.h"
+#include "GlobalArgs.h"
+#include "Profiler.h"
+#include "VirtualFS.h"
 using namespace ascii;
 
-const int kFPS = 60;
 const int kMaxFrameTime = 5 * 1000 / 60;
 
+// Longest an idle game waits without any event or scheduled wakeup
+const int kMaxIdleMS = 1000;
+// Looping sound groups need their channels checked about once a frame
+const int kSoundPollMS = 1000 / 60;
+
+// Packed content, used in place of loose files under content/ when present
+const string kContentArchive("content.pak");
+// Under the game's file directory
+const string kImageCacheDirectory("image-cache");
+
+namespace
+{
+    // Export the profiler's trace, if one was requested through the
+    // Profiler or the "profile" global arg
+    void WriteProfile()
+    {
+#ifdef ASCIILIB_PROFILE
+        string filename = Profiler::OutputFilename();
+
+        if (filename.empty() && GlobalArgs::Enabled("profile"))
+        {
+            filename = "trace.json";
+        }
+
+        if (!filename.empty())
+        {
+            Profiler::WriteChromeTrace(filename);
+        }
+#endif
+    }
+}
+
 ascii::Game::Game(const char* title, const int bufferWidth, const int bufferHeight,
         int charWidth, int charHeight, float* scaleOptions, int numScaleOptions,
-        int currentScaleOption, bool fullscreen)
+        int currentScaleOption, bool fullscreen, bool headless)
 	: mBufferWidth(bufferWidth), mBufferHeight(bufferHeight), mWindowTitle(title), mRunning(false),
-    mTextManager(&mLanguageManager), mFirstInputFrame(true)
+    mTextManager(&mLanguageManager), mFirstInputFrame(true),
+    mIdleMode(GlobalArgs::Enabled("idle"))
 {
+    headless = headless || GlobalArgs::Enabled("headless");
+
+    if (headless)
+    {
+        // SDL's dummy drivers work without a display or sound device. An
+        // audio driver chosen through the environment is still respected
+        Log::Print("Running headless.");
+        SDL_setenv("SDL_VIDEODRIVER", "dummy", 1);
+        SDL_setenv("SDL_AUDIODRIVER", "dummy", 0);
+    }
+
 	if (SDL_Init(SDL_INIT_EVERYTHING))
 	{
 		Log::Error("SDL_Init failed!");
@@ -27,6 +75,14 @@ ascii::Game::Game(const char* title, const int bufferWidth, const int bufferHeig
 		Log::SDLError();
 	}
 
+    VirtualFS::Mount(FileAccessPath(kContentArchive));
+
+    // Keep decoded images between runs, so they don't need decoding again
+    if (!GlobalArgs::Enabled("no-image-cache"))
+    {
+        DecodedImage::SetCacheDirectory(FileDirectory() + kImageCacheDirectory);
+    }
+
 	mpSoundManager = new SoundManager();
 
     vector<float> scaleOptionsVec;
@@ -34,7 +90,7 @@ ascii::Game::Game(const char* title, const int bufferWidth, const int bufferHeig
     {
         scaleOptionsVec.push_back(scaleOptions[i]);
     }
-	mpGraphics = new ascii::Graphics(mWindowTitle, charWidth, charHeight, scaleOptionsVec, currentScaleOption, fullscreen, mBufferWidth, mBufferHeight);
+	mpGraphics = new ascii::Graphics(mWindowTitle, charWidth, charHeight, scaleOptionsVec, currentScaleOption, fullscreen, mBufferWidth, mBufferHeight, headless);
 
 	mpInput = new Input();
 }
@@ -46,6 +102,9 @@ ascii::Game::~Game()
 	delete mpSoundManager;
     delete mpInput;
 
+    // Music may have been streaming from the archive until now
+    VirtualFS::UnmountAll();
+
     Log::Print("Calling IMG_Quit()");
 	IMG_Quit();
 
@@ -71,61 +130,128 @@ void ascii::Game::Run()
 
 	mRunning = true;
 
-	int lastUpdateTime = SDL_GetTicks();
+    mScheduler.setVsync(pacedByVsync());
+    mScheduler.start();
 
 	while (mRunning)
 	{
-		const int initialTime = SDL_GetTicks();
+        const int elapsedTime = mScheduler.beginFrame();
+
+        PROFILE_BEGIN_FRAME();
 
 		mpInput->beginNewFrame();
+        bool receivedEvents = false;
+
+        {
+            PROFILE_SCOPE("Game::PollEvents");
 
-		SDL_Event event;
-		while (SDL_PollEvent(&event))
-		{
-			switch (event.type)
+			SDL_Event event;
+			while (SDL_PollEvent(&event))
 			{
-				case SDL_QUIT:
-					Log::Print("Handling SDL_QUIT event.");
-					Quit();
-					return;
-				case SDL_KEYDOWN:
-					mpInput->keyDownEvent(event);
-					break;
-				case SDL_KEYUP:
-					mpInput->keyUpEvent(event);
-					break;
-				case SDL_MOUSEWHEEL:
-					mpInput->scrollEvent(event);
-					break;
-                case SDL_WINDOWEVENT:
-                    HandleWindowEvent(event);
-                    break;
+                receivedEvents = true;
+
+				switch (event.type)
+				{
+					case SDL_QUIT:
+						Log::Print("Handling SDL_QUIT event.");
+						Quit();
+                        WriteProfile();
+						return;
+					case SDL_KEYDOWN:
+						mpInput->keyDownEvent(event);
+						break;
+					case SDL_KEYUP:
+						mpInput->keyUpEvent(event);
+						break;
+					case SDL_MOUSEWHEEL:
+						mpInput->scrollEvent(event);
+						break;
+                    case SDL_WINDOWEVENT:
+                        if (event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED)
+                        {
+                            mpGraphics->updateViewport();
+                        }
+                        else if (event.window.event == SDL_WINDOWEVENT_EXPOSED)
+                        {
+                            // What the window showed may be gone, even if
+                            // nothing changed since the last present
+                            mpGraphics->invalidate();
+                        }
+                        HandleWindowEvent(event);
+                        break;
+                    case SDL_RENDER_TARGETS_RESET:
+                        // The last frame was lost along with the render target
+                        mpGraphics->invalidate();
+                        break;
+				}
 			}
-		}
+        }
 
-		HandleInput(*mpInput);
+        {
+            PROFILE_SCOPE("Game::HandleInput");
+            HandleInput(*mpInput);
+        }
         mFirstInputFrame = false;
 
-		const int currentTime = SDL_GetTicks();
-		const int elapsedTime = currentTime - lastUpdateTime;
-
-		Update(std::min(elapsedTime, kMaxFrameTime));
-		lastUpdateTime = currentTime;
-
-        mpSoundManager->update(elapsedTime);
-
-		Draw(*mpGraphics);
-
-		const int msPerFrame = 1000 / kFPS;
-		const int elapsedTimeMS = SDL_GetTicks() - initialTime;
-
-		if (elapsedTimeMS < msPerFrame)
-		{
-			SDL_Delay(msPerFrame - elapsedTimeMS);
-		}
+        {
+            PROFILE_SCOPE("Game::Update");
+
+            if (mScheduler.fixedTimestep())
+            {
+                int steps = mScheduler.takeSteps();
+                for (int i = 0; i < steps; ++i)
+                {
+                    Update(mScheduler.stepMS());
+                }
+            }
+            else
+            {
+                Update(std::min(elapsedTime, kMaxFrameTime + mScheduler.idleMS()));
+            }
+        }
+
+        {
+            PROFILE_SCOPE("SoundManager::update");
+            mpSoundManager->update(elapsedTime);
+        }
+
+        bool canIdle = mIdleMode && !MustRefreshScreen() && !State::AnyMustRefreshScreen();
+        mpGraphics->setSkipUnchangedFrames(canIdle);
+        Uint32 framesPresented = mpGraphics->framesPresented();
+
+        {
+            PROFILE_SCOPE("Game::Draw");
+            Draw(*mpGraphics);
+        }
+
+        PROFILE_END_FRAME();
+
+        {
+            PROFILE_SCOPE("Sleep");
+            mScheduler.endFrame();
+        }
+
+        // Nothing happened and nothing changed on screen, so there is no
+        // need to run again until something does
+        if (canIdle && !receivedEvents
+                && mpGraphics->framesPresented() == framesPresented)
+        {
+            PROFILE_SCOPE("Idle");
+
+            int maxMS = mpSoundManager->needsUpdates() ? kSoundPollMS : kMaxIdleMS;
+            mScheduler.idle(maxMS);
+        }
 	}
 
 	UnloadContent(mpGraphics->imageCache(), mpSoundManager);
+
+    WriteProfile();
+}
+
+void ascii::Game::SetVsync(bool vsync)
+{
+    mpGraphics->setVsync(vsync);
+    mScheduler.setVsync(pacedByVsync());
 }
 
 void ascii::Game::Quit()
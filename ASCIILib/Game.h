@@ -10,6 +10,7 @@
 #include "LanguageManager.h"
 #include "InputMappings.h"
 #include "State.h"
+#include "FrameScheduler.h"
 
 namespace ascii
 {
@@ -26,10 +27,13 @@ namespace ascii
 			///<param name="title">The title of the game's window.</param>
 			///<param name="bufferWidth">The width of the game's buffer, in cells.</param>
 			///<param name="bufferHeight">The height of the game's buffer, in cells.</param>
+			///<param name="headless">Run without a display, using SDL's dummy
+			/// video and audio drivers. Also enabled by the "headless" global
+			/// arg.</param>
 			Game(const char* title, const int bufferWidth, const int bufferHeight,
                     int charWidth, int charHeight,
                     float* scaleOptions, int numScaleOptions, int currentScaleOption,
-                    bool fullscreen);
+                    bool fullscreen, bool headless=false);
 
             ~Game();
 
@@ -62,6 +66,28 @@ namespace ascii
 
             ContentManager* contentManager() { return mpContentManager; }
 
+            // Controls the frame cap and fixed timestep of the game loop,
+            // and measures frame times
+            FrameScheduler* scheduler() { return &mScheduler; }
+
+            // With a fixed timestep, how far between the last update and the
+            // next the current frame is drawn, from 0 to 1
+            float Interpolation() { return mScheduler.interpolation(); }
+
+            // Wait for vsync when presenting frames, instead of pacing them
+            // by sleeping
+            void SetVsync(bool vsync);
+
+            // Idle mode: after a frame with no events in which nothing on
+            // screen changed, wait for the next event instead of running
+            // more frames. Off by default, or on with the "idle" global arg
+            void SetIdleMode(bool idle) { mIdleMode = idle; }
+            bool IdleMode() { return mIdleMode; }
+
+            // Run a frame after the given time even if the game is idle,
+            // for changes which happen on a timer
+            void ScheduleWakeup(int ms) { FrameScheduler::ScheduleWakeup(ms); }
+
             LanguageManager* languageManager() { return &mLanguageManager; }
             TextManager* textManager() { return &mTextManager; }
             virtual InputMappings* inputMappings() = 0;
@@ -93,6 +119,12 @@ namespace ascii
 
             virtual void HandleWindowEvent(SDL_Event event)=0;
 
+            // Whether the screen must keep being refreshed every frame, even
+            // when it looks unchanged. Keeps idle mode from waiting. The
+            // hints of existing States are checked on top of this, so games
+            // only override it for needs of their own
+            virtual bool MustRefreshScreen() { return false; }
+
             ContentManager* mpContentManager;
             LanguageManager mLanguageManager;
             TextManager mTextManager;
@@ -104,6 +136,11 @@ namespace ascii
 			SoundManager* mpSoundManager;
 			Graphics* mpGraphics;
             Input* mpInput;
+            FrameScheduler mScheduler;
+
+            // Whether presenting paces the game loop. A render thread waits
+            // for vsync in its place, so then the scheduler's cap does it
+            bool pacedByVsync() { return mpGraphics->vsync() && !mpGraphics->renderThreaded(); }
         
 			bool mRunning;
 
@@ -111,6 +148,8 @@ namespace ascii
 
             bool mFirstInputFrame;
 
+            bool mIdleMode;
+
 	};
 
 };
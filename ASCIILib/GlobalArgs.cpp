@@ -4,10 +4,12 @@
 
 
 vector<string> ascii::GlobalArgs::args;
+int ascii::GlobalArgs::generation = 0;
 
 void ascii::GlobalArgs::Add(string arg)
 {
     args.push_back(arg);
+    ++generation;
 }
 
 void ascii::GlobalArgs::AddList(vector<string> argList)
@@ -16,16 +18,19 @@ void ascii::GlobalArgs::AddList(vector<string> argList)
     {
         args.push_back(argList[i]);
     }
+    ++generation;
 }
 
 void ascii::GlobalArgs::Remove(string arg)
 {
     args.erase(remove(args.begin(), args.end(), arg));
+    ++generation;
 }
 
 void ascii::GlobalArgs::Clear()
 {
     args.clear();
+    ++generation;
 }
 
 bool ascii::GlobalArgs::Enabled(string arg)
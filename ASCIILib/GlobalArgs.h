@@ -18,7 +18,12 @@ namespace ascii
 
             static bool Enabled(string arg);
 
+            // Changes every time the arguments do, so that callers can cache
+            // what they look up
+            static int Generation() { return generation; }
+
         private:
             static vector<string> args;
+            static int generation;
     };
 }
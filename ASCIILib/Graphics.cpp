@@ -1,6 +1,7 @@
 #include "Graphics.h"
 
 #include <algorithm>
+#include <string.h>
 #include <string>
 #include <sstream>
 
@@ -14,6 +15,8 @@
 #include "Log.h"
 #include "StringTokenizer.h"
 #include "FileReader.h"
+#include "GlobalArgs.h"
+#include "Profiler.h"
 using namespace ascii;
 
 //static
@@ -22,18 +25,62 @@ const unsigned int ascii::Graphics::kBufferWidth = 80;
 //static
 const unsigned int ascii::Graphics::kBufferHeight = 25;
 
+// Color used to highlight redrawn regions when showing damage
+const SDL_Color kDamageColor = { 255, 0, 255, 64 };
+
+// Past this many background colors in one pass, batches are thrown away after
+// drawing instead of kept around for the next
+const size_t kMaxBackgroundBatches = 32;
+
+namespace
+{
+    // Copy every channel drawing reads from one surface onto another of the
+    // same size
+    void CopyCells(Surface* dest, Surface* source)
+    {
+        size_t cells = source->width() * source->height();
+
+        if (cells == 0)
+        {
+            return;
+        }
+
+        memcpy(dest->characterRow(0), source->characterRow(0), cells * sizeof(UChar));
+        memcpy(dest->backgroundColorRow(0), source->backgroundColorRow(0), cells * sizeof(Color));
+        memcpy(dest->characterColorRow(0), source->characterColorRow(0), cells * sizeof(Color));
+        memcpy(dest->opacityRow(0), source->opacityRow(0), cells * sizeof(Uint8));
+    }
+}
+
 
 ascii::Graphics::Graphics(const char* title, int charWidth, int charHeight,
         vector<float> scaleOptions, int currentScaleOption, bool fullscreen,
-        int bufferWidth, int bufferHeight)
+        int bufferWidth, int bufferHeight, bool headless)
 	: Surface(bufferWidth, bufferHeight),
     mTitle(title),
     mBackgroundColor(ascii::Color::Black),
     mpWindow(NULL), mpRenderer(NULL), mHidingImages(false),
-    mFullscreen(fullscreen),
-    mCellFonts(bufferWidth, vector<string>(bufferHeight, "")),
-    mCharWidth(charWidth), mCharHeight(charHeight)
+    mFullscreen(fullscreen && !headless), mHeadless(headless),
+    mVsync(GlobalArgs::Enabled("vsync") && !headless),
+    mFontKeys(1, ""), mScaledFonts(1, NULL), mScaledFontNames(1, ""),
+    mFontGeneration(0), mReportedFontGeneration(0),
+    mCellFonts(bufferWidth * bufferHeight, 0),
+    mCharWidth(charWidth), mCharHeight(charHeight),
+    mDrawnPaletteVersion(0),
+    mSkipUnchangedFrames(false), mFramesPresented(0),
+    mPartialRedraws(true), mpFrameTexture(NULL),
+    mFrameTextureWidth(0), mFrameTextureHeight(0),
+    mLastFrame(bufferWidth, bufferHeight), mFullRedraw(true),
+    mShowDamage(GlobalArgs::Enabled("show-damage")),
+    mLastBackgroundBatch(0),
+#ifdef ASCIILIB_IMAGE_BATCHING
+    mpImageBatchTexture(NULL), mImageBatchWidth(0), mImageBatchHeight(0),
+#endif
+    mpRenderThread(NULL), mBackSnapshot(0), mReadySnapshot(1),
+    mFrontSnapshot(2), mReadyFresh(false), mSnapshotLock(0)
 {
+    mFontIds[""] = 0;
+
     // Start by creating the window in the correct scale
     mScaleOptions.insert(mScaleOptions.end(), scaleOptions.begin(), scaleOptions.end());
     mCurrentScaleOption = currentScaleOption;
@@ -41,6 +88,13 @@ ascii::Graphics::Graphics(const char* title, int charWidth, int charHeight,
 
     int flags = SDL_WINDOW_SHOWN;
 
+    // Headless windows are never shown. Combined with SDL's dummy video
+    // driver, they don't need a display at all
+    if (mHeadless)
+    {
+        flags = SDL_WINDOW_HIDDEN;
+    }
+
     // Only create the window once
 	mpWindow = SDL_CreateWindow(mTitle, 
 		SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, 
@@ -53,8 +107,38 @@ ascii::Graphics::Graphics(const char* title, int charWidth, int charHeight,
         Log::SDLError();
     }
 
-    // oOnly create the renderer once
-	mpRenderer = SDL_CreateRenderer(mpWindow, -1, SDL_RENDERER_ACCELERATED);
+    // oOnly create the renderer once. Headless rendering happens in software
+    // so that it works without a GPU, and so frames can be read back
+    Uint32 rendererFlags = SDL_RENDERER_ACCELERATED;
+    if (mHeadless)
+    {
+        rendererFlags = SDL_RENDERER_SOFTWARE | SDL_RENDERER_TARGETTEXTURE;
+    }
+    if (mVsync)
+    {
+        rendererFlags |= SDL_RENDERER_PRESENTVSYNC;
+    }
+
+    // Pipelined mode creates the renderer on its own thread, falling back
+    // to drawing on this one if that fails
+    if (GlobalArgs::Enabled("render-thread") && mpWindow)
+    {
+        mpRenderThread = new RenderThread();
+        mpRenderer = mpRenderThread->Start(mpWindow, rendererFlags,
+                [this]() { drawPublishedFrame(); });
+
+        if (!mpRenderer)
+        {
+            Log::Warning("Drawing on the main thread instead of a render thread.");
+            delete mpRenderThread;
+            mpRenderThread = NULL;
+        }
+    }
+
+    if (!mpRenderer)
+    {
+        mpRenderer = SDL_CreateRenderer(mpWindow, -1, rendererFlags);
+    }
 
     if (!mpRenderer)
     {
@@ -65,7 +149,8 @@ ascii::Graphics::Graphics(const char* title, int charWidth, int charHeight,
     // Only create the ImageCache once
 	mpCache = new ascii::ImageCache(mpRenderer,
             mCharWidth,
-            mCharHeight);
+            mCharHeight,
+            mpRenderThread);
 
     ApplyOptions();
 }
@@ -77,13 +162,16 @@ ascii::Graphics::~Graphics(void)
 
 void ascii::Graphics::ApplyOptions()
 {
-    for (auto it = mFonts.begin(); it != mFonts.end(); ++it)
-    {
-        if (it->second->charHeight() == mCharHeight * mScale)
+    RenderThread::Run(mpRenderThread, [this]() {
+        for (auto it = mFonts.begin(); it != mFonts.end(); ++it)
         {
-            it->second->Initialize(mpRenderer);
+            if (it->second->charHeight() == mCharHeight * mScale)
+            {
+                it->second->Initialize(mpRenderer);
+            }
         }
-    }
+    });
+    resolveFonts();
     
     // Use linear scaling
     SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "1");
@@ -98,6 +186,11 @@ void ascii::Graphics::ApplyOptions()
             SDL_WINDOWPOS_CENTERED_DISPLAY(mLastDisplayIndex));
 
 	checkSize();
+    updateViewport();
+
+    // Fonts and the window size may have changed, so nothing drawn so far can
+    // be reused
+    invalidate();
     
     // Go fullscreen if fullscreen is needed
 
@@ -175,16 +268,37 @@ void ascii::Graphics::ApplyClosestScaleOption(int option)
 
 void ascii::Graphics::Dispose()
 {
-    SDL_DestroyRenderer(mpRenderer);
-    SDL_DestroyWindow(mpWindow);
+    // Everything owning textures goes before the renderer, on the thread
+    // which owns it
+    RenderThread::Run(mpRenderThread, [this]() {
+        if (mpFrameTexture)
+        {
+            SDL_DestroyTexture(mpFrameTexture);
+            mpFrameTexture = NULL;
+        }
+
+        // Dispose of fonts
+        for (auto it = mFonts.begin(); it != mFonts.end(); ++it)
+        {
+            it->second->Dispose();
+        }
+
+        delete mpCache;
+        mpCache = NULL;
 
-    // Dispose of fonts
-    for (auto it = mFonts.begin(); it != mFonts.end(); ++it)
+        SDL_DestroyRenderer(mpRenderer);
+        mpRenderer = NULL;
+    });
+
+    if (mpRenderThread)
     {
-        it->second->Dispose();
+        mpRenderThread->Stop();
+        delete mpRenderThread;
+        mpRenderThread = NULL;
     }
 
-    delete mpCache;
+    SDL_DestroyWindow(mpWindow);
+    mpWindow = NULL;
 }
 
 void ascii::Graphics::AddFont(string key, int size, string fontLayoutPath, string fontPath)
@@ -194,10 +308,14 @@ void ascii::Graphics::AddFont(string key, int size, string fontLayoutPath, strin
     
     float scale = (float) size / (float) mCharHeight;
     mFonts[sstream.str()] = new PixelFont(mCharWidth * scale, size, fontLayoutPath, fontPath);
+    fontId(key);
 
     if (size == mCharHeight * mScale)
     {
-        mFonts[sstream.str()]->Initialize(mpRenderer);
+        PixelFont* font = mFonts[sstream.str()];
+        RenderThread::Run(mpRenderThread, [this, font]() { font->Initialize(mpRenderer); });
+        resolveFonts();
+        invalidate();
     }
 }
 
@@ -205,23 +323,38 @@ void ascii::Graphics::UnloadFont(string key, int size)
 {
     stringstream sstream;
     sstream << key << size;
-    PixelFont* pFont = mFonts[sstream.str()];
-    delete pFont;
-    mFonts.erase(key);
+
+    auto it = mFonts.find(sstream.str());
+    if (it == mFonts.end())
+    {
+        return;
+    }
+
+    PixelFont* font = it->second;
+    RenderThread::Run(mpRenderThread, [font]() { delete font; });
+    mFonts.erase(it);
+    resolveFonts();
+    invalidate();
 }
 
 void ascii::Graphics::UnloadAllFonts()
 {
-    for (auto it = mFonts.begin(); it != mFonts.end(); ++it)
-    {
-        delete it->second;
-    }
+    RenderThread::Run(mpRenderThread, [this]() {
+        for (auto it = mFonts.begin(); it != mFonts.end(); ++it)
+        {
+            delete it->second;
+        }
+    });
     mFonts.clear();
+    resolveFonts();
+    invalidate();
 }
 
 void ascii::Graphics::SetDefaultFont(string key)
 {
     mDefaultFont = key;
+    resolveFonts();
+    invalidate();
 }
 
 
@@ -240,30 +373,62 @@ void ascii::Graphics::ToggleFullscreen()
 
 int ascii::Graphics::pixelToCellX(int pixelX)
 {
-    if (drawOrigin().x > 0)
+    if (mViewport.origin.x > 0)
     {
-        pixelX -= drawOrigin().x;
+        pixelX -= mViewport.origin.x;
     }
-    return pixelX / (mCharWidth * mScale);
+    return pixelX / mViewport.cellWidth;
 }
 
 int ascii::Graphics::pixelToCellY(int pixelY)
 {
-    if (drawOrigin().y > 0)
+    if (mViewport.origin.y > 0)
     {
-        pixelY -= drawOrigin().y;
+        pixelY -= mViewport.origin.y;
     }
-    return pixelY / (mCharHeight * mScale);
+    return pixelY / mViewport.cellHeight;
 }
 
 int ascii::Graphics::cellToPixelX(int cellX)
 {
-    return drawOrigin().x + (cellX * mCharWidth * mScale);
+    return mViewport.pixelX(cellX);
 }
 
 int ascii::Graphics::cellToPixelY(int cellY)
 {
-    return drawOrigin().y + (cellY * mCharHeight * mScale);
+    return mViewport.pixelY(cellY);
+}
+
+void ascii::Graphics::updateViewport()
+{
+    Point origin = drawOrigin();
+
+    bool moved = origin.x != mViewport.origin.x || origin.y != mViewport.origin.y
+        || mViewport.cellWidth != mCharWidth * mScale
+        || mViewport.cellHeight != mCharHeight * mScale;
+
+    mViewport.origin = origin;
+    mViewport.cellWidth = mCharWidth * mScale;
+    mViewport.cellHeight = mCharHeight * mScale;
+    mViewport.scale = mScale;
+
+    mViewport.columnX.resize(width() + 1);
+    for (int x = 0; x <= width(); ++x)
+    {
+        mViewport.columnX[x] = origin.x + (x * mCharWidth * mScale);
+    }
+
+    mViewport.rowY.resize(height() + 1);
+    for (int y = 0; y <= height(); ++y)
+    {
+        mViewport.rowY[y] = origin.y + (y * mCharHeight * mScale);
+    }
+
+    // Everything drawn so far is in the wrong place
+    if (moved)
+    {
+        invalidate();
+    }
 }
 
 ascii::Point ascii::Graphics::drawOrigin()
@@ -288,193 +453,961 @@ ascii::Point ascii::Graphics::drawOrigin()
 void ascii::Graphics::clearScreen()
 {
 	// Draw background color
-	SDL_SetRenderDrawColor(mpRenderer, mBackgroundColor.r, mBackgroundColor.g, mBackgroundColor.b, ascii::Color::kAlpha);
+    Color backgroundColor = mDraw.palette->resolve(mDraw.backgroundColor);
+	SDL_SetRenderDrawColor(mpRenderer, backgroundColor.r, backgroundColor.g, backgroundColor.b, ascii::Color::kAlpha);
 	SDL_RenderFillRect(mpRenderer, NULL);
+    PROFILE_DRAW_CALL(NULL);
 }
 
 void ascii::Graphics::drawImages(std::map<std::string, Image>* images)
 {
     // Don't draw any images if they're currently being hidden
-    if (!mHidingImages)
+    if (!mDraw.hidingImages)
     {
         // Draw every image in the given map otherwise, using their specified
         // positions
         for (auto it = images->begin(); it != images->end(); ++it)
         {
+            const ImageCache::TextureRegion& region = it->second.first;
+            if (!region.texture)
+            {
+                continue;
+            }
+
             SDL_Rect dest;
             
-            dest.x = cellToPixelX(it->second.second.x);
-            dest.y = cellToPixelY(it->second.second.y);
-
-            SDL_QueryTexture(it->second.first, NULL, NULL, &dest.w, &dest.h);
-            dest.w *= mScale;
-            dest.h *= mScale;
+            dest.x = mDraw.viewport->pixelX(it->second.second.x);
+            dest.y = mDraw.viewport->pixelY(it->second.second.y);
+            dest.w = region.source.w * mDraw.viewport->scale;
+            dest.h = region.source.h * mDraw.viewport->scale;
 
-            SDL_RenderCopy(mpRenderer, it->second.first, NULL, &dest);
+            queueImage(region, dest);
         }
+
+        flushImages();
     }
 }
 
-void ascii::Graphics::drawBackgroundColors(ascii::Surface* surface, int x, int y)
+void ascii::Graphics::queueImage(const ImageCache::TextureRegion& region, const SDL_Rect& dest)
 {
-    for (int ySrc = 0; ySrc < surface->height(); ++ySrc)
+#ifdef ASCIILIB_IMAGE_BATCHING
+    // Images packed into the same atlas page are drawn together, until one
+    // from another texture comes between them
+    if (region.texture != mpImageBatchTexture)
     {
-		int xSrc = 0;
+        flushImages();
+        mpImageBatchTexture = region.texture;
+        SDL_QueryTexture(region.texture, NULL, NULL, &mImageBatchWidth, &mImageBatchHeight);
+    }
 
-		while (xSrc < surface->width())
-		{
-			//chain all adjacent background colors in a row for more efficient rendering
-			SDL_Rect colorRect;
+    // Use the same texture coordinates SDL_RenderCopy() would compute for
+    // the source rectangle
+    float u1 = (float) region.source.x / mImageBatchWidth;
+    float v1 = (float) region.source.y / mImageBatchHeight;
+    float u2 = (float) (region.source.x + region.source.w) / mImageBatchWidth;
+    float v2 = (float) (region.source.y + region.source.h) / mImageBatchHeight;
+
+    float x1 = (float) dest.x;
+    float y1 = (float) dest.y;
+    float x2 = (float) (dest.x + dest.w);
+    float y2 = (float) (dest.y + dest.h);
+
+    SDL_Color white = { 255, 255, 255, 255 };
+
+    int first = mImageVertices.size();
+
+    SDL_Vertex corners[4] = {
+        { { x1, y1 }, white, { u1, v1 } },
+        { { x2, y1 }, white, { u2, v1 } },
+        { { x2, y2 }, white, { u2, v2 } },
+        { { x1, y2 }, white, { u1, v2 } }
+    };
+    mImageVertices.insert(mImageVertices.end(), corners, corners + 4);
+
+    int quad[6] = { first, first + 1, first + 2, first, first + 2, first + 3 };
+    mImageIndices.insert(mImageIndices.end(), quad, quad + 6);
+#else
+    // Images packed into the same atlas page still follow each other, so
+    // the renderer doesn't switch textures between them
+    SDL_RenderCopy(mpRenderer, region.texture, &region.source, &dest);
+    PROFILE_DRAW_CALL(region.texture);
+#endif
+}
+
+void ascii::Graphics::flushImages()
+{
+#ifdef ASCIILIB_IMAGE_BATCHING
+    if (mImageIndices.empty())
+    {
+        return;
+    }
+
+    PROFILE_DRAW_CALL(mpImageBatchTexture);
+
+    if (SDL_RenderGeometry(mpRenderer, mpImageBatchTexture,
+                &mImageVertices[0], mImageVertices.size(),
+                &mImageIndices[0], mImageIndices.size()) != 0)
+    {
+        Log::Error("Failed to render image batch.");
+        Log::SDLError();
+    }
+
+    // Keep the capacity around for the next frame
+    mImageVertices.clear();
+    mImageIndices.clear();
+    mpImageBatchTexture = NULL;
+#endif
+}
+
+void ascii::Graphics::drawBackgroundColors(ascii::Surface* surface, int x, int y, Rectangle source)
+{
+    // clearScreen() already fills the buffer with the window's background
+    // color, so cells of that color only need drawing if something else
+    // could show through them
+    bool skipClearColor = surface == mDraw.buffer
+        && (mDraw.backgroundImages->empty() || mDraw.hidingImages);
+    Color clearColor = mDraw.palette->resolve(mDraw.backgroundColor);
 
-			colorRect.x = cellToPixelX(x + xSrc);
-			colorRect.y = cellToPixelY(y + ySrc);
-			colorRect.w = 0;
-			colorRect.h = mCharHeight * mScale;
+    mOpenRuns.clear();
 
-			Color backgroundColor = surface->getBackgroundColor(xSrc, ySrc);
+    for (int ySrc = source.top(); ySrc < source.bottom(); ++ySrc)
+    {
+        Color* backgroundColors = surface->backgroundColorRow(ySrc);
+        Uint8* opacity = surface->opacityRow(ySrc);
+
+        // Runs are found left to right, in the same order as the open runs
+        // of the row above, so the two can be matched in one sweep
+        size_t open = 0;
+        mRowRuns.clear();
+
+		int xSrc = source.left();
+
+		while (xSrc < source.right())
+		{
+            if (!opacity[xSrc])
+            {
+                ++xSrc;
+                continue;
+            }
+
+			//chain all adjacent background colors in a row for more efficient rendering
+            Color backgroundColor = backgroundColors[xSrc];
+            int start = xSrc;
 
 			do
 			{
-				if (!surface->isCellOpaque(xSrc, ySrc))
-                {
-                    ++xSrc;
-                    break;
-                }
-
-				colorRect.w += mCharWidth * mScale;
 				++xSrc;
-			} while (xSrc < surface->width() && surface->getBackgroundColor(xSrc, ySrc) == backgroundColor);
+			} while (xSrc < source.right() && opacity[xSrc] && backgroundColors[xSrc] == backgroundColor);
 
-			SDL_SetRenderDrawColor(mpRenderer, backgroundColor.r, backgroundColor.g, backgroundColor.b, Color::kAlpha);
-			SDL_RenderFillRect(mpRenderer, &colorRect);
+            if (skipClearColor && mDraw.palette->resolve(backgroundColor) == clearColor)
+            {
+                continue;
+            }
+
+            // Runs above which this row can't continue are finished
+            while (open < mOpenRuns.size() && mOpenRuns[open].left < start)
+            {
+                queueBackgroundRun(mOpenRuns[open++], x, y);
+            }
+
+            // Extend the run above if this one covers exactly the same cells
+            if (open < mOpenRuns.size() && mOpenRuns[open].left == start
+                    && mOpenRuns[open].right == xSrc
+                    && mOpenRuns[open].color == backgroundColor)
+            {
+                BackgroundRun run = mOpenRuns[open++];
+                run.bottom = ySrc + 1;
+                mRowRuns.push_back(run);
+            }
+            else
+            {
+                BackgroundRun run = { start, xSrc, ySrc, ySrc + 1, backgroundColor };
+                mRowRuns.push_back(run);
+            }
 		}
+
+        while (open < mOpenRuns.size())
+        {
+            queueBackgroundRun(mOpenRuns[open++], x, y);
+        }
+
+        mOpenRuns.swap(mRowRuns);
 	}
+
+    for (size_t i = 0; i < mOpenRuns.size(); ++i)
+    {
+        queueBackgroundRun(mOpenRuns[i], x, y);
+    }
+
+    flushBackgroundRuns();
+}
+
+void ascii::Graphics::queueBackgroundRun(const BackgroundRun& run, int x, int y)
+{
+    Color color = mDraw.palette->resolve(run.color);
+
+    // Runs of one color tend to come in a row, so try the last batch first
+    if (mLastBackgroundBatch >= mBackgroundBatches.size()
+            || !(mBackgroundBatches[mLastBackgroundBatch].color == color))
+    {
+        mLastBackgroundBatch = 0;
+        while (mLastBackgroundBatch < mBackgroundBatches.size()
+                && !(mBackgroundBatches[mLastBackgroundBatch].color == color))
+        {
+            ++mLastBackgroundBatch;
+        }
+
+        if (mLastBackgroundBatch == mBackgroundBatches.size())
+        {
+            BackgroundBatch batch;
+            batch.color = color;
+            mBackgroundBatches.push_back(batch);
+        }
+    }
+
+    SDL_Rect rect;
+    rect.x = mDraw.viewport->pixelX(x + run.left);
+    rect.y = mDraw.viewport->pixelY(y + run.top);
+    rect.w = mDraw.viewport->pixelX(x + run.right) - rect.x;
+    rect.h = mDraw.viewport->pixelY(y + run.bottom) - rect.y;
+
+    mBackgroundBatches[mLastBackgroundBatch].rects.push_back(rect);
+}
+
+void ascii::Graphics::flushBackgroundRuns()
+{
+    // Runs of one surface never overlap, so the colors can be filled in any
+    // order
+    for (size_t i = 0; i < mBackgroundBatches.size(); ++i)
+    {
+        BackgroundBatch& batch = mBackgroundBatches[i];
+
+        if (batch.rects.empty())
+        {
+            continue;
+        }
+
+        SDL_SetRenderDrawColor(mpRenderer, batch.color.r, batch.color.g, batch.color.b, Color::kAlpha);
+        SDL_RenderFillRects(mpRenderer, &batch.rects[0], batch.rects.size());
+        PROFILE_DRAW_CALL(NULL);
+
+        batch.rects.clear();
+    }
+
+    if (mBackgroundBatches.size() > kMaxBackgroundBatches)
+    {
+        mBackgroundBatches.clear();
+    }
 }
 
-void ascii::Graphics::drawCharacters(ascii::Surface* surface, int x, int y)
+void ascii::Graphics::drawCharacters(ascii::Surface* surface, int x, int y, Rectangle source)
 {
+    // Fonts which have glyphs queued, to be flushed once every cell is visited
+    vector<PixelFont*> batchedFonts;
+
 	//draw all characters
-	for (int ySrc = 0; ySrc < surface->height(); ++ySrc)
+	for (int ySrc = source.top(); ySrc < source.bottom(); ++ySrc)
 	{
-        for (int xSrc = 0; xSrc < surface->width(); ++xSrc)
+        UChar* characters = surface->characterRow(ySrc);
+        Color* characterColors = surface->characterColorRow(ySrc);
+        Uint8* opacity = surface->opacityRow(ySrc);
+        Uint16* cellFonts = &(*mDraw.cellFonts)[(y + ySrc) * mDraw.buffer->width() + x];
+
+        for (int xSrc = source.left(); xSrc < source.right(); ++xSrc)
         {
-            UChar character = surface->getCharacter(xSrc, ySrc);
+            UChar character = characters[xSrc];
 
-            if (!IsWhiteSpace(character) && surface->isCellOpaque(xSrc, ySrc))
+            if (!IsWhiteSpace(character) && opacity[xSrc])
             {
-                Color color = surface->getCharacterColor(xSrc, ySrc);
+                Color color = mDraw.palette->resolve(characterColors[xSrc]);
 
                 int destCellX = x + xSrc;
                 int destCellY = y + ySrc;
-                int destPixelX = cellToPixelX(destCellX);
-                int destPixelY = cellToPixelY(destCellY);
+                int destPixelX = mDraw.viewport->pixelX(destCellX);
+                int destPixelY = mDraw.viewport->pixelY(destCellY);
 
-                //Log::Print("Rendering character: " + UnicodeString(character));
-                //Log::Print("x: ", false);
-                //Log::Print(pixelX);
-                //Log::Print("y: ", false);
-                //Log::Print(pixelY);
-
-                string cellFont = mCellFonts[destCellX][destCellY];
-
-                PixelFont* font = GetFont(cellFont);
+                PixelFont* font = GetFont(cellFonts[xSrc]);
 
                 if (font)
-                    font->RenderCharacter(character, destPixelX, destPixelY, color);
+                {
+                    font->QueueCharacter(character, destPixelX, destPixelY, color);
+
+                    if (find(batchedFonts.begin(), batchedFonts.end(), font) == batchedFonts.end())
+                    {
+                        batchedFonts.push_back(font);
+                    }
+                }
             }
         }
 	}
+
+    // Submit one batch per font texture sheet
+    for (auto it = batchedFonts.begin(); it != batchedFonts.end(); ++it)
+    {
+        (*it)->FlushBatch();
+    }
 }
 
-void ascii::Graphics::drawSurface(ascii::Surface* surface, int x, int y)
+void ascii::Graphics::drawSurface(ascii::Surface* surface, int x, int y, Rectangle source)
 {
+    PROFILE_SCOPE("Graphics::drawSurface");
+
+    // Only draw the part of the source which exists on the surface
+    int left = max(source.left(), 0);
+    int top = max(source.top(), 0);
+    int right = min(source.right(), surface->width());
+    int bottom = min(source.bottom(), surface->height());
+
+    if (left >= right || top >= bottom)
+    {
+        return;
+    }
+
+    source = Rectangle(left, top, right - left, bottom - top);
+
 	// Draw all background colors
-    drawBackgroundColors(surface, x, y);
+    drawBackgroundColors(surface, x, y, source);
 
     // Draw all characters
-    drawCharacters(surface, x, y);
+    drawCharacters(surface, x, y, source);
 }
 
 void ascii::Graphics::refresh()
 {
+    PROFILE_SCOPE("SDL_RenderPresent");
+
     SDL_RenderPresent(mpRenderer);
 }
 
-void ascii::Graphics::update()
+void ascii::Graphics::drawLayers(Rectangle* cells)
 {
-    // If the window has moved to a different display, refresh the scaling
-    // options to fit bigger/smaller screen space
-    if (mLastDisplayIndex != SDL_GetWindowDisplayIndex(mpWindow))
+    Surface* buffer = mDraw.buffer;
+    Rectangle region(0, 0, buffer->width(), buffer->height());
+
+    if (cells)
     {
-        ApplyClosestScaleOption(mCurrentScaleOption);
+        // Keep every layer from drawing outside of the given cells
+        region = *cells;
+
+        SDL_Rect clip;
+        clip.x = mDraw.viewport->pixelX(region.left());
+        clip.y = mDraw.viewport->pixelY(region.top());
+        clip.w = mDraw.viewport->pixelX(region.right()) - clip.x;
+        clip.h = mDraw.viewport->pixelY(region.bottom()) - clip.y;
+
+        SDL_RenderSetClipRect(mpRenderer, &clip);
     }
 
     // Clear the screen for drawing
     clearScreen();
 
 	// Draw background images
-    drawImages(&mBackgroundImages);
+    drawImages(mDraw.backgroundImages);
 
     // Draw the buffer surface in between
-    drawSurface(this, 0, 0);
+    drawSurface(buffer, 0, 0, region);
 
 	// Draw foreground images
-    drawImages(&mForegroundImages);
+    drawImages(mDraw.foregroundImages);
 
     // Draw foreground surfaces
-    for (int i = 0; i < mForegroundSurfaces.size(); ++i)
+    vector<ForegroundSurface>& foregroundSurfaces = *mDraw.foregroundSurfaces;
+    for (size_t i = 0; i < foregroundSurfaces.size(); ++i)
+    {
+        Surface* surface = foregroundSurfaces[i].first;
+        Point position = foregroundSurfaces[i].second;
+
+        Rectangle source(region.x - position.x, region.y - position.y,
+                region.width, region.height);
+
+        drawSurface(surface, position.x, position.y, source);
+    }
+
+    if (cells)
+    {
+        SDL_RenderSetClipRect(mpRenderer, NULL);
+    }
+}
+
+bool ascii::Graphics::prepareFrameTexture(bool* outRecreated)
+{
+    *outRecreated = false;
+
+    if (!mPartialRedraws)
+    {
+        return false;
+    }
+
+    if (!SDL_RenderTargetSupported(mpRenderer))
+    {
+        Log::Print("Render targets are not supported. The whole window will be redrawn every frame.");
+        mPartialRedraws = false;
+        return false;
+    }
+
+    int w, h;
+    SDL_GetRendererOutputSize(mpRenderer, &w, &h);
+
+    if (mpFrameTexture && w == mFrameTextureWidth && h == mFrameTextureHeight)
+    {
+        return true;
+    }
+
+    // The window has changed size, so the last frame is no use anymore
+    if (mpFrameTexture)
+    {
+        SDL_DestroyTexture(mpFrameTexture);
+    }
+
+    mpFrameTexture = SDL_CreateTexture(mpRenderer, SDL_PIXELFORMAT_ARGB8888,
+            SDL_TEXTUREACCESS_TARGET, w, h);
+
+    if (!mpFrameTexture)
+    {
+        Log::Error("Failed to create a texture to hold the last frame. The whole window will be redrawn every frame.");
+        Log::SDLError();
+        mPartialRedraws = false;
+        return false;
+    }
+
+    mFrameTextureWidth = w;
+    mFrameTextureHeight = h;
+    *outRecreated = true;
+
+    return true;
+}
+
+bool ascii::Graphics::findChangedSpan(int y, int* startX, int* endX)
+{
+    UChar* characters = characterRow(y);
+    Color* backgroundColors = backgroundColorRow(y);
+    Color* characterColors = characterColorRow(y);
+    Uint8* opacity = opacityRow(y);
+
+    UChar* lastCharacters = mLastFrame.characterRow(y);
+    Color* lastBackgroundColors = mLastFrame.backgroundColorRow(y);
+    Color* lastCharacterColors = mLastFrame.characterColorRow(y);
+    Uint8* lastOpacity = mLastFrame.opacityRow(y);
+
+    auto changed = [&](int x) {
+        return characters[x] != lastCharacters[x]
+            || !(backgroundColors[x] == lastBackgroundColors[x])
+            || !(characterColors[x] == lastCharacterColors[x])
+            || opacity[x] != lastOpacity[x];
+    };
+
+    // Shrink the span from both ends until it starts and ends on a change
+    while (*startX < *endX && !changed(*startX))
+    {
+        ++*startX;
+    }
+    while (*endX > *startX && !changed(*endX - 1))
+    {
+        --*endX;
+    }
+
+    return *startX < *endX;
+}
+
+void ascii::Graphics::findDamage(vector<Rectangle>* outRectangles)
+{
+    PROFILE_SCOPE("Graphics::findDamage");
+
+    // Damaged columns of every row: cells the buffer marked as damaged which
+    // really did change since the last frame, plus anything forced
+    vector<int> rowStart(height(), width());
+    vector<int> rowEnd(height(), 0);
+
+    for (int y = 0; y < height(); ++y)
+    {
+        int startX, endX;
+
+        if (getDamagedSpan(y, &startX, &endX) && findChangedSpan(y, &startX, &endX))
+        {
+            rowStart[y] = startX;
+            rowEnd[y] = endX;
+        }
+    }
+
+    for (size_t i = 0; i < mForcedDamage.size(); ++i)
+    {
+        Rectangle cells = mForcedDamage[i];
+
+        for (int y = max(cells.top(), 0); y < min(cells.bottom(), height()); ++y)
+        {
+            rowStart[y] = min(rowStart[y], max(cells.left(), 0));
+            rowEnd[y] = max(rowEnd[y], min(cells.right(), width()));
+        }
+    }
+
+    // Merge the spans of consecutive rows into rectangles where they overlap
+    Rectangle current(0, 0, 0, 0);
+
+    for (int y = 0; y < height(); ++y)
+    {
+        if (rowStart[y] >= rowEnd[y])
+        {
+            continue;
+        }
+
+        bool overlaps = current.height > 0 && current.bottom() == y
+            && rowStart[y] < current.right() && rowEnd[y] > current.left();
+
+        if (overlaps)
+        {
+            int left = min(current.left(), rowStart[y]);
+            int right = max(current.right(), rowEnd[y]);
+            current = Rectangle(left, current.y, right - left, current.height + 1);
+        }
+        else
+        {
+            if (current.height > 0)
+            {
+                outRectangles->push_back(current);
+            }
+
+            current = Rectangle(rowStart[y], y, rowEnd[y] - rowStart[y], 1);
+        }
+    }
+
+    if (current.height > 0)
+    {
+        outRectangles->push_back(current);
+    }
+}
+
+void ascii::Graphics::drawDamageOverlay(const vector<Rectangle>& damage)
+{
+    SDL_SetRenderDrawBlendMode(mpRenderer, SDL_BLENDMODE_BLEND);
+    SDL_SetRenderDrawColor(mpRenderer, kDamageColor.r, kDamageColor.g, kDamageColor.b, kDamageColor.a);
+
+    for (size_t i = 0; i < damage.size(); ++i)
+    {
+        Rectangle cells = damage[i];
+
+        SDL_Rect rect;
+        rect.x = mDraw.viewport->pixelX(cells.left());
+        rect.y = mDraw.viewport->pixelY(cells.top());
+        rect.w = mDraw.viewport->pixelX(cells.right()) - rect.x;
+        rect.h = mDraw.viewport->pixelY(cells.bottom()) - rect.y;
+
+        SDL_RenderFillRect(mpRenderer, &rect);
+        SDL_RenderDrawRect(mpRenderer, &rect);
+    }
+
+    SDL_SetRenderDrawBlendMode(mpRenderer, SDL_BLENDMODE_NONE);
+}
+
+void ascii::Graphics::update()
+{
+    PROFILE_SCOPE("Graphics::update");
+
+    // If the window has moved to a different display, refresh the scaling
+    // options to fit bigger/smaller screen space
+    if (mLastDisplayIndex != SDL_GetWindowDisplayIndex(mpWindow))
+    {
+        ApplyClosestScaleOption(mCurrentScaleOption);
+    }
+
+    // Any cell with an indexed color may look different under a changed
+    // palette
+    if (mPalette.version() != mDrawnPaletteVersion)
+    {
+        mDrawnPaletteVersion = mPalette.version();
+        invalidate();
+    }
+
+    // Foreground surfaces are drawn fresh every frame, so wherever they are
+    // now or were last frame needs redrawing
+    vector<Rectangle> foregroundRectangles;
+    for (size_t i = 0; i < mForegroundSurfaces.size(); ++i)
     {
         Surface* surface = mForegroundSurfaces[i].first;
         Point position = mForegroundSurfaces[i].second;
 
-        drawSurface(surface, position.x, position.y);
+        Rectangle cells(position.x, position.y, surface->width(), surface->height());
+        foregroundRectangles.push_back(cells);
+
+        // Anything drawn outside of the buffer can only be cleaned up by
+        // redrawing everything
+        if (cells.left() < 0 || cells.top() < 0
+                || cells.right() > width() || cells.bottom() > height())
+        {
+            invalidate();
+        }
     }
+    mForcedDamage.insert(mForcedDamage.end(), foregroundRectangles.begin(), foregroundRectangles.end());
+    mForcedDamage.insert(mForcedDamage.end(), mLastForegroundRectangles.begin(), mLastForegroundRectangles.end());
+
+    mRedrawnRectangles.clear();
+
+    // Without partial redraws, every frame is drawn from scratch
+    bool fullRedraw = mFullRedraw || !mPartialRedraws;
+
+    if (fullRedraw)
+    {
+        mRedrawnRectangles.push_back(Rectangle(0, 0, width(), height()));
+    }
+    else
+    {
+        findDamage(&mRedrawnRectangles);
+    }
+
+    // Remember what is drawn, to compare the next frame against
+    for (size_t i = 0; i < mRedrawnRectangles.size(); ++i)
+    {
+        Rectangle cells = mRedrawnRectangles[i];
+        mLastFrame.copySurface(this, cells, cells.x, cells.y);
+    }
+
+    // The window still shows the last frame presented, so an identical one
+    // doesn't need presenting
+    bool skip = mSkipUnchangedFrames && mRedrawnRectangles.empty();
+
+    if (!skip)
+    {
+        if (mpRenderThread)
+        {
+            publishFrame(mRedrawnRectangles, fullRedraw);
+        }
+        else
+        {
+            mDraw = liveView();
+            drawFrame(mRedrawnRectangles, fullRedraw);
+        }
+
+        ++mFramesPresented;
+    }
+
+    resetDamage();
+    mFullRedraw = false;
+    mForcedDamage.clear();
+    mLastForegroundRectangles = foregroundRectangles;
 
     // Clear any surfaces from the foreground
     mForegroundSurfaces.clear();
+}
+
+ascii::Graphics::FrameView ascii::Graphics::liveView()
+{
+    FrameView view;
+    view.buffer = this;
+    view.cellFonts = &mCellFonts;
+    view.fonts = &mScaledFonts;
+    view.fontNames = &mScaledFontNames;
+    view.fontGeneration = mFontGeneration;
+    view.backgroundImages = &mBackgroundImages;
+    view.foregroundImages = &mForegroundImages;
+    view.foregroundSurfaces = &mForegroundSurfaces;
+    view.palette = &mPalette;
+    view.viewport = &mViewport;
+    view.backgroundColor = mBackgroundColor;
+    view.hidingImages = mHidingImages;
+    return view;
+}
+
+void ascii::Graphics::publishFrame(const vector<Rectangle>& damage, bool fullRedraw)
+{
+    PROFILE_SCOPE("Graphics::publishFrame");
+
+    // Only the game thread touches the back snapshot
+    FrameSnapshot& snapshot = mSnapshots[mBackSnapshot];
+
+    if (snapshot.buffer.width() != width() || snapshot.buffer.height() != height())
+    {
+        snapshot.buffer = Surface(width(), height());
+    }
+    CopyCells(&snapshot.buffer, this);
+    snapshot.cellFonts = mCellFonts;
+
+    // Fonts rarely change, so only copy them when they do
+    if (snapshot.fontGeneration != mFontGeneration || snapshot.fonts.empty())
+    {
+        snapshot.fonts = mScaledFonts;
+        snapshot.fontNames = mScaledFontNames;
+        snapshot.fontGeneration = mFontGeneration;
+    }
+
+    snapshot.backgroundImages = mBackgroundImages;
+    snapshot.foregroundImages = mForegroundImages;
+
+    // Foreground surfaces belong to the game, which may change them as soon
+    // as this returns
+    snapshot.foregroundCopies.resize(mForegroundSurfaces.size(), Surface(1, 1));
+    snapshot.foregroundSurfaces.clear();
+    for (size_t i = 0; i < mForegroundSurfaces.size(); ++i)
+    {
+        Surface* surface = mForegroundSurfaces[i].first;
+        Surface& copy = snapshot.foregroundCopies[i];
+
+        if (copy.width() != surface->width() || copy.height() != surface->height())
+        {
+            copy = Surface(surface->width(), surface->height());
+        }
+        CopyCells(&copy, surface);
+
+        snapshot.foregroundSurfaces.push_back(make_pair(&copy, mForegroundSurfaces[i].second));
+    }
+
+    snapshot.palette = mPalette;
+    snapshot.viewport = mViewport;
+
+    FrameView& view = snapshot.view;
+    view.buffer = &snapshot.buffer;
+    view.cellFonts = &snapshot.cellFonts;
+    view.fonts = &snapshot.fonts;
+    view.fontNames = &snapshot.fontNames;
+    view.fontGeneration = snapshot.fontGeneration;
+    view.backgroundImages = &snapshot.backgroundImages;
+    view.foregroundImages = &snapshot.foregroundImages;
+    view.foregroundSurfaces = &snapshot.foregroundSurfaces;
+    view.palette = &snapshot.palette;
+    view.viewport = &snapshot.viewport;
+    view.backgroundColor = mBackgroundColor;
+    view.hidingImages = mHidingImages;
+
+    snapshot.damage = damage;
+    snapshot.fullRedraw = fullRedraw;
+
+    SDL_AtomicLock(&mSnapshotLock);
+
+    // If the render thread never got to the last frame published, this one
+    // replaces it, so has to redraw what it would have
+    if (mReadyFresh)
+    {
+        FrameSnapshot& skipped = mSnapshots[mReadySnapshot];
+        snapshot.damage.insert(snapshot.damage.end(), skipped.damage.begin(), skipped.damage.end());
+        snapshot.fullRedraw = snapshot.fullRedraw || skipped.fullRedraw;
+    }
+
+    swap(mBackSnapshot, mReadySnapshot);
+    mReadyFresh = true;
+
+    SDL_AtomicUnlock(&mSnapshotLock);
+
+    mpRenderThread->FramePublished();
+}
+
+void ascii::Graphics::drawPublishedFrame()
+{
+    SDL_AtomicLock(&mSnapshotLock);
+
+    bool fresh = mReadyFresh;
+    if (fresh)
+    {
+        swap(mReadySnapshot, mFrontSnapshot);
+        mReadyFresh = false;
+    }
+
+    SDL_AtomicUnlock(&mSnapshotLock);
+
+    if (!fresh)
+    {
+        return;
+    }
+
+    // Only the render thread touches the front snapshot
+    FrameSnapshot& snapshot = mSnapshots[mFrontSnapshot];
+    mDraw = snapshot.view;
+    drawFrame(snapshot.damage, snapshot.fullRedraw);
+}
+
+void ascii::Graphics::drawFrame(const vector<Rectangle>& damage, bool fullRedraw)
+{
+    PROFILE_SCOPE("Graphics::drawFrame");
+
+    bool recreated;
+
+    if (prepareFrameTexture(&recreated))
+    {
+        // Draw into the last frame, redrawing only what changed
+        SDL_SetRenderTarget(mpRenderer, mpFrameTexture);
+
+        if (fullRedraw || recreated)
+        {
+            drawLayers(NULL);
+        }
+        else
+        {
+            for (size_t i = 0; i < damage.size(); ++i)
+            {
+                Rectangle cells = damage[i];
+                drawLayers(&cells);
+            }
+        }
+
+        SDL_SetRenderTarget(mpRenderer, NULL);
+
+        SDL_RenderCopy(mpRenderer, mpFrameTexture, NULL, NULL);
+        PROFILE_DRAW_CALL(mpFrameTexture);
+    }
+    else
+    {
+        drawLayers(NULL);
+    }
+
+    if (mShowDamage)
+    {
+        drawDamageOverlay(damage);
+    }
 
     // Refresh the window to show all changes
     refresh();
 }
 
+void ascii::Graphics::setVsync(bool vsync)
+{
+    if (vsync == mVsync || mHeadless)
+    {
+        return;
+    }
+
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+    int result;
+    RenderThread::Run(mpRenderThread, [this, vsync, &result]() {
+        result = SDL_RenderSetVSync(mpRenderer, vsync ? 1 : 0);
+    });
+
+    if (result == 0)
+    {
+        mVsync = vsync;
+        return;
+    }
+
+    Log::Error("Failed to change vsync.");
+    Log::SDLError();
+#else
+    Log::Warning("Vsync can only be chosen at startup with this version of SDL, using the \"vsync\" global arg.");
+#endif
+}
+
+SDL_Surface* ascii::Graphics::readPixels()
+{
+    SDL_Surface* pixels = NULL;
+
+    // Waits for any frame published so far to be drawn first
+    RenderThread::Run(mpRenderThread, [this, &pixels]() {
+        int w, h;
+        SDL_GetRendererOutputSize(mpRenderer, &w, &h);
+
+        pixels = SDL_CreateRGBSurface(0, w, h, 32,
+                0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000);
+
+        if (!pixels)
+        {
+            Log::Error("Failed to create a surface to read the frame into.");
+            Log::SDLError();
+            return;
+        }
+
+        if (SDL_RenderReadPixels(mpRenderer, NULL, SDL_PIXELFORMAT_ARGB8888,
+                    pixels->pixels, pixels->pitch) != 0)
+        {
+            Log::Error("Failed to read back the pixels of the last frame.");
+            Log::SDLError();
+            SDL_FreeSurface(pixels);
+            pixels = NULL;
+        }
+    });
+
+    return pixels;
+}
+
 void ascii::Graphics::drawForegroundSurface(ascii::Surface* surface, int x, int y)
 {
     mForegroundSurfaces.push_back(make_pair(surface, Point(x, y)));
 }
 
+void ascii::Graphics::setWindowBackgroundColor(Color color)
+{
+    if (!(color == mBackgroundColor))
+    {
+        invalidate();
+    }
+
+    mBackgroundColor = color;
+}
+
 void ascii::Graphics::addBackgroundImage(std::string key, std::string textureKey, int x, int y)
 {
+    pinImage(mBackgroundImageTextures, key, textureKey);
 	mBackgroundImages[key] = std::make_pair(mpCache->getTexture(textureKey), ascii::Point(x, y));
+    invalidate();
 }
 
 void ascii::Graphics::removeBackgroundImage(std::string key)
 {
+    unpinImage(mBackgroundImageTextures, key);
 	mBackgroundImages.erase(key);
+    invalidate();
 }
 
 void ascii::Graphics::addForegroundImage(std::string key, std::string textureKey, int x, int y)
 {
+    pinImage(mForegroundImageTextures, key, textureKey);
 	mForegroundImages[key] = std::make_pair(mpCache->getTexture(textureKey), ascii::Point(x, y));
+    invalidate();
 }
 
 void ascii::Graphics::removeForegroundImage(std::string key)
 {
+    unpinImage(mForegroundImageTextures, key);
 	mForegroundImages.erase(key);
+    invalidate();
 }
 
 void ascii::Graphics::clearImages()
 {
+    while (!mBackgroundImageTextures.empty())
+    {
+        unpinImage(mBackgroundImageTextures, mBackgroundImageTextures.begin()->first);
+    }
+    while (!mForegroundImageTextures.empty())
+    {
+        unpinImage(mForegroundImageTextures, mForegroundImageTextures.begin()->first);
+    }
+
 	mBackgroundImages.clear();
 	mForegroundImages.clear();
+    invalidate();
+}
+
+void ascii::Graphics::pinImage(std::map<std::string, std::string>& textureKeys, std::string key, std::string textureKey)
+{
+    // Pin first, so that replacing an image with the same texture never
+    // leaves it unpinned
+    mpCache->pinTexture(textureKey);
+    unpinImage(textureKeys, key);
+
+    textureKeys[key] = textureKey;
+}
+
+void ascii::Graphics::unpinImage(std::map<std::string, std::string>& textureKeys, std::string key)
+{
+    auto it = textureKeys.find(key);
+    if (it == textureKeys.end()) return;
+
+    mpCache->unpinTexture(it->second);
+    textureKeys.erase(it);
 }
 
 void ascii::Graphics::hideImages()
 {
+    if (!mHidingImages)
+    {
+        invalidate();
+    }
+
     mHidingImages = true;
 }
 
 void ascii::Graphics::showImages()
 {
+    if (mHidingImages)
+    {
+        invalidate();
+    }
+
     mHidingImages = false;
 }
 
@@ -520,45 +1453,93 @@ void ascii::Graphics::checkSize()
 
 void ascii::Graphics::clearCellFonts()
 {
-    for (int x = 0; x < width(); ++x)
-    {
-        for (int y = 0; y < height(); ++y)
-        {
-            mCellFonts[x][y] = "";
-        }
-    }
+    setCellFont(Rectangle(0, 0, width(), height()), "");
 }
 
 void ascii::Graphics::setCellFont(Rectangle cells, string font)
 {
-    for (int x = cells.x; x < cells.right(); ++x)
+    Uint16 id = fontId(font);
+
+    // Track which cells actually change font, because they will need to be
+    // redrawn
+    int left = cells.right(), right = cells.left();
+    int top = cells.bottom(), bottom = cells.top();
+
+    for (int y = cells.y; y < cells.bottom(); ++y)
     {
-        for (int y = cells.y; y < cells.bottom(); ++y)
+        Uint16* cellFonts = &mCellFonts[y * width()];
+
+        for (int x = cells.x; x < cells.right(); ++x)
         {
-            mCellFonts[x][y] = font;
+            if (cellFonts[x] != id)
+            {
+                cellFonts[x] = id;
+
+                left = min(left, x);
+                right = max(right, x + 1);
+                top = min(top, y);
+                bottom = max(bottom, y + 1);
+            }
         }
     }
+
+    if (left < right)
+    {
+        mForcedDamage.push_back(Rectangle(left, top, right - left, bottom - top));
+    }
 }
 
-PixelFont* ascii::Graphics::GetFont(string key)
+Uint16 ascii::Graphics::fontId(string key)
 {
-    PixelFont* font = NULL;
+    auto it = mFontIds.find(key);
+    if (it != mFontIds.end())
+    {
+        return it->second;
+    }
+
+    // Fonts can be assigned to cells before they are added, so unknown keys
+    // get an ID too, and find their font once it is loaded
+    Uint16 id = (Uint16) mFontKeys.size();
+    mFontIds[key] = id;
+    mFontKeys.push_back(key);
+    mScaledFonts.push_back(NULL);
+    mScaledFontNames.push_back(key);
+    resolveFonts();
+    return id;
+}
 
-    if (key.empty())
+void ascii::Graphics::resolveFonts()
+{
+    for (size_t id = 0; id < mFontKeys.size(); ++id)
     {
-        key = mDefaultFont;
+        string key = id == 0 ? mDefaultFont : mFontKeys[id];
+
+        stringstream sstream;
+        sstream << key << (mCharHeight * mScale);
+
+        auto it = mFonts.find(sstream.str());
+        mScaledFonts[id] = it != mFonts.end() ? it->second : NULL;
+        mScaledFontNames[id] = key;
     }
 
-    stringstream sstream;
-    sstream << key << (mCharHeight * mScale);
-    key = sstream.str();
+    ++mFontGeneration;
+}
+
+PixelFont* ascii::Graphics::GetFont(Uint16 id)
+{
+    // Called while drawing, so reads the fonts of the frame being drawn
+    PixelFont* font = (*mDraw.fonts)[id];
 
-    if (mFonts.find(key) != mFonts.end())
+    if (mReportedFontGeneration != mDraw.fontGeneration)
     {
-        font = mFonts[key];
+        mReportedMissingFonts.assign(mDraw.fonts->size(), false);
+        mReportedFontGeneration = mDraw.fontGeneration;
     }
-    else
+
+    if (!font && !mReportedMissingFonts[id])
     {
+        string key = (*mDraw.fontNames)[id];
+
         string error = "Graphics tried to render a character in a nonexistent font: ";
         if (key.empty())
         {
@@ -570,6 +1551,7 @@ PixelFont* ascii::Graphics::GetFont(string key)
         }
 
         Log::Error(error);
+        mReportedMissingFonts[id] = true;
     }
 
     return font;
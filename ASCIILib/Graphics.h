@@ -1,6 +1,7 @@
 #ifndef GRAPHICS_H
 #define GRAPHICS_H
 
+#include <atomic>
 #include <map>
 #include <string>
 using namespace std;
@@ -8,13 +9,63 @@ using namespace std;
 #include <SDL.h>
 
 #include "Surface.h"
+#include "ImageCache.h"
 #include "Rectangle.h"
 #include "Point.h"
 #include "PixelFont.h"
+#include "RenderThread.h"
+
+// SDL_RenderGeometry() is needed to draw a run of images from the same atlas
+// page in one call
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+#define ASCIILIB_IMAGE_BATCHING
+#endif
 
 namespace ascii
 {
 
+    // Where the cells of the buffer land in the window. Kept by Graphics and
+    // only recomputed when the window or the scale changes
+    struct Viewport
+    {
+        Viewport() : cellWidth(0), cellHeight(0), scale(1) { }
+
+        // Top-left pixel of the given column or row
+        int pixelX(int cellX) const
+        {
+            if (cellX >= 0 && cellX < (int) columnX.size())
+            {
+                return columnX[cellX];
+            }
+
+            // Images and foreground surfaces can hang off the edge of the
+            // buffer
+            return origin.x + (int) (cellX * cellWidth);
+        }
+
+        int pixelY(int cellY) const
+        {
+            if (cellY >= 0 && cellY < (int) rowY.size())
+            {
+                return rowY[cellY];
+            }
+
+            return origin.y + (int) (cellY * cellHeight);
+        }
+
+        // Top-left pixel of the buffer, which is centered in windows larger
+        // than it
+        Point origin;
+        float cellWidth, cellHeight;
+        // Scale images are drawn at
+        float scale;
+
+        // Left pixel of every column and top pixel of every row, with one
+        // extra entry for the right and bottom edges of the buffer
+        vector<int> columnX;
+        vector<int> rowY;
+    };
+
 	///<summary>
 	/// Handles all rendering for an ASCIILib game.
 	///</summary>
@@ -35,10 +86,14 @@ namespace ascii
 			/// Creates a game window and sets up the Graphics instance.
 			///</summary>
 			///<param name="title">The title of the game window.</param>
+			///<param name="headless">If true, the window stays hidden and
+			/// frames are drawn by the software renderer, so that they can
+			/// be read back without a display or GPU.</param>
 			Graphics(const char* title, int charWidth, int charHeight,
                     vector<float> scaleOptions, int currentScaleOption,
                     bool fullscreen,
-                    int bufferWidth=kBufferWidth, int bufferHeight=kBufferHeight);
+                    int bufferWidth=kBufferWidth, int bufferHeight=kBufferHeight,
+                    bool headless=false);
 			~Graphics();
 
             // Applies the desired scale option, or the next smallest option
@@ -85,6 +140,10 @@ namespace ascii
 			///</summary>
 			ImageCache* imageCache() { return mpCache; }
 
+            // Indexed colors of every surface drawn are looked up in this
+            // palette. Changing it redraws the window on the next update
+            Palette* palette() { return &mPalette; }
+
 			int charWidth() { return mCharWidth; }
 			int charHeight() { return mCharHeight; }
 
@@ -93,12 +152,54 @@ namespace ascii
 
             int cellToPixelX(int cellX);
             int cellToPixelY(int cellY);
+
+            // Recompute where cells are drawn in the window. Must be called
+            // when the window changes size
+            void updateViewport();
+            const Viewport& viewport() { return mViewport; }
 			///<summary>
 			/// Renders the rendering buffer in its current state.
 			///</summary>
 			void update();
 
-			void setWindowBackgroundColor(Color color) { mBackgroundColor = color; }
+            bool headless() { return mHeadless; }
+
+            // Don't present frames which are identical to the last one. Only
+            // takes effect when partial redraws are possible
+            void setSkipUnchangedFrames(bool skip) { mSkipUnchangedFrames = skip; }
+            // Number of frames update() has presented so far
+            Uint32 framesPresented() { return mFramesPresented; }
+
+            // Whether presenting waits for vsync. Starts on with the "vsync"
+            // global arg. Changing it later requires SDL 2.0.18
+            void setVsync(bool vsync);
+            bool vsync() { return mVsync; }
+
+            // Whether frames are drawn on a separate render thread, which
+            // starts with the "render-thread" global arg. update() then only
+            // publishes a snapshot of the frame and returns, while the render
+            // thread draws and presents it. The renderer may only be used
+            // from that thread, so pass renderThread() to RenderThread::Run()
+            // for anything which needs it
+            bool renderThreaded() { return mpRenderThread != NULL; }
+            RenderThread* renderThread() { return mpRenderThread; }
+
+            // Read back the pixels of the last frame drawn by update(), as
+            // an ARGB8888 surface which the caller must free. Only reliable
+            // in headless mode, where frames are drawn in software
+            SDL_Surface* readPixels();
+
+			void setWindowBackgroundColor(Color color);
+
+            // Force the next update to redraw the whole window instead of just
+            // the cells which changed
+            void invalidate() { mFullRedraw = true; }
+
+            // Cell rectangles which were redrawn by the last update
+            vector<Rectangle> redrawnRectangles() { return mRedrawnRectangles; }
+
+            // Highlight the regions redrawn each frame, for debugging
+            void setShowDamage(bool showDamage) { mShowDamage = showDamage; }
 
 			///<summary>
 			/// Draw a surface in the VERY foreground of the screen
@@ -164,16 +265,119 @@ namespace ascii
 
 		private:
 			typedef pair<string, Color> Glyph;
-			typedef pair<SDL_Texture*, Point> Image;
+			typedef pair<ImageCache::TextureRegion, Point> Image;
             typedef pair<Surface*, Point> ForegroundSurface;
 
+            // Everything drawing a frame reads. Points either at this
+            // Graphics' own state, or at a snapshot of it taken for the
+            // render thread
+            struct FrameView
+            {
+                Surface* buffer;
+                vector<Uint16>* cellFonts;
+                vector<PixelFont*>* fonts;
+                vector<string>* fontNames;
+                Uint32 fontGeneration;
+                map<string, Image>* backgroundImages;
+                map<string, Image>* foregroundImages;
+                vector<ForegroundSurface>* foregroundSurfaces;
+                Palette* palette;
+                Viewport* viewport;
+                Color backgroundColor;
+                bool hidingImages;
+            };
+
+            // A frame published for the render thread, with copies of
+            // everything it draws so that the game can go on changing the
+            // buffer while it is drawn
+            struct FrameSnapshot
+            {
+                FrameSnapshot() : buffer(1, 1), fontGeneration(0), fullRedraw(false) { }
+
+                Surface buffer;
+                vector<Uint16> cellFonts;
+                vector<PixelFont*> fonts;
+                vector<string> fontNames;
+                Uint32 fontGeneration;
+                map<string, Image> backgroundImages;
+                map<string, Image> foregroundImages;
+                vector<Surface> foregroundCopies;
+                vector<ForegroundSurface> foregroundSurfaces;
+                Palette palette;
+                Viewport viewport;
+                FrameView view;
+
+                // Cells which changed since the last frame drawn
+                vector<Rectangle> damage;
+                bool fullRedraw;
+            };
+
+            // View of this Graphics' own state
+            FrameView liveView();
+
+            // Copy the current state into the back snapshot and swap it with
+            // the ready one, for the render thread to pick up
+            void publishFrame(const vector<Rectangle>& damage, bool fullRedraw);
+
+            // Take the latest published snapshot and draw it. Called on the
+            // render thread
+            void drawPublishedFrame();
+
+            // Draw and present the frame mDraw views, redrawing only the
+            // given cells unless fullRedraw is set
+            void drawFrame(const vector<Rectangle>& damage, bool fullRedraw);
+
             void clearScreen();
             void drawImages(map<string, Image>* images);
-            void drawBackgroundColors(Surface* surface, int x, int y);
-            void drawCharacters(Surface* surface, int x, int y);
-            void drawSurface(Surface* surface, int x, int y);
+            // Draw an image along with the others queued from its texture
+            void queueImage(const ImageCache::TextureRegion& region, const SDL_Rect& dest);
+            void flushImages();
+            // Keep the texture an image shows from being evicted from the
+            // cache, and stop keeping the one it showed before
+            void pinImage(map<string, string>& textureKeys, string key, string textureKey);
+            void unpinImage(map<string, string>& textureKeys, string key);
+            void drawBackgroundColors(Surface* surface, int x, int y, Rectangle source);
+
+            // A rectangle of cells which share a background color
+            struct BackgroundRun
+            {
+                int left, right, top, bottom;
+                Color color;
+            };
+
+            // Rectangles to fill in one color, with a single draw call
+            struct BackgroundBatch
+            {
+                Color color;
+                vector<SDL_Rect> rects;
+            };
+
+            // Queue the pixels of a run of the surface drawn at (x, y)
+            void queueBackgroundRun(const BackgroundRun& run, int x, int y);
+            void flushBackgroundRuns();
+            void drawCharacters(Surface* surface, int x, int y, Rectangle source);
+            void drawSurface(Surface* surface, int x, int y, Rectangle source);
             void refresh();
 
+            // Draw every layer of the window, limited to the given cells of
+            // the buffer, or everywhere if cells is NULL
+            void drawLayers(Rectangle* cells);
+
+            // Make sure the texture holding the last frame matches the
+            // window. Returns false if it can't be used. Sets outRecreated
+            // if its old contents were lost
+            bool prepareFrameTexture(bool* outRecreated);
+
+            // Find the cell rectangles which differ from the last frame drawn
+            void findDamage(vector<Rectangle>* outRectangles);
+
+            // Narrow the span of a buffer row to the cells which differ from
+            // the last frame drawn. Returns false if none of them do
+            bool findChangedSpan(int y, int* startX, int* endX);
+
+            // Tint the regions redrawn this frame
+            void drawDamageOverlay(const vector<Rectangle>& cells);
+
 			///<summary>
 			/// Ensures that this Graphics instance was not created with dimensions too small to fit
 			///</summary>
@@ -187,24 +391,109 @@ namespace ascii
 
             const char* mTitle;
             bool mFullscreen;
+            bool mHeadless;
+            bool mVsync;
 			Color mBackgroundColor;
 
 			map<string, Image> mBackgroundImages;
 			map<string, Image> mForegroundImages;
+            // The texture key each image was added with
+            map<string, string> mBackgroundImageTextures;
+            map<string, string> mForegroundImageTextures;
             vector<ForegroundSurface> mForegroundSurfaces;
-            vector<vector<string> > mCellFonts;
             bool mHidingImages;
 
+            // Fonts are stored under their key followed by their size
             map<string, PixelFont*> mFonts;
-            PixelFont* GetFont(string key);
             string mDefaultFont;
 
+            // Font keys are numbered as they are first seen, so that cells
+            // can refer to them cheaply. ID 0 always means the default font
+            Uint16 fontId(string key);
+
+            // Find the font of each ID at the current scale. Called whenever
+            // the fonts, the default font or the scale change
+            void resolveFonts();
+
+            // Font to draw a cell in. NULL if the font isn't loaded at the
+            // current scale, which is reported once per resolution
+            PixelFont* GetFont(Uint16 id);
+
+            map<string, Uint16> mFontIds;
+            vector<string> mFontKeys;
+            vector<PixelFont*> mScaledFonts;
+            // Key each ID resolved to, for error messages
+            vector<string> mScaledFontNames;
+            // Counts resolutions, so the drawing side knows when to report
+            // missing fonts again
+            Uint32 mFontGeneration;
+            vector<bool> mReportedMissingFonts;
+            Uint32 mReportedFontGeneration;
+
+            // Font ID of every cell, row by row
+            vector<Uint16> mCellFonts;
+
             float mScale;
 
             vector<float> mScaleOptions;
             int mCurrentScaleOption;
 
             int mLastDisplayIndex;
+
+            Viewport mViewport;
+
+            Palette mPalette;
+            // Version of the palette the last frame was drawn with
+            Uint32 mDrawnPaletteVersion;
+
+            bool mSkipUnchangedFrames;
+            Uint32 mFramesPresented;
+
+            // Partial redraws: the window is drawn into a texture which keeps
+            // the last frame, so that each update only needs to redraw the
+            // cells which changed since then
+            // Cleared by whichever thread draws, if it finds it can't do
+            // partial redraws
+            atomic<bool> mPartialRedraws;
+            SDL_Texture* mpFrameTexture;
+            int mFrameTextureWidth, mFrameTextureHeight;
+            // The buffer as it was last drawn into the frame texture
+            Surface mLastFrame;
+            bool mFullRedraw;
+            // Cells which need redrawing even if the buffer didn't change
+            vector<Rectangle> mForcedDamage;
+            vector<Rectangle> mLastForegroundRectangles;
+            vector<Rectangle> mRedrawnRectangles;
+            bool mShowDamage;
+
+            // Background runs still growing downward, and those found in the
+            // current row. Kept between frames to reuse their memory
+            vector<BackgroundRun> mOpenRuns;
+            vector<BackgroundRun> mRowRuns;
+            vector<BackgroundBatch> mBackgroundBatches;
+            size_t mLastBackgroundBatch;
+
+#ifdef ASCIILIB_IMAGE_BATCHING
+            // Quads of consecutive images from the same texture, waiting to
+            // be drawn in one call
+            SDL_Texture* mpImageBatchTexture;
+            int mImageBatchWidth, mImageBatchHeight;
+            vector<SDL_Vertex> mImageVertices;
+            vector<int> mImageIndices;
+#endif
+
+            // What the frame being drawn reads from
+            FrameView mDraw;
+
+            // Pipelined mode: the game fills the back snapshot and swaps it
+            // with the ready one, which the render thread swaps with the
+            // front one to draw. Neither side ever waits for the other
+            RenderThread* mpRenderThread;
+            FrameSnapshot mSnapshots[3];
+            int mBackSnapshot, mReadySnapshot, mFrontSnapshot;
+            // Whether the ready snapshot has been published but not drawn
+            bool mReadyFresh;
+            SDL_SpinLock mSnapshotLock;
 	};
 
 };
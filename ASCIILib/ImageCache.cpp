@@ -1,18 +1,67 @@
 #include "ImageCache.h"
 
+#include <algorithm>
 #include <iostream>
 using namespace std;
 
-#include <SDL_image.h>
-
 #include "Log.h"
 using ascii::Log;
 
 
-ascii::ImageCache::ImageCache(SDL_Renderer* renderer, int charWidth, int charHeight)
-	: mRenderer(renderer), mCharWidth(charWidth), mCharHeight(charHeight)
+namespace
+{
+    // Width and height of atlas pages, unless the renderer can't take
+    // textures that big
+    const int kAtlasPageSize = 1024;
+
+    // Images bigger than this in either dimension get their own textures
+    const int kMaxAtlasImageSize = 256;
+
+    // Border of extruded edge pixels around each packed image
+    const int kAtlasPadding = 1;
+
+    // Types of asset in the memory budget. Images packed into an atlas page
+    // are budgeted as part of the page
+    const int kTextureAsset = 0;
+    const int kAtlasPageAsset = 1;
+}
+
+ascii::ImageCache::ImageCache(SDL_Renderer* renderer, int charWidth, int charHeight,
+        RenderThread* renderThread)
+	: mRenderer(renderer), mpRenderThread(renderThread),
+    mCharWidth(charWidth), mCharHeight(charHeight),
+    mTextureFormat(SDL_PIXELFORMAT_ARGB8888), mAtlasPageSize(kAtlasPageSize),
+    mAtlasPagesCreated(0), mBudget(2)
 {
+    // Decode images straight into the first 32-bit format with alpha which
+    // the renderer takes, so that uploading them needs no conversion
+    RenderThread::Run(mpRenderThread, [this]() {
+        SDL_RendererInfo info;
+        if (!mRenderer || SDL_GetRendererInfo(mRenderer, &info) != 0)
+        {
+            return;
+        }
+
+        if (info.max_texture_width > 0 && info.max_texture_width < mAtlasPageSize)
+        {
+            mAtlasPageSize = info.max_texture_width;
+        }
+        if (info.max_texture_height > 0 && info.max_texture_height < mAtlasPageSize)
+        {
+            mAtlasPageSize = info.max_texture_height;
+        }
 
+        for (Uint32 i = 0; i < info.num_texture_formats; ++i)
+        {
+            Uint32 format = info.texture_formats[i];
+            if (!SDL_ISPIXELFORMAT_FOURCC(format) && SDL_ISPIXELFORMAT_ALPHA(format)
+                    && SDL_BYTESPERPIXEL(format) == 4)
+            {
+                mTextureFormat = format;
+                break;
+            }
+        }
+    });
 }
 
 ascii::ImageCache::~ImageCache()
@@ -22,35 +71,234 @@ ascii::ImageCache::~ImageCache()
 
 void ascii::ImageCache::loadTexture(std::string key, string path, ascii::Color colorKey)
 {
-	SDL_Surface* imageSurface = IMG_Load(path.c_str());
-    if (!imageSurface)
+    // Errors are logged while decoding
+    DecodedImage* image = DecodedImage::Load(path, mTextureFormat, colorKey);
+    if (!image)
     {
-        Log::Error("Failed to load texture: " + path);
-        Log::SDLError();
 		return;
     }
 
+    addTexture(key, image, path, colorKey);
+}
+
+void ascii::ImageCache::addTexture(std::string key, SDL_Surface* imageSurface, string path, ascii::Color colorKey)
+{
+    addTexture(key, DecodedImage::FromSurface(imageSurface, mTextureFormat, colorKey), path, colorKey);
+}
+
+void ascii::ImageCache::addTexture(std::string key, DecodedImage* image, string path, ascii::Color colorKey)
+{
+    if (!image)
+    {
+        return;
+    }
+
 	//Make sure the image dimensions will align to the buffer
-	if (imageSurface->w % mCharWidth != 0 || imageSurface->h % mCharHeight != 0)
+	if (image->width % mCharWidth != 0 || image->height % mCharHeight != 0)
     {
         Log::Error("Warning! Loaded a texture which does not align with buffer: " + path);
     }
 
-    if (!colorKey.isNone)
+    // Replacing an image mustn't leak the old one. It goes first, so that it
+    // can't share a page with its replacement
+    auto existing = mTextures.find(key);
+    if (existing != mTextures.end())
+    {
+        destroyEntry(key, existing->second);
+        mBudget.remove(kTextureAsset, key);
+        mTextures.erase(existing);
+    }
+
+    Entry entry;
+    entry.path = path;
+    entry.colorKey = colorKey;
+
+    if (addToAtlas(key, image, &entry))
+    {
+        entry.packed = true;
+    }
+    else
+    {
+        // Decoding happens here, but only the renderer's thread can upload
+        SDL_Texture* imageTexture = NULL;
+        RenderThread::Run(mpRenderThread, [&]() {
+            imageTexture = SDL_CreateTexture(mRenderer, image->format,
+                    SDL_TEXTUREACCESS_STATIC, image->width, image->height);
+
+            if (imageTexture && SDL_UpdateTexture(imageTexture, NULL,
+                        image->pixels.empty() ? NULL : &image->pixels[0], image->pitch) != 0)
+            {
+                SDL_DestroyTexture(imageTexture);
+                imageTexture = NULL;
+            }
+
+            if (imageTexture && image->blended)
+            {
+                SDL_SetTextureBlendMode(imageTexture, SDL_BLENDMODE_BLEND);
+            }
+        });
+        if (!imageTexture)
+        {
+            Log::Error("Failed to create texture " + path);
+            Log::SDLError();
+        }
+
+        entry.region.texture = imageTexture;
+        entry.region.source.w = image->width;
+        entry.region.source.h = image->height;
+    }
+
+	mTextures[key] = entry;
+
+    // Atlas pages are counted when they're created
+    if (entry.region.texture && !entry.packed)
+    {
+        size_t bytes = (size_t) image->width * image->height * SDL_BYTESPERPIXEL(image->format);
+        mBudget.add(kTextureAsset, key, bytes, !path.empty());
+    }
+
+    if (entry.region.texture)
+    {
+        evictTextures(key);
+    }
+
+	delete image;
+}
+
+bool ascii::ImageCache::addToAtlas(const string& key, DecodedImage* image, Entry* outEntry)
+{
+    int paddedWidth = image->width + 2 * kAtlasPadding;
+    int paddedHeight = image->height + 2 * kAtlasPadding;
+
+    if (image->width == 0 || image->height == 0
+            || image->width > kMaxAtlasImageSize || image->height > kMaxAtlasImageSize
+            || paddedWidth > mAtlasPageSize || paddedHeight > mAtlasPageSize)
+    {
+        return false;
+    }
+
+    // Lay out the image with its border before handing it to the renderer
+    vector<Uint32> padded((size_t) paddedWidth * paddedHeight);
+    for (int y = 0; y < paddedHeight; ++y)
     {
-        SDL_SetColorKey(imageSurface, SDL_ENABLE, colorKey.ToUint32(imageSurface->format));
+        int sourceY = min(max(y - kAtlasPadding, 0), image->height - 1);
+        const Uint32* sourceRow = (const Uint32*) &image->pixels[(size_t) sourceY * image->pitch];
+        Uint32* row = &padded[(size_t) y * paddedWidth];
+
+        for (int x = 0; x < paddedWidth; ++x)
+        {
+            row[x] = sourceRow[min(max(x - kAtlasPadding, 0), image->width - 1)];
+        }
     }
 
-	SDL_Texture* imageTexture = SDL_CreateTextureFromSurface(mRenderer, imageSurface);
-    if (!imageTexture)
+    SDL_Rect dest;
+    dest.w = paddedWidth;
+    dest.h = paddedHeight;
+
+    // Earlier pages are fuller, so try the newest first
+    AtlasPage* page = NULL;
+    for (int i = (int) mAtlasPages.size() - 1; i >= 0 && !page; --i)
+    {
+        if (mAtlasPages[i]->pack(paddedWidth, paddedHeight, mAtlasPageSize, &dest.x, &dest.y))
+        {
+            page = mAtlasPages[i];
+        }
+    }
+
+    bool uploaded = false;
+    bool created = false;
+
+    RenderThread::Run(mpRenderThread, [&]() {
+        if (!page)
+        {
+            SDL_Texture* texture = SDL_CreateTexture(mRenderer, mTextureFormat,
+                    SDL_TEXTUREACCESS_STATIC, mAtlasPageSize, mAtlasPageSize);
+            if (!texture)
+            {
+                return;
+            }
+
+            // Pages hold transparent and opaque images alike. Opaque ones
+            // have full alpha, so blending doesn't change them
+            SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+
+            page = new AtlasPage();
+            page->texture = texture;
+            page->budgetKey = to_string(mAtlasPagesCreated++);
+            created = true;
+
+            SkylineSpan floor = { 0, 0, mAtlasPageSize };
+            page->skyline.push_back(floor);
+            mAtlasPages.push_back(page);
+
+            page->pack(paddedWidth, paddedHeight, mAtlasPageSize, &dest.x, &dest.y);
+        }
+
+        uploaded = SDL_UpdateTexture(page->texture, &dest, &padded[0],
+                paddedWidth * sizeof(Uint32)) == 0;
+    });
+
+    if (!uploaded)
     {
-        Log::Error("Failed to create texture " + path);
+        // The space stays used, but the image can still have a texture of
+        // its own
+        if (page && page->images.empty())
+        {
+            destroyPage(page);
+        }
+
+        Log::Warning("Failed to add image to texture atlas, giving it its own texture");
         Log::SDLError();
+        return false;
     }
 
-	mTextures[key] = imageTexture;
+    if (created)
+    {
+        mBudget.add(kAtlasPageAsset, page->budgetKey, (size_t) mAtlasPageSize * mAtlasPageSize * SDL_BYTESPERPIXEL(mTextureFormat));
+    }
 
-	SDL_FreeSurface(imageSurface);
+    page->images.insert(key);
+
+    outEntry->page = page;
+    outEntry->region.texture = page->texture;
+    outEntry->region.source.x = dest.x + kAtlasPadding;
+    outEntry->region.source.y = dest.y + kAtlasPadding;
+    outEntry->region.source.w = image->width;
+    outEntry->region.source.h = image->height;
+    return true;
+}
+
+void ascii::ImageCache::destroyEntry(const string& key, const Entry& entry)
+{
+    AtlasPage* page = entry.page;
+    SDL_Texture* texture = entry.region.texture;
+
+    if (page)
+    {
+        // Space in a page isn't reused until every image in it is freed,
+        // which is usually when the content group they came with is
+        page->images.erase(key);
+        if (page->images.empty())
+        {
+            destroyPage(page);
+        }
+    }
+    // Evicted images have nothing left to free
+    else if (texture)
+    {
+        RenderThread::Run(mpRenderThread, [texture]() { SDL_DestroyTexture(texture); });
+    }
+}
+
+void ascii::ImageCache::destroyPage(AtlasPage* page)
+{
+    mAtlasPages.erase(find(mAtlasPages.begin(), mAtlasPages.end(), page));
+    mBudget.remove(kAtlasPageAsset, page->budgetKey);
+
+    SDL_Texture* texture = page->texture;
+    RenderThread::Run(mpRenderThread, [texture]() { SDL_DestroyTexture(texture); });
+
+    delete page;
 }
 
 void ascii::ImageCache::loadTexture(std::string key, string path)
@@ -62,32 +310,264 @@ void ascii::ImageCache::loadTexture(std::string key, string path)
 void ascii::ImageCache::freeTexture(std::string key)
 {
     //cout << "Freeing texture " << key << endl;
-	SDL_Texture* imageTexture = mTextures[key];
+    auto it = mTextures.find(key);
+    if (it == mTextures.end())
+    {
+        return;
+    }
 
-	SDL_DestroyTexture(imageTexture);
+    destroyEntry(key, it->second);
+    mBudget.remove(kTextureAsset, key);
 
-	mTextures.erase(key);
+	mTextures.erase(it);
 }
 
-SDL_Texture* ascii::ImageCache::getTexture(std::string key)
+ascii::ImageCache::TextureRegion ascii::ImageCache::getTexture(std::string key)
 {
-    if (mTextures.find(key) == mTextures.end())
+    auto it = mTextures.find(key);
+    if (it == mTextures.end())
     {
         Log::Error("Tried to retrieve nonexistent texture: " + key);
-        return NULL;
+        return TextureRegion();
+    }
+
+    if (it->second.evicted)
+    {
+        mBudget.miss(it->second.packed ? kAtlasPageAsset : kTextureAsset);
+
+        Entry evicted = it->second;
+        loadTexture(key, evicted.path, evicted.colorKey);
+
+        it = mTextures.find(key);
+    }
+    else if (it->second.page)
+    {
+        mBudget.hit(kAtlasPageAsset, it->second.page->budgetKey);
     }
     else
     {
-        return mTextures[key];
+        mBudget.hit(kTextureAsset, key);
     }
+
+    return it->second.region;
 }
 
 void ascii::ImageCache::clearTextures()
 {
-	for (auto it = mTextures.begin(); it != mTextures.end(); ++it)
-	{
-		SDL_DestroyTexture(it->second);
-	}
+    RenderThread::Run(mpRenderThread, [this]() {
+        for (auto it = mTextures.begin(); it != mTextures.end(); ++it)
+        {
+            if (!it->second.page && it->second.region.texture)
+            {
+                SDL_DestroyTexture(it->second.region.texture);
+            }
+        }
+
+        for (auto it = mAtlasPages.begin(); it != mAtlasPages.end(); ++it)
+        {
+            SDL_DestroyTexture((*it)->texture);
+            delete *it;
+        }
+    });
+
+    for (auto it = mTextures.begin(); it != mTextures.end(); ++it)
+    {
+        mBudget.remove(kTextureAsset, it->first);
+    }
+    for (auto it = mAtlasPages.begin(); it != mAtlasPages.end(); ++it)
+    {
+        mBudget.remove(kAtlasPageAsset, (*it)->budgetKey);
+    }
 
 	mTextures.clear();
+    mAtlasPages.clear();
+}
+
+void ascii::ImageCache::setMemoryBudget(size_t bytes)
+{
+    mBudget.setBudget(bytes);
+    evictTextures("");
+}
+
+void ascii::ImageCache::pinTexture(std::string key)
+{
+    mBudget.pin(kTextureAsset, key);
+}
+
+void ascii::ImageCache::unpinTexture(std::string key)
+{
+    mBudget.unpin(kTextureAsset, key);
+}
+
+ascii::CacheStats ascii::ImageCache::textureStats()
+{
+    return mBudget.stats(kTextureAsset);
+}
+
+ascii::CacheStats ascii::ImageCache::atlasStats()
+{
+    return mBudget.stats(kAtlasPageAsset);
+}
+
+void ascii::ImageCache::evictTextures(const string& keep)
+{
+    auto kept = mTextures.find(keep);
+    AtlasPage* keepPage = kept != mTextures.end() ? kept->second.page : NULL;
+
+    auto findPage = [this](const string& budgetKey) -> AtlasPage* {
+        for (auto it = mAtlasPages.begin(); it != mAtlasPages.end(); ++it)
+        {
+            if ((*it)->budgetKey == budgetKey) return *it;
+        }
+        return NULL;
+    };
+
+    // A page can only go if every image on it can be loaded again and none
+    // of them are pinned
+    auto canEvict = [&](int type, const string& key) {
+        if (type == kTextureAsset)
+        {
+            return key != keep;
+        }
+
+        AtlasPage* page = findPage(key);
+        if (!page || page == keepPage)
+        {
+            return false;
+        }
+
+        for (auto it = page->images.begin(); it != page->images.end(); ++it)
+        {
+            if (mBudget.pinned(kTextureAsset, *it) || mTextures[*it].path.empty())
+            {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    int type;
+    string key;
+
+    while (mBudget.nextEviction(&type, &key, canEvict))
+    {
+        // The paths and color keys stay, to load the images again from
+        if (type == kTextureAsset)
+        {
+            Entry& entry = mTextures[key];
+            destroyEntry(key, entry);
+
+            entry.region = TextureRegion();
+            entry.evicted = true;
+            continue;
+        }
+
+        AtlasPage* page = findPage(key);
+        for (auto it = page->images.begin(); it != page->images.end(); ++it)
+        {
+            Entry& entry = mTextures[*it];
+            entry.region = TextureRegion();
+            entry.page = NULL;
+            entry.evicted = true;
+        }
+
+        destroyPage(page);
+    }
+}
+
+bool ascii::ImageCache::AtlasPage::pack(int width, int height, int pageSize, int* outX, int* outY)
+{
+    // Bottom-left rule: rest the rectangle as low as it can go, and where
+    // that ties, on the narrowest span, to waste the least room under it
+    int bestSpan = -1;
+    int bestBottom = 0;
+    int bestWidth = 0;
+
+    for (size_t i = 0; i < skyline.size(); ++i)
+    {
+        int y = fit(i, width, height, pageSize);
+        if (y < 0)
+        {
+            continue;
+        }
+
+        if (bestSpan < 0 || y + height < bestBottom
+                || (y + height == bestBottom && skyline[i].width < bestWidth))
+        {
+            bestSpan = (int) i;
+            bestBottom = y + height;
+            bestWidth = skyline[i].width;
+        }
+    }
+
+    if (bestSpan < 0)
+    {
+        return false;
+    }
+
+    *outX = skyline[bestSpan].x;
+    *outY = bestBottom - height;
+
+    // Raise the skyline over the rectangle, cutting back the spans it covers
+    SkylineSpan raised = { *outX, bestBottom, width };
+    skyline.insert(skyline.begin() + bestSpan, raised);
+
+    for (size_t i = bestSpan + 1; i < skyline.size(); )
+    {
+        int coveredTo = skyline[i - 1].x + skyline[i - 1].width;
+        if (skyline[i].x >= coveredTo)
+        {
+            break;
+        }
+
+        int overlap = coveredTo - skyline[i].x;
+        skyline[i].x += overlap;
+        skyline[i].width -= overlap;
+
+        if (skyline[i].width > 0)
+        {
+            break;
+        }
+        skyline.erase(skyline.begin() + i);
+    }
+
+    // Join neighboring spans of the same height
+    for (size_t i = 0; i + 1 < skyline.size(); )
+    {
+        if (skyline[i].y == skyline[i + 1].y)
+        {
+            skyline[i].width += skyline[i + 1].width;
+            skyline.erase(skyline.begin() + i + 1);
+        }
+        else
+        {
+            ++i;
+        }
+    }
+
+    return true;
+}
+
+int ascii::ImageCache::AtlasPage::fit(size_t span, int width, int height, int pageSize)
+{
+    if (skyline[span].x + width > pageSize)
+    {
+        return -1;
+    }
+
+    // Sit on top of the highest span the rectangle reaches across
+    int y = 0;
+    int widthLeft = width;
+
+    for (size_t i = span; widthLeft > 0; ++i)
+    {
+        y = max(y, skyline[i].y);
+        if (y + height > pageSize)
+        {
+            return -1;
+        }
+        widthLeft -= skyline[i].width;
+    }
+
+    return y;
 }
@@ -2,12 +2,17 @@
 #define IMAGE_CACHE_H
 
 #include <map>
+#include <set>
 #include <string>
+#include <vector>
 using namespace std;
 
 #include <SDL.h>
 
 #include "Color.h"
+#include "DecodedImage.h"
+#include "MemoryBudget.h"
+#include "RenderThread.h"
 
 namespace ascii
 {
@@ -18,10 +23,23 @@ namespace ascii
 	class ImageCache
 	{
 		public:
+            // Where an image is found: either a texture of its own, or a
+            // rectangle of an atlas page shared with other small images
+            struct TextureRegion
+            {
+                TextureRegion() : texture(NULL) { source.x = source.y = source.w = source.h = 0; }
+
+                SDL_Texture* texture;
+                SDL_Rect source;
+            };
+
 			/// <summary>
 			/// Creates an ImageCache and prepares it for loading textures.
 			/// </summary>
-			ImageCache(SDL_Renderer* renderer, int charWidth, int charHeight);
+			/// <param name="renderThread">The thread which owns the renderer,
+			/// if it isn't this one. Textures are created and destroyed there.</param>
+			ImageCache(SDL_Renderer* renderer, int charWidth, int charHeight,
+                    RenderThread* renderThread=NULL);
 			~ImageCache();
 
 			/// <summary>
@@ -40,27 +58,135 @@ namespace ascii
 			/// <param name="path">The filepath of the texture to load (must be a bitmap).</param>
 			void loadTexture(std::string key, string path);
 
+			/// <summary>
+			/// Creates a texture from an image which was already decoded, such as by a loading thread, and stores it in the cache.
+			/// </summary>
+			/// <param name="surface">The decoded image, which the cache frees.</param>
+			/// <param name="path">The filepath the image came from, for error messages.</param>
+			void addTexture(std::string key, SDL_Surface* surface, string path, Color colorKey=Color::None);
+
+			/// <summary>
+			/// Uploads an image which was already decoded into the texture format, such as by a loading thread, and stores it in the cache.
+			/// </summary>
+			/// <param name="image">The decoded image, which the cache deletes.</param>
+			/// <param name="path">The filepath the image came from, which it is loaded from again if evicted.</param>
+			/// <param name="colorKey">The transparent color the image was decoded with.</param>
+			void addTexture(std::string key, DecodedImage* image, string path, Color colorKey=Color::None);
+
+			/// <summary>
+			/// The pixel format textures are created in, which images must be decoded into.
+			/// </summary>
+			Uint32 textureFormat() { return mTextureFormat; }
+
 			/// <summary>
 			/// Frees the texture in the cache associated with the given key string.
 			/// </summary>
 			void freeTexture(std::string key);
 
 			/// <summary>
-			/// Gets a texture from the cache.
+			/// Gets a texture from the cache. Small images share atlas textures, so only the returned source rectangle of the texture belongs to the image.
 			/// </summary>
 			/// <param name="key">The unique key with which this texture was loaded.</param>
-			/// <returns>The texture associated with the given key.</returns>
-			SDL_Texture* getTexture(std::string key);
+			/// <returns>The texture and source rectangle associated with the given key. The texture is NULL if there is no such key.</returns>
+			TextureRegion getTexture(std::string key);
 
 			/// <summary>
 			/// Frees all textures currently held in the cache.
 			/// </summary>
 			void clearTextures();
+
+			/// <summary>
+			/// Limits the bytes of texture memory the cache keeps. Past the budget, the least recently used textures which aren't pinned are evicted, and loaded again the next time they are retrieved. Small images are evicted along with the whole atlas page they share. 0, the default, means no limit.
+			/// </summary>
+			void setMemoryBudget(size_t bytes);
+			size_t memoryBudget() { return mBudget.budget(); }
+
+			/// <summary>
+			/// Keeps a texture from being evicted until it is unpinned as many times. A pinned image keeps its whole atlas page. Textures can be pinned before they are loaded.
+			/// </summary>
+			void pinTexture(std::string key);
+			void unpinTexture(std::string key);
+
+			/// <summary>
+			/// Memory in use by images with textures of their own, and how often they were resident or had to be loaded again when retrieved.
+			/// </summary>
+			CacheStats textureStats();
+			/// <summary>
+			/// The same for atlas pages. Hits and misses count retrievals of the images packed into them.
+			/// </summary>
+			CacheStats atlasStats();
 		private:
+            // One span of the skyline, the top edge of everything packed
+            // into an atlas page so far
+            struct SkylineSpan
+            {
+                int x, y, width;
+            };
+
+            // A texture shared by many small images
+            struct AtlasPage
+            {
+                SDL_Texture* texture;
+                vector<SkylineSpan> skyline;
+                // Keys of the images packed which haven't been freed yet
+                set<string> images;
+                // The page's key in the memory budget, which evicts it as a
+                // whole because its space isn't reused
+                string budgetKey;
+
+                // Find room for a rectangle, lowest first, and mark it used.
+                // Returns false if the page is too full
+                bool pack(int width, int height, int pageSize, int* outX, int* outY);
+
+                private:
+                    // The y the rectangle would sit at if placed on the
+                    // given span, or -1 if it doesn't fit there
+                    int fit(size_t span, int width, int height, int pageSize);
+            };
+
+            struct Entry
+            {
+                Entry() : page(NULL), packed(false), evicted(false) { }
+
+                TextureRegion region;
+                // NULL if the image has its own texture
+                AtlasPage* page;
+
+                // Where to load the image from again after evicting it
+                string path;
+                Color colorKey;
+
+                // Whether the image went in an atlas page, which stays known
+                // after the page is evicted
+                bool packed;
+                bool evicted;
+            };
+
+            // Copy an image into an atlas page, with a border of its own edge
+            // pixels so that linear scaling doesn't blend in its neighbors.
+            // Returns false if it should get its own texture instead
+            bool addToAtlas(const string& key, DecodedImage* image, Entry* outEntry);
+
+            // Free a texture, or the image's share of its atlas page
+            void destroyEntry(const string& key, const Entry& entry);
+            void destroyPage(AtlasPage* page);
+
+            // Evict textures and atlas pages until the cache is within its
+            // budget, keeping the image with the given key
+            void evictTextures(const string& keep);
+
 			SDL_Renderer* mRenderer;
+            RenderThread* mpRenderThread;
 			int mCharWidth, mCharHeight;
+            Uint32 mTextureFormat;
+            // Width and height of atlas pages, limited by the renderer
+            int mAtlasPageSize;
+            // Counts pages for their budget keys
+            int mAtlasPagesCreated;
 
-			std::map<std::string, SDL_Texture*> mTextures;
+			std::map<std::string, Entry> mTextures;
+            vector<AtlasPage*> mAtlasPages;
+            MemoryBudget mBudget;
 	};
 
 };
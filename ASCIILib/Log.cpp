@@ -1,11 +1,177 @@
 #include "Log.h"
 
+#include <atomic>
+#include <stdio.h>
+#include <stdlib.h>
+
 #include "SDL.h"
 
 #include "GlobalArgs.h"
 
 
-string ascii::Log::sOutputFilename;
+namespace
+{
+    // Number of messages which can wait to be written at once. Must be a
+    // power of two
+    const size_t kQueueSize = 4096;
+
+    // How long the logging thread sleeps when there is nothing to write
+    const Uint32 kIdleTimeoutMS = 100;
+
+    // One message waiting in the queue. Its sequence number tells producers
+    // and the logging thread whose turn it is to use the slot
+    struct Slot
+    {
+        atomic<size_t> sequence;
+        string message;
+    };
+
+    // Bounded multi-producer queue of messages, drained by one thread
+    struct Queue
+    {
+        Queue()
+            : enqueuePos(0), dequeuePos(0), written(0),
+            running(false), stopped(false), pThread(NULL), startLock(0),
+            pFile(NULL)
+        {
+            for (size_t i = 0; i < kQueueSize; ++i)
+            {
+                slots[i].sequence.store(i, memory_order_relaxed);
+            }
+
+            pWakeUp = SDL_CreateSemaphore(0);
+            pFileLock = SDL_CreateMutex();
+        }
+
+        Slot slots[kQueueSize];
+        atomic<size_t> enqueuePos;
+        // Only touched while holding the file lock
+        size_t dequeuePos;
+        // Number of messages written out so far
+        atomic<size_t> written;
+
+        atomic<bool> running;
+        // Once shut down, messages are written out as they are logged
+        bool stopped;
+        SDL_Thread* pThread;
+        SDL_sem* pWakeUp;
+        SDL_SpinLock startLock;
+
+        // The output file stays open for as long as it is in use
+        SDL_mutex* pFileLock;
+        FILE* pFile;
+    };
+
+    Queue& GetQueue()
+    {
+        static Queue queue;
+        return queue;
+    }
+
+    // Cached result of checking for the "log" global arg
+    atomic<bool> sEnabled(false);
+    atomic<int> sEnabledGeneration(-1);
+
+    // Write every message which has been published, in order
+    void DrainQueue(Queue& queue)
+    {
+        SDL_LockMutex(queue.pFileLock);
+
+        bool wroteAny = false;
+
+        while (true)
+        {
+            Slot& slot = queue.slots[queue.dequeuePos & (kQueueSize - 1)];
+
+            if (slot.sequence.load(memory_order_acquire) != queue.dequeuePos + 1)
+            {
+                break;
+            }
+
+            fputs(slot.message.c_str(), stdout);
+            if (queue.pFile)
+            {
+                fputs(slot.message.c_str(), queue.pFile);
+            }
+
+            // Let go of long messages' memory, and hand the slot back to the
+            // producers for its next lap around the queue
+            string().swap(slot.message);
+            slot.sequence.store(queue.dequeuePos + kQueueSize, memory_order_release);
+
+            ++queue.dequeuePos;
+            queue.written.fetch_add(1, memory_order_release);
+            wroteAny = true;
+        }
+
+        // Flush once per batch instead of once per message
+        if (wroteAny)
+        {
+            fflush(stdout);
+            if (queue.pFile)
+            {
+                fflush(queue.pFile);
+            }
+        }
+
+        SDL_UnlockMutex(queue.pFileLock);
+    }
+
+    int LogThread(void* data)
+    {
+        Queue& queue = *(Queue*) data;
+
+        while (queue.running.load())
+        {
+            SDL_SemWaitTimeout(queue.pWakeUp, kIdleTimeoutMS);
+            DrainQueue(queue);
+        }
+
+        // Catch anything logged while stopping
+        DrainQueue(queue);
+        return 0;
+    }
+
+    void ShutdownAtExit()
+    {
+        ascii::Log::Shutdown();
+    }
+
+    // Start the logging thread if it isn't running yet
+    void StartThread(Queue& queue)
+    {
+        if (queue.running.load())
+        {
+            return;
+        }
+
+        SDL_AtomicLock(&queue.startLock);
+
+        if (!queue.running.load() && !queue.stopped)
+        {
+            static bool registeredAtExit = false;
+            if (!registeredAtExit)
+            {
+                atexit(ShutdownAtExit);
+                registeredAtExit = true;
+            }
+
+            queue.running.store(true);
+            queue.pThread = SDL_CreateThread(LogThread, "Log", &queue);
+
+            if (!queue.pThread)
+            {
+                fprintf(stderr, "Failed to start logging thread: %s\n", SDL_GetError());
+                queue.running.store(false);
+                queue.stopped = true;
+            }
+        }
+
+        SDL_AtomicUnlock(&queue.startLock);
+    }
+}
+
+ascii::LogLevel ascii::Log::sLevel = LOG_DEBUG;
 
 void ascii::Log::SDLError()
 {
@@ -14,22 +180,150 @@ void ascii::Log::SDLError()
 
 bool ascii::Log::Enabled()
 {
-    return ascii::GlobalArgs::Enabled("log");
+    // Only search the global args again when they have changed
+    int generation = GlobalArgs::Generation();
+
+    if (generation != sEnabledGeneration.load(memory_order_relaxed))
+    {
+        sEnabled.store(ascii::GlobalArgs::Enabled("log"), memory_order_relaxed);
+        sEnabledGeneration.store(generation, memory_order_relaxed);
+    }
+
+    return sEnabled.load(memory_order_relaxed);
+}
+
+void ascii::Log::SetLevel(LogLevel level)
+{
+    sLevel = level;
 }
 
 void ascii::Log::SetOutputFilename(string filename)
 {
-    sOutputFilename = filename;
+    Queue& queue = GetQueue();
+
+    // Make sure messages logged before now go to the old file
+    Flush();
 
     // If the file already exists, overwrite it
-	FILE* overwriteFile = fopen(filename.c_str(), "w");
+	FILE* file = fopen(filename.c_str(), "w");
 
-    if (overwriteFile == NULL)
+    SDL_LockMutex(queue.pFileLock);
+    if (queue.pFile)
+    {
+        fclose(queue.pFile);
+    }
+    queue.pFile = file;
+    SDL_UnlockMutex(queue.pFileLock);
+
+    if (file == NULL)
     {
-        string filename = sOutputFilename;
-        sOutputFilename = "";
         Error("Log file could not be opened for writing: " + filename);
     }
+}
+
+void ascii::Log::Enqueue(LogLevel level, string message)
+{
+    Queue& queue = GetQueue();
+
+    StartThread(queue);
+
+    // Claim the next free slot in the queue
+    Slot* slot;
+    size_t pos = queue.enqueuePos.load(memory_order_relaxed);
+
+    while (true)
+    {
+        slot = &queue.slots[pos & (kQueueSize - 1)];
+        size_t sequence = slot->sequence.load(memory_order_acquire);
+        ptrdiff_t difference = (ptrdiff_t) sequence - (ptrdiff_t) pos;
+
+        if (difference == 0)
+        {
+            if (queue.enqueuePos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (difference < 0)
+        {
+            // The queue is full. Wait for the logging thread to catch up
+            // rather than lose messages
+            if (queue.stopped)
+            {
+                DrainQueue(queue);
+            }
+            else
+            {
+                SDL_SemPost(queue.pWakeUp);
+                SDL_Delay(1);
+            }
+            pos = queue.enqueuePos.load(memory_order_relaxed);
+        }
+        else
+        {
+            // Another thread claimed this slot first
+            pos = queue.enqueuePos.load(memory_order_relaxed);
+        }
+    }
+
+    // Publish the message
+    slot->message.swap(message);
+    slot->sequence.store(pos + 1, memory_order_release);
+
+    // Without the logging thread, write the message right away
+    if (queue.stopped)
+    {
+        DrainQueue(queue);
+        return;
+    }
+
+    SDL_SemPost(queue.pWakeUp);
+
+    // Errors often come right before a crash, so don't let them sit in the
+    // queue
+    if (level >= LOG_ERROR)
+    {
+        Flush();
+    }
+}
+
+void ascii::Log::Flush()
+{
+    Queue& queue = GetQueue();
+
+    if (!queue.running.load())
+    {
+        return;
+    }
+
+    size_t target = queue.enqueuePos.load();
+
+    while (queue.written.load(memory_order_acquire) < target)
+    {
+        SDL_SemPost(queue.pWakeUp);
+        SDL_Delay(1);
+    }
+}
+
+void ascii::Log::Shutdown()
+{
+    Queue& queue = GetQueue();
+
+    SDL_AtomicLock(&queue.startLock);
+
+    queue.stopped = true;
+
+    if (queue.running.load())
+    {
+        queue.running.store(false);
+        SDL_SemPost(queue.pWakeUp);
+
+        if (queue.pThread)
+        {
+            SDL_WaitThread(queue.pThread, NULL);
+            queue.pThread = NULL;
+        }
+    }
 
-	fclose(overwriteFile);
+    SDL_AtomicUnlock(&queue.startLock);
 }
@@ -10,22 +10,61 @@ using namespace std;
 using namespace icu;
 
 
+// Log levels, from most to least verbose
+#define ASCIILIB_LOG_DEBUG 0
+#define ASCIILIB_LOG_INFO 1
+#define ASCIILIB_LOG_WARNING 2
+#define ASCIILIB_LOG_ERROR 3
+
+// Messages below this level are compiled out entirely. Define it as one of the
+// levels above to strip chattier logging from a build
+#ifndef ASCIILIB_LOG_LEVEL
+#define ASCIILIB_LOG_LEVEL ASCIILIB_LOG_DEBUG
+#endif
+
 namespace ascii
 {
-    // Handles log output, respecting the runtime log argument
+    enum LogLevel
+    {
+        LOG_DEBUG = ASCIILIB_LOG_DEBUG,
+        LOG_INFO = ASCIILIB_LOG_INFO,
+        LOG_WARNING = ASCIILIB_LOG_WARNING,
+        LOG_ERROR = ASCIILIB_LOG_ERROR
+    };
+
+    // Handles log output, respecting the runtime log argument. Messages are
+    // queued without locking and written to the console (and the output file,
+    // if one is set) by a background thread
     class Log
     {
         public:
+            template<typename T> static void Debug(T message, bool newLine=true);
             template<typename T> static void Print(T message, bool newLine=true);
+            template<typename T> static void Warning(T warningMessage);
             template<typename T> static void Error(T errorMessage);
 
             static void SDLError();
 
             static void SetOutputFilename(string filename);
 
+            // Ignore messages below the given level at runtime, on top of the
+            // levels compiled out by ASCIILIB_LOG_LEVEL
+            static void SetLevel(LogLevel level);
+
+            // Wait until every message logged so far has been written out.
+            // Errors are always flushed before Error() returns
+            static void Flush();
+
+            // Write every remaining message and stop the logging thread.
+            // Called automatically at exit
+            static void Shutdown();
+
         private:
+            template<typename T> static void Write(LogLevel level, T message, bool newLine);
+            static void Enqueue(LogLevel level, string message);
+
             static bool Enabled();
-            static string sOutputFilename;
+            static LogLevel sLevel;
     };
 }
 
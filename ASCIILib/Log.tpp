@@ -1,43 +1,47 @@
-template<typename T> void ascii::Log::Print(T message, bool newLine)
+template<typename T> void ascii::Log::Write(LogLevel level, T message, bool newLine)
 {
-    if (Enabled())
+    if (level >= sLevel && Enabled())
     {
         // Put the message together in a stream
         stringstream messageStream;
         messageStream << message;
         if (newLine)
         {
-            messageStream << endl;
+            messageStream << '\n';
         }
 
-        // Output the message to the console
-        cout << messageStream.str();
-        cout.flush();
+        Enqueue(level, messageStream.str());
+    }
+}
 
-        // If an output filename is set, output to a file also
-        if (!sOutputFilename.empty())
-        {
-            FILE* file = fopen(sOutputFilename.c_str(), "a");
+template<typename T> void ascii::Log::Debug(T message, bool newLine)
+{
+#if ASCIILIB_LOG_LEVEL <= ASCIILIB_LOG_DEBUG
+    Write(LOG_DEBUG, message, newLine);
+#endif
+}
 
-			if (file == NULL)
-			{
-                cout << "Error! Could not write log output to file." << endl;
-                cout.flush();
-			}
-			else
-			{
-                fprintf(file, messageStream.str().c_str());
-                fflush(file);
-                fclose(file);
-			}
-        }
-    }
+template<typename T> void ascii::Log::Print(T message, bool newLine)
+{
+#if ASCIILIB_LOG_LEVEL <= ASCIILIB_LOG_INFO
+    Write(LOG_INFO, message, newLine);
+#endif
+}
+
+template<typename T> void ascii::Log::Warning(T warningMessage)
+{
+#if ASCIILIB_LOG_LEVEL <= ASCIILIB_LOG_WARNING
+    stringstream messageStream;
+    messageStream << "Warning: " << warningMessage;
+
+    Write(LOG_WARNING, messageStream.str(), true);
+#endif
 }
 
 template<typename T> void ascii::Log::Error(T errorMessage)
 {
     // Construct the message in one stream instead of calling Print() 5 times,
-    // to save file open operations
+    // so it reaches the log in one piece
     stringstream messageStream;
     messageStream << endl;
     messageStream << "*========================ERROR========================*" << endl;
@@ -45,5 +49,5 @@ template<typename T> void ascii::Log::Error(T errorMessage)
     messageStream << "*========================ERROR========================*" << endl;
     messageStream << endl;
 
-    Print(messageStream.str());
+    Write(LOG_ERROR, messageStream.str(), true);
 }
@@ -0,0 +1,120 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+#ifdef _WIN32
+
+ascii::MappedFile::MappedFile(string path)
+    : mOpen(false), mpData(NULL), mSize(0),
+    mFileHandle(INVALID_HANDLE_VALUE), mMappingHandle(NULL)
+{
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+            NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return;
+    }
+
+    mFileHandle = file;
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize))
+    {
+        return;
+    }
+
+    mSize = (size_t) fileSize.QuadPart;
+    mOpen = true;
+
+    // Empty files can't be mapped, but there's nothing to read anyway
+    if (mSize == 0)
+    {
+        return;
+    }
+
+    mMappingHandle = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mMappingHandle)
+    {
+        mpData = (const Uint8*) MapViewOfFile(mMappingHandle, FILE_MAP_READ, 0, 0, 0);
+    }
+
+    if (!mpData)
+    {
+        mOpen = false;
+        mSize = 0;
+    }
+}
+
+ascii::MappedFile::~MappedFile()
+{
+    if (mpData)
+    {
+        UnmapViewOfFile(mpData);
+    }
+    if (mMappingHandle)
+    {
+        CloseHandle(mMappingHandle);
+    }
+    if (mFileHandle != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(mFileHandle);
+    }
+}
+
+#else
+
+ascii::MappedFile::MappedFile(string path)
+    : mOpen(false), mpData(NULL), mSize(0)
+{
+    int file = open(path.c_str(), O_RDONLY);
+
+    if (file == -1)
+    {
+        return;
+    }
+
+    struct stat info;
+    if (fstat(file, &info) == 0)
+    {
+        mSize = (size_t) info.st_size;
+        mOpen = true;
+
+        // Empty files can't be mapped, but there's nothing to read anyway
+        if (mSize > 0)
+        {
+            void* data = mmap(NULL, mSize, PROT_READ, MAP_PRIVATE, file, 0);
+
+            if (data == MAP_FAILED)
+            {
+                mOpen = false;
+                mSize = 0;
+            }
+            else
+            {
+                mpData = (const Uint8*) data;
+            }
+        }
+    }
+
+    // The mapping stays valid after the file is closed
+    close(file);
+}
+
+ascii::MappedFile::~MappedFile()
+{
+    if (mpData)
+    {
+        munmap((void*) mpData, mSize);
+    }
+}
+
+#endif
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <string>
+using namespace std;
+
+#include <SDL.h>
+
+namespace ascii
+{
+
+    // Maps a whole file into memory read-only, so that binary content can be
+    // used straight from the page cache instead of being read and parsed.
+    // The mapping lasts as long as the MappedFile does
+    class MappedFile
+    {
+        public:
+            MappedFile(string path);
+            ~MappedFile();
+
+            // Check if the file was successfully opened and mapped
+            bool isOpen() { return mOpen; }
+
+            // The file's contents. NULL if the file is empty or couldn't be
+            // opened
+            const Uint8* data() { return mpData; }
+            size_t size() { return mSize; }
+
+        private:
+            // Mappings can't be shared between copies
+            MappedFile(const MappedFile&);
+            MappedFile& operator=(const MappedFile&);
+
+            bool mOpen;
+            const Uint8* mpData;
+            size_t mSize;
+
+#ifdef _WIN32
+            void* mFileHandle;
+            void* mMappingHandle;
+#endif
+    };
+
+}
@@ -0,0 +1,126 @@
+#include "MemoryBudget.h"
+
+
+ascii::MemoryBudget::MemoryBudget(int types)
+    : mBudget(0), mResidentBytes(0), mStats(types)
+{
+}
+
+void ascii::MemoryBudget::add(int type, const string& key, size_t bytes, bool reloadable)
+{
+    AssetKey assetKey(type, key);
+
+    // Loading an asset again replaces its old accounting
+    auto existing = mAssets.find(assetKey);
+    if (existing != mAssets.end())
+    {
+        remove(type, key);
+    }
+
+    Asset& asset = mAssets[assetKey];
+    asset.bytes = bytes;
+    asset.reloadable = reloadable;
+    asset.resident = true;
+    asset.use = mUses.insert(mUses.end(), assetKey);
+
+    mResidentBytes += bytes;
+    mStats[type].residentBytes += bytes;
+    ++mStats[type].residentAssets;
+}
+
+void ascii::MemoryBudget::remove(int type, const string& key)
+{
+    auto it = mAssets.find(AssetKey(type, key));
+    if (it == mAssets.end())
+    {
+        return;
+    }
+
+    if (it->second.resident)
+    {
+        mUses.erase(it->second.use);
+        mResidentBytes -= it->second.bytes;
+        mStats[type].residentBytes -= it->second.bytes;
+        --mStats[type].residentAssets;
+    }
+
+    mAssets.erase(it);
+}
+
+bool ascii::MemoryBudget::evicted(int type, const string& key)
+{
+    auto it = mAssets.find(AssetKey(type, key));
+    return it != mAssets.end() && !it->second.resident;
+}
+
+void ascii::MemoryBudget::hit(int type, const string& key)
+{
+    auto it = mAssets.find(AssetKey(type, key));
+    if (it == mAssets.end() || !it->second.resident)
+    {
+        return;
+    }
+
+    mUses.splice(mUses.end(), mUses, it->second.use);
+    ++mStats[type].hits;
+}
+
+void ascii::MemoryBudget::miss(int type)
+{
+    ++mStats[type].misses;
+}
+
+void ascii::MemoryBudget::pin(int type, const string& key)
+{
+    ++mPins[AssetKey(type, key)];
+}
+
+void ascii::MemoryBudget::unpin(int type, const string& key)
+{
+    auto it = mPins.find(AssetKey(type, key));
+    if (it != mPins.end() && --it->second <= 0)
+    {
+        mPins.erase(it);
+    }
+}
+
+bool ascii::MemoryBudget::nextEviction(int* outType, string* outKey,
+        function<bool (int, const string&)> canEvict)
+{
+    if (mBudget == 0 || mResidentBytes <= mBudget)
+    {
+        return false;
+    }
+
+    for (auto use = mUses.begin(); use != mUses.end(); ++use)
+    {
+        auto asset = mAssets.find(*use);
+
+        if (!asset->second.reloadable || mPins.count(*use)
+                || (canEvict && !canEvict(use->first, use->second)))
+        {
+            continue;
+        }
+
+        *outType = use->first;
+        *outKey = use->second;
+        evict(asset);
+        return true;
+    }
+
+    // Everything left is pinned or in use
+    return false;
+}
+
+void ascii::MemoryBudget::evict(map<AssetKey, Asset>::iterator asset)
+{
+    int type = asset->first.first;
+
+    mUses.erase(asset->second.use);
+    asset->second.resident = false;
+
+    mResidentBytes -= asset->second.bytes;
+    mStats[type].residentBytes -= asset->second.bytes;
+    --mStats[type].residentAssets;
+    ++mStats[type].evictions;
+}
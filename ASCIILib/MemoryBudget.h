@@ -0,0 +1,100 @@
+#pragma once
+
+#include <functional>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include <SDL.h>
+
+namespace ascii
+{
+
+    // Memory used by one type of asset in a cache, and how well the cache
+    // has kept the assets needed resident
+    struct CacheStats
+    {
+        CacheStats()
+            : residentBytes(0), residentAssets(0), hits(0), misses(0), evictions(0) { }
+
+        size_t residentBytes;
+        int residentAssets;
+        // Uses of assets which were resident, and of ones which had been
+        // evicted and had to be loaded again
+        Uint64 hits;
+        Uint64 misses;
+        Uint64 evictions;
+    };
+
+    // Accounts for the memory a cache's assets use, and picks the least
+    // recently used ones to evict when the total goes over budget. Assets
+    // are told apart by a type, which stats are kept for, and a key.
+    //
+    // Pinned assets are never evicted. Pins are counted, and can be placed
+    // on assets which aren't loaded yet
+    class MemoryBudget
+    {
+        public:
+            MemoryBudget(int types);
+
+            // Most bytes assets may use before some are evicted. 0 means no
+            // limit, which is the default
+            void setBudget(size_t bytes) { mBudget = bytes; }
+            size_t budget() { return mBudget; }
+
+            size_t residentBytes() { return mResidentBytes; }
+
+            // Account for an asset which was loaded, or loaded again after
+            // being evicted. Only reloadable assets are ever evicted
+            void add(int type, const string& key, size_t bytes, bool reloadable=true);
+            // Forget an asset which was freed
+            void remove(int type, const string& key);
+
+            // Whether an asset was evicted and hasn't been loaded again
+            bool evicted(int type, const string& key);
+
+            // Count a use of a resident asset, making it the most recently
+            // used
+            void hit(int type, const string& key);
+            // Count a use of an evicted asset, which is being loaded again
+            void miss(int type);
+
+            void pin(int type, const string& key);
+            void unpin(int type, const string& key);
+            bool pinned(int type, const string& key) { return mPins.count(AssetKey(type, key)) != 0; }
+
+            // While over budget, find the least recently used asset which
+            // can be evicted, and count it as evicted. The cache must then
+            // free it. canEvict can keep other assets, such as those in use
+            bool nextEviction(int* outType, string* outKey,
+                    function<bool (int, const string&)> canEvict=nullptr);
+
+            CacheStats stats(int type) { return mStats[type]; }
+
+        private:
+            typedef pair<int, string> AssetKey;
+
+            struct Asset
+            {
+                size_t bytes;
+                bool reloadable;
+                bool resident;
+                // Place in mUses while resident
+                list<AssetKey>::iterator use;
+            };
+
+            void evict(map<AssetKey, Asset>::iterator asset);
+
+            size_t mBudget;
+            size_t mResidentBytes;
+
+            map<AssetKey, Asset> mAssets;
+            // Resident assets, least recently used first
+            list<AssetKey> mUses;
+            map<AssetKey, int> mPins;
+            vector<CacheStats> mStats;
+    };
+
+}
@@ -0,0 +1,99 @@
+#include "Palette.h"
+
+#include <algorithm>
+using namespace std;
+
+#include "Log.h"
+
+
+namespace
+{
+    int DistanceSquared(ascii::Color a, ascii::Color b)
+    {
+        int r = a.r - b.r;
+        int g = a.g - b.g;
+        int bl = a.b - b.b;
+        return r * r + g * g + bl * bl;
+    }
+
+    Uint8 Lerp(Uint8 from, Uint8 to, float amount)
+    {
+        return from + (to - from) * amount;
+    }
+}
+
+ascii::Palette::Palette()
+    : mSize(0), mVersion(0)
+{
+}
+
+Uint8 ascii::Palette::add(Color color)
+{
+    int closest = 0;
+
+    for (int i = 0; i < mSize; ++i)
+    {
+        if (mBase[i] == color && mBase[i].isNone == color.isNone)
+        {
+            return i;
+        }
+
+        if (DistanceSquared(mBase[i], color) < DistanceSquared(mBase[closest], color))
+        {
+            closest = i;
+        }
+    }
+
+    if (mSize == kMaxColors)
+    {
+        Log::Warning("Palette is full. Using the closest color instead.");
+        return closest;
+    }
+
+    set(mSize, color);
+    return mSize++;
+}
+
+void ascii::Palette::set(Uint8 index, Color color)
+{
+    mBase[index] = color;
+    mShown[index] = color;
+    ++mVersion;
+}
+
+void ascii::Palette::fade(Color color, float amount)
+{
+    amount = max(0.0f, min(amount, 1.0f));
+
+    for (int i = 0; i < mSize; ++i)
+    {
+        mShown[i].r = Lerp(mBase[i].r, color.r, amount);
+        mShown[i].g = Lerp(mBase[i].g, color.g, amount);
+        mShown[i].b = Lerp(mBase[i].b, color.b, amount);
+    }
+
+    ++mVersion;
+}
+
+void ascii::Palette::cycle(Uint8 first, int count, int steps)
+{
+    count = min(count, kMaxColors - first);
+
+    if (count <= 1)
+    {
+        return;
+    }
+
+    // Rotate right, so that each color moves up by the given steps
+    int shift = ((steps % count) + count) % count;
+    rotate(mBase + first, mBase + first + count - shift, mBase + first + count);
+    rotate(mShown + first, mShown + first + count - shift, mShown + first + count);
+
+    ++mVersion;
+}
+
+void ascii::Palette::reset()
+{
+    copy(mBase, mBase + mSize, mShown);
+    ++mVersion;
+}
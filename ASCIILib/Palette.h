@@ -0,0 +1,62 @@
+#pragma once
+
+#include <SDL.h>
+
+#include "Color.h"
+
+namespace ascii
+{
+    // A table of up to 256 colors which indexed colors (see Color::Indexed)
+    // are looked up in when drawn. Each entry has a base color, set when the
+    // palette is built, and a shown color, which effects like fades derive
+    // from the base. An effect on the whole screen only has to touch the
+    // palette, instead of every cell using its colors
+    class Palette
+    {
+        public:
+            static const int kMaxColors = 256;
+
+            Palette();
+
+            // Number of entries in use
+            int size() { return mSize; }
+
+            // Find the entry holding the given base color, adding one if
+            // there is none. When the palette is full, the closest entry is
+            // used instead
+            Uint8 add(Color color);
+
+            // Change the base color of an entry. The shown color is reset to
+            // match it
+            void set(Uint8 index, Color color);
+            Color base(Uint8 index) { return mBase[index]; }
+
+            // The color an entry is drawn in right now
+            Color get(Uint8 index) { return mShown[index]; }
+
+            // Look up a color in the palette if it is indexed
+            Color resolve(Color color) { return color.isIndexed ? mShown[color.r] : color; }
+
+            // Blend every shown color from its base toward the given color.
+            // 0 shows the base colors and 1 shows only the given color, so
+            // this covers fades to black and flashes alike
+            void fade(Color color, float amount);
+
+            // Rotate the entries [first, first + count) by the given number
+            // of steps, for color cycling
+            void cycle(Uint8 first, int count, int steps=1);
+
+            // Show the base colors again
+            void reset();
+
+            // Changes every time a shown color may have changed, so that
+            // whatever was drawn with the palette knows to redraw
+            Uint32 version() { return mVersion; }
+
+        private:
+            Color mBase[kMaxColors];
+            Color mShown[kMaxColors];
+            int mSize;
+            Uint32 mVersion;
+    };
+}
@@ -8,11 +8,31 @@
 #include "Log.h"
 #include "Rectangle.h"
 #include "FilePaths.h"
+#include "Profiler.h"
+#include "VirtualFS.h"
 
 
+namespace
+{
+    // Most colors kept sorting glyphs into between flushes
+    const size_t kMaxGlyphBuckets = 32;
+
+    // How long a color has to keep being drawn before it gets a tinted sheet.
+    // Going by time rather than by flushes, as one frame can flush a font
+    // once for every region redrawn
+    const Uint32 kTintAfterMS = 250;
+}
+
+list<ascii::PixelFont::TintedSheet> ascii::PixelFont::sTintedSheets;
+size_t ascii::PixelFont::sTintCacheBudget = 8 * 1024 * 1024;
+size_t ascii::PixelFont::sTintCacheBytes = 0;
+
 ascii::PixelFont::PixelFont(int charWidth, int charHeight,
         string fontLayoutFile, string textureSheet)
-    : mCharWidth(charWidth), mCharHeight(charHeight),
+    : mGlyphPages(256), mUnknownCharacters(0), mpSheetSurface(NULL), mCharWidth(charWidth), mCharHeight(charHeight),
+#ifndef ASCIILIB_GLYPH_BATCHING
+    mLastBucket(0),
+#endif
     mInitialized(false)
 {
     mFontLayoutPath = FileAccessPath(fontLayoutFile);
@@ -34,7 +54,7 @@ void ascii::PixelFont::Initialize(SDL_Renderer* pRenderer)
     }
 
     // Load the texture sheet
-    SDL_Surface* tempSurface = IMG_Load(mFontPath.c_str());
+    SDL_Surface* tempSurface = IMG_Load_RW(VirtualFS::Open(mFontPath), 1);
 
     // Make sure the texture sheet loaded correctly
     if (!tempSurface)
@@ -67,6 +87,24 @@ void ascii::PixelFont::Initialize(SDL_Renderer* pRenderer)
         return;
     }
 
+    // Keep a copy of the sheet for tinting, with black made transparent by
+    // hand so it doesn't depend on how SDL converts color keys
+    mpSheetSurface = SDL_ConvertSurfaceFormat(tempSurface, SDL_PIXELFORMAT_ARGB8888, 0);
+    if (mpSheetSurface)
+    {
+        SDL_LockSurface(mpSheetSurface);
+        for (int y = 0; y < mpSheetSurface->h; ++y)
+        {
+            Uint32* pixels = (Uint32*) ((Uint8*) mpSheetSurface->pixels + y * mpSheetSurface->pitch);
+
+            for (int x = 0; x < mpSheetSurface->w; ++x)
+            {
+                pixels[x] = (pixels[x] & 0x00FFFFFF) == 0 ? 0 : (pixels[x] | 0xFF000000);
+            }
+        }
+        SDL_UnlockSurface(mpSheetSurface);
+    }
+
     // Font files are white letters on black background, making black
     // transparent
     SDL_SetColorKey(tempSurface, SDL_ENABLE,
@@ -74,12 +112,20 @@ void ascii::PixelFont::Initialize(SDL_Renderer* pRenderer)
 
     // Now create a texture from the loaded surface, and free the surface
     mpTextureSheet = SDL_CreateTextureFromSurface(pRenderer, tempSurface);
+
+#ifdef ASCIILIB_GLYPH_BATCHING
+    // Remember the sheet dimensions for normalizing texture coordinates
+    mTextureWidth = tempSurface->w;
+    mTextureHeight = tempSurface->h;
+#endif
     
     // Dispose of the surface
     SDL_FreeSurface(tempSurface);
 
     // Now go through all of the rows, constructing source rectangles for each
     // character
+    mGlyphPages.assign(256, vector<SDL_Rect>());
+
     for (int r = 0; r < rows; ++r)
     {
         UnicodeString row = layoutRows[r];
@@ -94,10 +140,29 @@ void ascii::PixelFont::Initialize(SDL_Renderer* pRenderer)
             sourceRect.w = mCharWidth;
             sourceRect.h = mCharHeight;
 
-            mCharacterRectangles[character] = sourceRect;
+            vector<SDL_Rect>& page = mGlyphPages[character >> 8];
+            if (page.empty())
+            {
+                SDL_Rect noGlyph = { 0, 0, 0, 0 };
+                page.assign(256, noGlyph);
+            }
+
+            page[character & 0xFF] = sourceRect;
         }
     }
 
+    // Pick the glyph drawn in place of missing ones
+    SDL_Rect noGlyph = { 0, 0, 0, 0 };
+    mMissingGlyph = noGlyph;
+    if (hasGlyph(0xFFFD))
+    {
+        mMissingGlyph = GlyphRectangle(0xFFFD);
+    }
+    else if (hasGlyph('?'))
+    {
+        mMissingGlyph = GlyphRectangle('?');
+    }
+
     // Now the pixel font should be ready to render letters!
     mInitialized = true;
 }
@@ -115,6 +180,15 @@ void ascii::PixelFont::Dispose()
         SDL_DestroyTexture(mpTextureSheet);
     }
 
+    // Tinted sheets belong to the renderer the font was initialized with
+    FreeTintedSheets();
+
+    if (mpSheetSurface)
+    {
+        SDL_FreeSurface(mpSheetSurface);
+        mpSheetSurface = NULL;
+    }
+
     mInitialized = false;
 }
 
@@ -127,14 +201,318 @@ void ascii::PixelFont::RenderCharacter(UChar character, int x, int y, Color colo
     }
 
     // Retrieve the character's source rectangle
-    SDL_Rect src = mCharacterRectangles[character];
+    const SDL_Rect& src = GlyphRectangle(character);
     SDL_Rect dest = Rectangle(x, y, mCharWidth, mCharHeight);
 
+    // Prefer a sheet already tinted to the color, which needs no state change
+    SDL_Texture* tintedSheet = GetTintedSheet(color);
+    if (tintedSheet)
+    {
+        SDL_RenderCopy(mpRenderer, tintedSheet, &src, &dest);
+        PROFILE_DRAW_CALL(tintedSheet);
+        return;
+    }
+
     SDL_SetTextureColorMod(mpTextureSheet,
             color.r,
             color.g,
             color.b);
 
     SDL_RenderCopy(mpRenderer, mpTextureSheet, &src, &dest);
+    PROFILE_DRAW_CALL(mpTextureSheet);
 }
 
+
+void ascii::PixelFont::QueueCharacter(UChar character, int x, int y, Color color)
+{
+#ifdef ASCIILIB_GLYPH_BATCHING
+    if (!mInitialized)
+    {
+        Log::Error("Tried to render characters with uninitialized font: " + mFontPath);
+        return;
+    }
+
+    const SDL_Rect& src = GlyphRectangle(character);
+
+    // Use the same texture coordinates SDL_RenderCopy() would compute for
+    // this source rectangle, so batched glyphs match unbatched ones exactly
+    float u1 = (float) src.x / mTextureWidth;
+    float v1 = (float) src.y / mTextureHeight;
+    float u2 = (float) (src.x + src.w) / mTextureWidth;
+    float v2 = (float) (src.y + src.h) / mTextureHeight;
+
+    float x1 = (float) x;
+    float y1 = (float) y;
+    float x2 = (float) (x + mCharWidth);
+    float y2 = (float) (y + mCharHeight);
+
+    SDL_Color vertexColor = { color.r, color.g, color.b, Color::kAlpha };
+
+    int first = mBatchVertices.size();
+
+    SDL_Vertex corners[4] = {
+        { { x1, y1 }, vertexColor, { u1, v1 } },
+        { { x2, y1 }, vertexColor, { u2, v1 } },
+        { { x2, y2 }, vertexColor, { u2, v2 } },
+        { { x1, y2 }, vertexColor, { u1, v2 } }
+    };
+    mBatchVertices.insert(mBatchVertices.end(), corners, corners + 4);
+
+    // Two triangles per glyph quad
+    int quad[6] = { first, first + 1, first + 2, first, first + 2, first + 3 };
+    mBatchIndices.insert(mBatchIndices.end(), quad, quad + 6);
+#else
+    if (!mInitialized)
+    {
+        Log::Error("Tried to render characters with uninitialized font: " + mFontPath);
+        return;
+    }
+
+    Uint32 colorKey = ColorKey(color);
+
+    if (mLastBucket >= mGlyphBuckets.size() || mGlyphBuckets[mLastBucket].colorKey != colorKey)
+    {
+        mLastBucket = 0;
+        while (mLastBucket < mGlyphBuckets.size() && mGlyphBuckets[mLastBucket].colorKey != colorKey)
+        {
+            ++mLastBucket;
+        }
+
+        if (mLastBucket == mGlyphBuckets.size())
+        {
+            GlyphBucket bucket;
+            bucket.colorKey = colorKey;
+            bucket.color = color;
+            mGlyphBuckets.push_back(bucket);
+        }
+    }
+
+    GlyphBucket& bucket = mGlyphBuckets[mLastBucket];
+    bucket.sources.push_back(GlyphRectangle(character));
+    bucket.dests.push_back(Rectangle(x, y, mCharWidth, mCharHeight));
+#endif
+}
+
+void ascii::PixelFont::FlushBatch()
+{
+#ifdef ASCIILIB_GLYPH_BATCHING
+    if (mBatchIndices.empty())
+    {
+        return;
+    }
+
+    PROFILE_DRAW_CALL(mpTextureSheet);
+
+    // Vertex colors take the place of the texture color mod, so make sure
+    // a tint left over from RenderCharacter() isn't applied on top of them
+    SDL_SetTextureColorMod(mpTextureSheet, 255, 255, 255);
+
+    if (SDL_RenderGeometry(mpRenderer, mpTextureSheet,
+                &mBatchVertices[0], mBatchVertices.size(),
+                &mBatchIndices[0], mBatchIndices.size()) != 0)
+    {
+        Log::Error("Failed to render glyph batch for font: " + mFontPath);
+        Log::SDLError();
+    }
+
+    // Keep the capacity around for the next frame
+    mBatchVertices.clear();
+    mBatchIndices.clear();
+#else
+    // Glyphs sit in separate cells, so they can be drawn in any order. Draw
+    // each color's glyphs in a row from the same texture, letting the
+    // renderer batch them
+    for (auto it = mGlyphBuckets.begin(); it != mGlyphBuckets.end(); ++it)
+    {
+        if (it->dests.empty())
+        {
+            continue;
+        }
+
+        SDL_Texture* sheet = GetTintedSheet(it->color);
+        if (!sheet)
+        {
+            sheet = mpTextureSheet;
+            SDL_SetTextureColorMod(sheet, it->color.r, it->color.g, it->color.b);
+        }
+
+        for (size_t i = 0; i < it->dests.size(); ++i)
+        {
+            SDL_RenderCopy(mpRenderer, sheet, &it->sources[i], &it->dests[i]);
+            PROFILE_DRAW_CALL(sheet);
+        }
+
+        // Keep the capacity around for the next frame
+        it->sources.clear();
+        it->dests.clear();
+    }
+
+    // Don't let colors which have gone out of use slow down the search
+    if (mGlyphBuckets.size() > kMaxGlyphBuckets)
+    {
+        mGlyphBuckets.clear();
+    }
+#endif
+}
+
+bool ascii::PixelFont::hasGlyph(UChar character)
+{
+    const vector<SDL_Rect>& page = mGlyphPages[character >> 8];
+    return !page.empty() && page[character & 0xFF].w != 0;
+}
+
+const SDL_Rect& ascii::PixelFont::MissingGlyph(UChar character)
+{
+    ++mUnknownCharacters;
+
+    // Only complain about each character once
+    if (!mReportedMissing[character])
+    {
+        mReportedMissing[character] = true;
+        Log::Warning(UnicodeString("Font has no glyph for character '") + character + "': " + UnicodeString::fromUTF8(mFontPath));
+    }
+
+    return mMissingGlyph;
+}
+
+void ascii::PixelFont::SetTintCacheBudget(size_t bytes)
+{
+    sTintCacheBudget = bytes;
+    EvictTintedSheets(0);
+}
+
+SDL_Texture* ascii::PixelFont::GetTintedSheet(Color color)
+{
+    Uint32 key = ColorKey(color);
+
+    auto it = mTintedSheets.find(key);
+    if (it != mTintedSheets.end())
+    {
+        // Mark the sheet most recently used
+        sTintedSheets.splice(sTintedSheets.begin(), sTintedSheets, it->second);
+        return it->second->texture;
+    }
+
+    if (!mpSheetSurface)
+    {
+        return NULL;
+    }
+
+    size_t bytes = (size_t) mpSheetSurface->w * mpSheetSurface->h * 4;
+    if (bytes > sTintCacheBudget)
+    {
+        return NULL;
+    }
+
+    // A color drawn for a moment isn't worth tinting a whole copy of the
+    // sheet for, so leave it to the color mod until it has stayed in use.
+    // Colors drawn again after a gap start over
+    Uint32 now = SDL_GetTicks();
+
+    auto use = mColorUses.find(key);
+    if (use == mColorUses.end() || now - use->second.lastDrawn > kTintAfterMS)
+    {
+        // Forget colors which stopped being drawn before getting a sheet
+        if (mColorUses.size() > kMaxGlyphBuckets)
+        {
+            for (auto it = mColorUses.begin(); it != mColorUses.end(); )
+            {
+                if (now - it->second.lastDrawn > kTintAfterMS)
+                {
+                    it = mColorUses.erase(it);
+                }
+                else
+                {
+                    ++it;
+                }
+            }
+        }
+
+        ColorUse firstUse = { now, now };
+        mColorUses[key] = firstUse;
+        return NULL;
+    }
+
+    use->second.lastDrawn = now;
+    if (now - use->second.firstDrawn < kTintAfterMS)
+    {
+        return NULL;
+    }
+
+    mColorUses.erase(use);
+
+    EvictTintedSheets(bytes);
+
+    PROFILE_SCOPE("PixelFont::GetTintedSheet");
+
+    // The glyphs are white, so multiplying by the color tints them exactly
+    // the way the texture color mod would
+    SDL_Surface* tinted = SDL_ConvertSurface(mpSheetSurface, mpSheetSurface->format, 0);
+    if (!tinted)
+    {
+        Log::Error("Failed to tint texture sheet for font: " + mFontPath);
+        Log::SDLError();
+        return NULL;
+    }
+
+    SDL_LockSurface(tinted);
+    for (int y = 0; y < tinted->h; ++y)
+    {
+        Uint32* pixels = (Uint32*) ((Uint8*) tinted->pixels + y * tinted->pitch);
+
+        for (int x = 0; x < tinted->w; ++x)
+        {
+            Uint32 pixel = pixels[x];
+            Uint32 r = ((pixel >> 16) & 0xFF) * color.r / 255;
+            Uint32 g = ((pixel >> 8) & 0xFF) * color.g / 255;
+            Uint32 b = (pixel & 0xFF) * color.b / 255;
+            pixels[x] = (pixel & 0xFF000000) | (r << 16) | (g << 8) | b;
+        }
+    }
+    SDL_UnlockSurface(tinted);
+
+    SDL_Texture* texture = SDL_CreateTextureFromSurface(mpRenderer, tinted);
+    SDL_FreeSurface(tinted);
+
+    if (!texture)
+    {
+        Log::Error("Failed to create tinted texture sheet for font: " + mFontPath);
+        Log::SDLError();
+        return NULL;
+    }
+
+    SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+
+    TintedSheet sheet = { this, key, texture, bytes };
+    sTintedSheets.push_front(sheet);
+    mTintedSheets[key] = sTintedSheets.begin();
+    sTintCacheBytes += bytes;
+
+    return texture;
+}
+
+void ascii::PixelFont::FreeTintedSheets()
+{
+    for (auto it = mTintedSheets.begin(); it != mTintedSheets.end(); ++it)
+    {
+        SDL_DestroyTexture(it->second->texture);
+        sTintCacheBytes -= it->second->bytes;
+        sTintedSheets.erase(it->second);
+    }
+
+    mTintedSheets.clear();
+}
+
+void ascii::PixelFont::EvictTintedSheets(size_t bytesNeeded)
+{
+    while (!sTintedSheets.empty() && sTintCacheBytes + bytesNeeded > sTintCacheBudget)
+    {
+        TintedSheet& oldest = sTintedSheets.back();
+
+        SDL_DestroyTexture(oldest.texture);
+        sTintCacheBytes -= oldest.bytes;
+        oldest.font->mTintedSheets.erase(oldest.color);
+
+        sTintedSheets.pop_back();
+    }
+}
@@ -1,7 +1,10 @@
 #pragma once
 
+#include <bitset>
 #include <string>
+#include <list>
 #include <map>
+#include <vector>
 using namespace std;
 
 #include "unicode/utypes.h"
@@ -11,6 +14,11 @@ using namespace ascii;
 
 #include "SDL.h"
 
+// SDL_RenderGeometry() is needed to draw a whole batch of glyphs in one call
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+#define ASCIILIB_GLYPH_BATCHING
+#endif
+
 namespace ascii
 {
 
@@ -32,16 +40,128 @@ namespace ascii
             // given renderer
             void RenderCharacter(UChar character, int x, int y, Color color);
 
+            // Queue the given character to be drawn at the point given in
+            // pixels by the next call to FlushBatch()
+            void QueueCharacter(UChar character, int x, int y, Color color);
+
+            // Submit every character queued since the last flush. With
+            // geometry support this is a single draw call on the font's
+            // texture sheet. Otherwise the characters are drawn grouped by
+            // color, from texture sheets pre-tinted to each color that has
+            // been drawn for a while, or by changing the color mod for colors
+            // which are new, like those of a fade
+            void FlushBatch();
+
             int charHeight() { return mCharHeight; }
 
+            // Check whether the font's layout includes the given character
+            bool hasGlyph(UChar character);
+            // Number of times a character missing from the font has been
+            // drawn. Those characters are drawn with the fallback glyph
+            // instead: U+FFFD or '?' if the font has either, else nothing
+            int unknownCharacterCount() { return mUnknownCharacters; }
+
+            // Pre-tinted texture sheets are shared out of one memory budget
+            // by every font, and the least recently used ones are freed to
+            // stay under it. Characters whose tinted sheet doesn't fit are
+            // drawn by changing the texture color mod instead
+            static void SetTintCacheBudget(size_t bytes);
+            static size_t TintCacheBudget() { return sTintCacheBudget; }
+            // Bytes of texture memory used by tinted sheets right now
+            static size_t TintCacheBytes() { return sTintCacheBytes; }
+
         private:
+            struct TintedSheet
+            {
+                PixelFont* font;
+                Uint32 color;
+                SDL_Texture* texture;
+                size_t bytes;
+            };
+
+            // Retrieve the texture sheet tinted to the given color, creating
+            // it once the color has been drawn for long enough. Returns NULL
+            // if the color is too new or the sheet can't be cached
+            SDL_Texture* GetTintedSheet(Color color);
+            void FreeTintedSheets();
+            // Free least recently used sheets until the given number of bytes
+            // fits in the budget
+            static void EvictTintedSheets(size_t bytesNeeded);
+
+            static Uint32 ColorKey(Color color) { return (color.r << 16) | (color.g << 8) | color.b; }
+
+            // Every font's tinted sheets, most recently used first
+            static list<TintedSheet> sTintedSheets;
+            static size_t sTintCacheBudget;
+            static size_t sTintCacheBytes;
+
+            // Retrieve the source rectangle of the given character's glyph
+            const SDL_Rect& GlyphRectangle(UChar character)
+            {
+                const vector<SDL_Rect>& page = mGlyphPages[character >> 8];
+
+                if (!page.empty() && page[character & 0xFF].w != 0)
+                {
+                    return page[character & 0xFF];
+                }
+
+                return MissingGlyph(character);
+            }
+            const SDL_Rect& MissingGlyph(UChar character);
+
             SDL_Renderer* mpRenderer;
             SDL_Texture* mpTextureSheet;
-            map<UChar, SDL_Rect> mCharacterRectangles;
+
+            // Source rectangles of the glyphs, split by the high byte of each
+            // character into pages of 256, which are only allocated for
+            // ranges the font covers. Missing glyphs have zero width
+            vector<vector<SDL_Rect> > mGlyphPages;
+            SDL_Rect mMissingGlyph;
+            int mUnknownCharacters;
+            // Missing characters which have already been reported
+            bitset<65536> mReportedMissing;
+
+            // The texture sheet's pixels with black made transparent, kept to
+            // tint new copies of it from
+            SDL_Surface* mpSheetSurface;
+            // This font's entries in sTintedSheets
+            map<Uint32, list<TintedSheet>::iterator> mTintedSheets;
+
+            // When colors without a tinted sheet were first and last drawn,
+            // in SDL ticks
+            struct ColorUse
+            {
+                Uint32 firstDrawn;
+                Uint32 lastDrawn;
+            };
+            map<Uint32, ColorUse> mColorUses;
 
             int mCharWidth;
             int mCharHeight;
 
+#ifdef ASCIILIB_GLYPH_BATCHING
+            // Glyph quads waiting to be flushed, with each cell's color baked
+            // into its vertices
+            vector<SDL_Vertex> mBatchVertices;
+            vector<int> mBatchIndices;
+
+            int mTextureWidth;
+            int mTextureHeight;
+#else
+            // Glyphs waiting to be flushed, grouped by color
+            struct GlyphBucket
+            {
+                Uint32 colorKey;
+                Color color;
+                vector<SDL_Rect> sources;
+                vector<SDL_Rect> dests;
+            };
+            vector<GlyphBucket> mGlyphBuckets;
+            // Neighboring cells usually share a color, so check the bucket
+            // used last before searching
+            size_t mLastBucket;
+#endif
+
             string mFontLayoutPath;
             string mFontPath;
 
@@ -0,0 +1,187 @@
+#include "Profiler.h"
+
+#include <stdio.h>
+
+#include "Log.h"
+
+
+namespace
+{
+    // Stop recording once this many events are stored, so that a long
+    // session can't eat all available memory
+    const size_t kMaxEvents = 1000000;
+
+    // Events can be recorded, and draw calls counted, from more than one
+    // thread. A render thread counts its draw calls into the frame the game
+    // thread is on
+    SDL_SpinLock sLock = 0;
+
+    // Microseconds between the given counter value and the first event
+    double Microseconds(Uint64 counter, Uint64 origin)
+    {
+        return (double) (counter - origin) * 1000000.0 / (double) SDL_GetPerformanceFrequency();
+    }
+
+    // Write a string as a JSON string literal
+    void WriteJSONString(FILE* file, const char* text)
+    {
+        fputc('"', file);
+        for (const char* c = text; *c; ++c)
+        {
+            if (*c == '"' || *c == '\\')
+            {
+                fputc('\\', file);
+            }
+            fputc(*c, file);
+        }
+        fputc('"', file);
+    }
+}
+
+vector<ascii::Profiler::Event> ascii::Profiler::sEvents;
+bool ascii::Profiler::sFull = false;
+
+Uint64 ascii::Profiler::sFrameStart = 0;
+ascii::FrameStats ascii::Profiler::sFrame;
+ascii::FrameStats ascii::Profiler::sLastFrame;
+SDL_Texture* ascii::Profiler::sLastTexture = NULL;
+
+string ascii::Profiler::sOutputFilename;
+
+void ascii::Profiler::BeginFrame()
+{
+    Uint64 frameStart = SDL_GetPerformanceCounter();
+
+    SDL_AtomicLock(&sLock);
+    sFrameStart = frameStart;
+    sFrame = FrameStats();
+    sLastTexture = NULL;
+    SDL_AtomicUnlock(&sLock);
+}
+
+void ascii::Profiler::EndFrame()
+{
+    Uint64 frameEnd = SDL_GetPerformanceCounter();
+
+    SDL_AtomicLock(&sLock);
+    sFrame.seconds = (double) (frameEnd - sFrameStart) / (double) SDL_GetPerformanceFrequency();
+    FrameStats frame = sFrame;
+    Uint64 frameStart = sFrameStart;
+    SDL_AtomicUnlock(&sLock);
+
+    sLastFrame = frame;
+
+    RecordScope("Frame", frameStart, frameEnd);
+
+    Event counter;
+    counter.name = "Frame";
+    counter.start = frameEnd;
+    counter.end = frameEnd;
+    counter.thread = SDL_ThreadID();
+    counter.counter = true;
+    counter.stats = frame;
+    AddEvent(counter);
+}
+
+void ascii::Profiler::RecordScope(const char* name, Uint64 start, Uint64 end)
+{
+    Event event;
+    event.name = name;
+    event.start = start;
+    event.end = end;
+    event.thread = SDL_ThreadID();
+    event.counter = false;
+    AddEvent(event);
+}
+
+void ascii::Profiler::CountDrawCall(SDL_Texture* texture)
+{
+    SDL_AtomicLock(&sLock);
+
+    ++sFrame.drawCalls;
+
+    if (texture)
+    {
+        if (sLastTexture && texture != sLastTexture)
+        {
+            ++sFrame.textureSwitches;
+        }
+
+        sLastTexture = texture;
+    }
+
+    SDL_AtomicUnlock(&sLock);
+}
+
+void ascii::Profiler::AddEvent(Event event)
+{
+    SDL_AtomicLock(&sLock);
+
+    if (sEvents.size() < kMaxEvents)
+    {
+        sEvents.push_back(event);
+    }
+    else if (!sFull)
+    {
+        sFull = true;
+        Log::Error("Profiler event limit reached. No more events will be recorded.");
+    }
+
+    SDL_AtomicUnlock(&sLock);
+}
+
+bool ascii::Profiler::WriteChromeTrace(string filename)
+{
+    FILE* file = fopen(filename.c_str(), "w");
+
+    if (!file)
+    {
+        Log::Error("Profiler trace could not be opened for writing: " + filename);
+        return false;
+    }
+
+    SDL_AtomicLock(&sLock);
+
+    Uint64 origin = 0;
+    for (size_t i = 0; i < sEvents.size(); ++i)
+    {
+        if (i == 0 || sEvents[i].start < origin)
+        {
+            origin = sEvents[i].start;
+        }
+    }
+
+    fprintf(file, "{\"traceEvents\":[\n");
+
+    for (size_t i = 0; i < sEvents.size(); ++i)
+    {
+        Event& event = sEvents[i];
+
+        fprintf(file, "{\"name\":");
+        WriteJSONString(file, event.name);
+
+        if (event.counter)
+        {
+            fprintf(file, ",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,\"tid\":%lu,"
+                    "\"args\":{\"drawCalls\":%d,\"textureSwitches\":%d}}",
+                    Microseconds(event.start, origin), (unsigned long) event.thread,
+                    event.stats.drawCalls, event.stats.textureSwitches);
+        }
+        else
+        {
+            fprintf(file, ",\"cat\":\"ascii\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%lu}",
+                    Microseconds(event.start, origin),
+                    Microseconds(event.end, event.start),
+                    (unsigned long) event.thread);
+        }
+
+        fprintf(file, i + 1 < sEvents.size() ? ",\n" : "\n");
+    }
+
+    fprintf(file, "],\"displayTimeUnit\":\"ms\"}\n");
+
+    SDL_AtomicUnlock(&sLock);
+
+    fclose(file);
+    return true;
+}
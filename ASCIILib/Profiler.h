@@ -0,0 +1,116 @@
+#pragma once
+
+#include <string>
+#include <vector>
+using namespace std;
+
+#include <SDL.h>
+
+namespace ascii
+{
+    // Timings and counters for one frame
+    struct FrameStats
+    {
+        FrameStats() : seconds(0), drawCalls(0), textureSwitches(0) { }
+
+        double seconds;
+        int drawCalls;
+        int textureSwitches;
+    };
+
+    // Records how long named scopes take, using SDL's high resolution
+    // counter, along with the draw calls and texture switches of each frame.
+    // The session can be exported in Chrome's trace event format, to inspect
+    // in chrome://tracing or any compatible trace viewer.
+    //
+    // Use the PROFILE_ macros below rather than calling this directly: they
+    // compile to nothing unless ASCIILIB_PROFILE is defined.
+    class Profiler
+    {
+        public:
+            static void BeginFrame();
+            static void EndFrame();
+
+            // Record a scope which began and ended at the given counter values
+            static void RecordScope(const char* name, Uint64 start, Uint64 end);
+
+            // Count a draw call. Consecutive textured draw calls which use
+            // different textures also count as texture switches. Any thread
+            // may count them, and they go to the current frame
+            static void CountDrawCall(SDL_Texture* texture=NULL);
+
+            // Stats for the last frame that ended
+            static FrameStats LastFrame() { return sLastFrame; }
+
+            // Write every event recorded so far as Chrome trace JSON
+            static bool WriteChromeTrace(string filename);
+
+            // Where Game writes the trace when it stops running. Nothing is
+            // written if this is empty
+            static void SetOutputFilename(string filename) { sOutputFilename = filename; }
+            static string OutputFilename() { return sOutputFilename; }
+
+        private:
+            struct Event
+            {
+                const char* name;
+                Uint64 start;
+                Uint64 end;
+                SDL_threadID thread;
+                // Counter events have no duration, only frame stats
+                bool counter;
+                FrameStats stats;
+            };
+
+            static void AddEvent(Event event);
+
+            static vector<Event> sEvents;
+            static bool sFull;
+
+            static Uint64 sFrameStart;
+            static FrameStats sFrame;
+            static FrameStats sLastFrame;
+            static SDL_Texture* sLastTexture;
+
+            static string sOutputFilename;
+    };
+
+    // Times the scope it is declared in
+    class ScopedTimer
+    {
+        public:
+            ScopedTimer(const char* name)
+                : mName(name), mStart(SDL_GetPerformanceCounter()) { }
+
+            ~ScopedTimer()
+            {
+                Profiler::RecordScope(mName, mStart, SDL_GetPerformanceCounter());
+            }
+
+        private:
+            const char* mName;
+            Uint64 mStart;
+    };
+}
+
+#ifdef ASCIILIB_PROFILE
+
+#define PROFILE_JOIN_(a, b) a ## b
+#define PROFILE_JOIN(a, b) PROFILE_JOIN_(a, b)
+
+// Time the rest of the enclosing scope under the given name
+#define PROFILE_SCOPE(name) ascii::ScopedTimer PROFILE_JOIN(profileTimer, __LINE__)(name)
+
+#define PROFILE_BEGIN_FRAME() ascii::Profiler::BeginFrame()
+#define PROFILE_END_FRAME() ascii::Profiler::EndFrame()
+
+#define PROFILE_DRAW_CALL(texture) ascii::Profiler::CountDrawCall(texture)
+
+#else
+
+#define PROFILE_SCOPE(name)
+#define PROFILE_BEGIN_FRAME()
+#define PROFILE_END_FRAME()
+#define PROFILE_DRAW_CALL(texture)
+
+#endif
@@ -0,0 +1,161 @@
+#include "RenderThread.h"
+
+#include "Log.h"
+#include "Profiler.h"
+
+
+ascii::RenderThread::RenderThread()
+    : mpThread(NULL), mThreadID(0), mStopping(false), mFramePending(false),
+    mCallsQueued(0), mCallsDone(0), mpWindow(NULL), mRendererFlags(0),
+    mpRenderer(NULL)
+{
+    mpLock = SDL_CreateMutex();
+    mpWake = SDL_CreateCond();
+    mpDone = SDL_CreateCond();
+}
+
+ascii::RenderThread::~RenderThread()
+{
+    Stop();
+
+    SDL_DestroyCond(mpDone);
+    SDL_DestroyCond(mpWake);
+    SDL_DestroyMutex(mpLock);
+}
+
+SDL_Renderer* ascii::RenderThread::Start(SDL_Window* window, Uint32 rendererFlags, function<void()> drawFrame)
+{
+    mpWindow = window;
+    mRendererFlags = rendererFlags;
+    mDrawFrame = drawFrame;
+    mStopping = false;
+
+    mpThread = SDL_CreateThread(ThreadMain, "Render", this);
+
+    if (!mpThread)
+    {
+        Log::Error("Failed to start the render thread.");
+        Log::SDLError();
+        return NULL;
+    }
+
+    mThreadID = SDL_GetThreadID(mpThread);
+
+    // Wait for the renderer to be created before anything can use it
+    Call([]() { });
+
+    if (!mpRenderer)
+    {
+        Stop();
+    }
+
+    return mpRenderer;
+}
+
+void ascii::RenderThread::Stop()
+{
+    if (!mpThread)
+    {
+        return;
+    }
+
+    SDL_LockMutex(mpLock);
+    mStopping = true;
+    SDL_CondSignal(mpWake);
+    SDL_UnlockMutex(mpLock);
+
+    SDL_WaitThread(mpThread, NULL);
+    mpThread = NULL;
+}
+
+void ascii::RenderThread::FramePublished()
+{
+    SDL_LockMutex(mpLock);
+    mFramePending = true;
+    SDL_CondSignal(mpWake);
+    SDL_UnlockMutex(mpLock);
+}
+
+void ascii::RenderThread::Call(function<void()> work)
+{
+    if (!mpThread || SDL_ThreadID() == mThreadID)
+    {
+        work();
+        return;
+    }
+
+    SDL_LockMutex(mpLock);
+
+    mCalls.push_back(work);
+    Uint64 ticket = ++mCallsQueued;
+    SDL_CondSignal(mpWake);
+
+    while (mCallsDone < ticket)
+    {
+        SDL_CondWait(mpDone, mpLock);
+    }
+
+    SDL_UnlockMutex(mpLock);
+}
+
+int ascii::RenderThread::ThreadMain(void* data)
+{
+    ((RenderThread*) data)->Loop();
+    return 0;
+}
+
+void ascii::RenderThread::Loop()
+{
+    mpRenderer = SDL_CreateRenderer(mpWindow, -1, mRendererFlags);
+
+    if (!mpRenderer)
+    {
+        Log::Error("Failed to create SDL_Renderer on the render thread.");
+        Log::SDLError();
+    }
+
+    SDL_LockMutex(mpLock);
+
+    while (true)
+    {
+        while (!mFramePending && mCalls.empty() && !mStopping)
+        {
+            SDL_CondWait(mpWake, mpLock);
+        }
+
+        // Draw before running calls, so that a frame published before a
+        // texture is freed is done with it first
+        if (mFramePending)
+        {
+            mFramePending = false;
+            SDL_UnlockMutex(mpLock);
+
+            {
+                PROFILE_SCOPE("RenderThread::DrawFrame");
+                mDrawFrame();
+            }
+
+            SDL_LockMutex(mpLock);
+        }
+
+        while (!mCalls.empty())
+        {
+            function<void()> work = mCalls.front();
+            mCalls.pop_front();
+            SDL_UnlockMutex(mpLock);
+
+            work();
+
+            SDL_LockMutex(mpLock);
+            ++mCallsDone;
+            SDL_CondBroadcast(mpDone);
+        }
+
+        if (mStopping && !mFramePending)
+        {
+            break;
+        }
+    }
+
+    SDL_UnlockMutex(mpLock);
+}
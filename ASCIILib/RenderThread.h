@@ -0,0 +1,74 @@
+#pragma once
+
+#include <deque>
+#include <functional>
+using namespace std;
+
+#include <SDL.h>
+
+namespace ascii
+{
+    // A thread which owns an SDL_Renderer, for Graphics' pipelined mode.
+    // SDL renderers may only be used from the thread which created them, so
+    // frames are drawn here, and anything else needing the renderer is
+    // handed over with Call()
+    class RenderThread
+    {
+        public:
+            RenderThread();
+            ~RenderThread();
+
+            // Start the thread and create a renderer for the window on it.
+            // The given function draws the latest frame whenever one is
+            // published. Returns NULL if either fails
+            SDL_Renderer* Start(SDL_Window* window, Uint32 rendererFlags, function<void()> drawFrame);
+
+            // Finish any work handed over so far, then stop the thread
+            void Stop();
+
+            bool running() { return mpThread != NULL; }
+
+            // Wake the thread to draw the latest frame
+            void FramePublished();
+
+            // Run work on the render thread and wait for it to finish. Frames
+            // published before the call are drawn first
+            void Call(function<void()> work);
+
+            // Call work on the given thread, or right here if there is none
+            static void Run(RenderThread* thread, function<void()> work)
+            {
+                if (thread)
+                {
+                    thread->Call(work);
+                }
+                else
+                {
+                    work();
+                }
+            }
+
+        private:
+            static int ThreadMain(void* data);
+            void Loop();
+
+            SDL_Thread* mpThread;
+            SDL_threadID mThreadID;
+            SDL_mutex* mpLock;
+            SDL_cond* mpWake;
+            SDL_cond* mpDone;
+
+            // Guarded by mpLock
+            bool mStopping;
+            bool mFramePending;
+            deque<function<void()> > mCalls;
+            // Number of calls finished, so callers know when theirs is
+            Uint64 mCallsQueued;
+            Uint64 mCallsDone;
+
+            SDL_Window* mpWindow;
+            Uint32 mRendererFlags;
+            SDL_Renderer* mpRenderer;
+            function<void()> mDrawFrame;
+    };
+}
@@ -7,14 +7,30 @@ using namespace std;
 #include <time.h>
 
 #include "Log.h"
+#include "VirtualFS.h"
 using ascii::Log;
 
 
 const int kChunkSize = 1024;
 
+namespace
+{
+    // Whether a chunk is playing on any channel, so it can't be freed
+    bool ChunkPlaying(Mix_Chunk* chunk)
+    {
+        for (int i = 0; i < MIX_CHANNELS; ++i)
+        {
+            if (Mix_Playing(i) && Mix_GetChunk(i) == chunk) return true;
+        }
+
+        return false;
+    }
+}
+
 ascii::SoundManager::SoundManager(void)
     : mSoundVolume(1.0f), mEnabled(true), mCurrentTrackPosition(0.0f),
-    mPlayingCurrentTrack(false), mCurrentLoops(0), mBackgroundTrackVolumeMod(1.0f)
+    mPlayingCurrentTrack(false), mCurrentLoops(0), mBackgroundTrackVolumeMod(1.0f),
+    mBudget(2)
 {
     if (Mix_Init(MIX_INIT_OGG) != MIX_INIT_OGG)
     {
@@ -74,13 +90,31 @@ void ascii::SoundManager::loadSound(std::string key, string path)
 {
     if (!mEnabled) return;
 
-    Mix_Chunk* sound = Mix_LoadWAV(path.c_str());
+    Mix_Chunk* sound = Mix_LoadWAV_RW(VirtualFS::Open(path), 1);
     if (!sound)
     {
         Log::Error("Failed to load sound " + path);
         Log::SDLError();
     }
+    addSound(key, sound, path);
+}
+
+void ascii::SoundManager::addSound(std::string key, Mix_Chunk* sound, string path)
+{
+    if (!mEnabled)
+    {
+        Mix_FreeChunk(sound);
+        return;
+    }
+
 	mSounds[key] = sound;
+    mSoundPaths[key] = path;
+
+    if (sound)
+    {
+        mBudget.add(kSoundAsset, key, sound->alen, !path.empty());
+        evictSounds(kSoundAsset, key);
+    }
 }
 
 bool ascii::SoundManager::hasSound(std::string key)
@@ -94,8 +128,17 @@ void ascii::SoundManager::freeSound(std::string key)
 {
     if (!mEnabled) return;
 
-	Mix_FreeChunk(getSound(key));
-	mSounds.erase(key);
+    auto it = mSounds.find(key);
+    if (it == mSounds.end())
+    {
+        Log::Error("Tried to access nonexistent sound: " + key);
+        return;
+    }
+
+	Mix_FreeChunk(it->second);
+	mSounds.erase(it);
+    mSoundPaths.erase(key);
+    mBudget.remove(kSoundAsset, key);
 }
 
 void ascii::SoundManager::playSound(std::string key, float volume)
@@ -204,26 +247,61 @@ void ascii::SoundManager::loadGroupSound(std::string group, string path)
 {
     if (!mEnabled) return;
 
-    Mix_Chunk* groupSound = Mix_LoadWAV(path.c_str());
+    Mix_Chunk* groupSound = Mix_LoadWAV_RW(VirtualFS::Open(path), 1);
     if (!groupSound)
     {
         Log::Error("Failed to load sound for group '" + group + "': " + path ); 
     }
-	mSoundGroups[group].push_back(groupSound);
+    addGroupSound(group, groupSound, path);
+}
+
+void ascii::SoundManager::addGroupSound(std::string group, Mix_Chunk* sound, string path)
+{
+    if (!mEnabled)
+    {
+        Mix_FreeChunk(sound);
+        return;
+    }
+
+    SoundGroup& soundGroup = mSoundGroups[group];
+    vector<string>& paths = mSoundGroupPaths[group];
+
+	soundGroup.push_back(sound);
+    paths.push_back(path);
+
+    // The group is budgeted as a whole, and can only be loaded again if
+    // every sound in it can
+    size_t bytes = 0;
+    bool reloadable = true;
+    for (size_t i = 0; i < soundGroup.size(); ++i)
+    {
+        if (soundGroup[i]) bytes += soundGroup[i]->alen;
+        reloadable = reloadable && !paths[i].empty();
+    }
+
+    mBudget.add(kSoundGroupAsset, group, bytes, reloadable);
+    evictSounds(kSoundGroupAsset, group);
 }
 
 void ascii::SoundManager::freeSoundGroup(std::string group)
 {
     if (!mEnabled) return;
 
-	ascii::SoundManager::SoundGroup soundGroup = getSoundGroup(group);
+    auto it = mSoundGroups.find(group);
+    if (it == mSoundGroups.end())
+    {
+        Log::Error("Tried to access nonexistent sound group: " + group);
+        return;
+    }
 
-	for (auto it = soundGroup.begin(); it != soundGroup.end(); ++it)
+	for (auto sound = it->second.begin(); sound != it->second.end(); ++sound)
 	{
-		Mix_FreeChunk(*it);
+		Mix_FreeChunk(*sound);
 	}
 
-	mSoundGroups.erase(group);
+	mSoundGroups.erase(it);
+    mSoundGroupPaths.erase(group);
+    mBudget.remove(kSoundGroupAsset, group);
 }
 
 int ascii::SoundManager::playSoundGroup(std::string group, float volume)
@@ -241,7 +319,7 @@ int ascii::SoundManager::playSoundGroup(std::string group, float volume)
 
     int channel = firstOpenChannel();
     Mix_Volume(channel, MIX_MAX_VOLUME * (mSoundVolume * volume));
-	return Mix_PlayChannel(channel, getSoundGroup(group)[n], 0);
+	return Mix_PlayChannel(channel, soundGroup[n], 0);
 }
 
 int ascii::SoundManager::playSoundGroupGetDuration(std::string group, float volume)
@@ -252,7 +330,7 @@ int ascii::SoundManager::playSoundGroupGetDuration(std::string group, float volu
 
 	int n = rand() % soundGroup.size();
 
-    Mix_Chunk* groupSound = getSoundGroup(group)[n];
+    Mix_Chunk* groupSound = soundGroup[n];
 
     int channel = firstOpenChannel();
     Mix_Volume(channel, MIX_MAX_VOLUME * (mSoundVolume * volume));
@@ -329,12 +407,23 @@ void ascii::SoundManager::loadTrack(std::string key, string path)
 {
     if (!mEnabled) return;
 
-    Mix_Music* track = Mix_LoadMUS(path.c_str());
+    Mix_Music* track = Mix_LoadMUS_RW(VirtualFS::Open(path), 1);
     if (!track)
     {
         Log::Error("Failed to load music file: " + path);
         Log::SDLError();
     }
+    addTrack(key, track);
+}
+
+void ascii::SoundManager::addTrack(std::string key, Mix_Music* track)
+{
+    if (!mEnabled)
+    {
+        Mix_FreeMusic(track);
+        return;
+    }
+
 	mTracks[key] = track;
 }
 
@@ -457,6 +546,16 @@ Mix_Chunk* ascii::SoundManager::getSound(std::string key)
         return NULL;
     }
 
+    if (mBudget.evicted(kSoundAsset, key))
+    {
+        mBudget.miss(kSoundAsset);
+        loadSound(key, mSoundPaths[key]);
+    }
+    else
+    {
+        mBudget.hit(kSoundAsset, key);
+    }
+
     Mix_Chunk* sound = mSounds[key];
     return sound;
 }
@@ -472,10 +571,99 @@ ascii::SoundManager::SoundGroup ascii::SoundManager::getSoundGroup(
         return SoundGroup();
     }
 
+    if (mBudget.evicted(kSoundGroupAsset, groupKey))
+    {
+        mBudget.miss(kSoundGroupAsset);
+
+        // Load every sound of the group again, in the same order
+        vector<string> paths = mSoundGroupPaths[groupKey];
+        mSoundGroups[groupKey].clear();
+        mSoundGroupPaths[groupKey].clear();
+
+        for (auto it = paths.begin(); it != paths.end(); ++it)
+        {
+            loadGroupSound(groupKey, *it);
+        }
+    }
+    else
+    {
+        mBudget.hit(kSoundGroupAsset, groupKey);
+    }
+
     ascii::SoundManager::SoundGroup group = mSoundGroups[groupKey];
     return group;
 }
 
+void ascii::SoundManager::setMemoryBudget(size_t bytes)
+{
+    mBudget.setBudget(bytes);
+    evictSounds(-1, "");
+}
+
+void ascii::SoundManager::pinSound(std::string key)
+{
+    mBudget.pin(kSoundAsset, key);
+}
+
+void ascii::SoundManager::unpinSound(std::string key)
+{
+    mBudget.unpin(kSoundAsset, key);
+}
+
+void ascii::SoundManager::pinSoundGroup(std::string group)
+{
+    mBudget.pin(kSoundGroupAsset, group);
+}
+
+void ascii::SoundManager::unpinSoundGroup(std::string group)
+{
+    mBudget.unpin(kSoundGroupAsset, group);
+}
+
+void ascii::SoundManager::evictSounds(int keepType, const string& keepKey)
+{
+    if (!mEnabled) return;
+
+    auto canEvict = [this, keepType, &keepKey](int type, const string& key)
+    {
+        if (type == keepType && key == keepKey) return false;
+
+        if (type == kSoundAsset)
+        {
+            return !ChunkPlaying(mSounds[key]);
+        }
+
+        SoundGroup& group = mSoundGroups[key];
+        for (auto it = group.begin(); it != group.end(); ++it)
+        {
+            if (ChunkPlaying(*it)) return false;
+        }
+        return true;
+    };
+
+    int type;
+    string key;
+
+    while (mBudget.nextEviction(&type, &key, canEvict))
+    {
+        // Paths stay behind to load the sounds again from
+        if (type == kSoundAsset)
+        {
+            Mix_FreeChunk(mSounds[key]);
+            mSounds[key] = NULL;
+        }
+        else
+        {
+            SoundGroup& group = mSoundGroups[key];
+            for (auto it = group.begin(); it != group.end(); ++it)
+            {
+                Mix_FreeChunk(*it);
+                *it = NULL;
+            }
+        }
+    }
+}
+
 
 void ascii::SoundManager::playBackgroundTrack()
 {
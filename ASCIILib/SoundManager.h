@@ -9,6 +9,8 @@ using namespace std;
 
 #include <SDL_mixer.h>
 
+#include "MemoryBudget.h"
+
 namespace ascii
 {
 
@@ -30,6 +32,12 @@ namespace ascii
 			///<param name="path">The file path of the WAV file.</param>
 			void loadSound(std::string key, string path);
 
+            // Store a sound which was already decoded, such as by a loading
+            // thread. The SoundManager takes ownership of it. Sounds with a
+            // path can be evicted to stay within the memory budget, and are
+            // loaded from it again when played
+            void addSound(std::string key, Mix_Chunk* sound, string path="");
+
             ///<summary>
             /// Check if the SoundManager has loaded a sound corresponding
             /// to the given key
@@ -74,6 +82,11 @@ namespace ascii
 			///<param name="path">The file path of the WAV file.</param>
 			void loadGroupSound(std::string group, string path);
 
+            // Store an already decoded sound in a sound group, taking
+            // ownership of it. A group can only be evicted if all of its
+            // sounds have a path
+            void addGroupSound(std::string group, Mix_Chunk* sound, string path="");
+
 			///<summary>
 			/// Frees all sounds from a sound group.
 			///</summary>
@@ -135,6 +148,9 @@ namespace ascii
 			///<param name="path">The file path of the track.</param>
 			void loadTrack(std::string key, string path);
 
+            // Store an already opened music track, taking ownership of it
+            void addTrack(std::string key, Mix_Music* track);
+
 			///<summary>
 			/// Frees a music track from memory.
 			///</summary>
@@ -205,6 +221,26 @@ namespace ascii
 
             bool isEnabled() { return mEnabled; }
 
+            // Whether update() has work to do soon, such as restarting
+            // looping sound groups when their current sound ends
+            bool needsUpdates() { return mEnabled && !mLoopingChannels.empty(); }
+
+            ///<summary>
+            /// Limits the bytes of decoded audio kept for sounds and sound groups. Past the budget, the least recently played ones which aren't pinned or playing are evicted. 0, the default, means no limit.
+            ///</summary>
+            void setMemoryBudget(size_t bytes);
+            size_t memoryBudget() { return mBudget.budget(); }
+
+            // Keep a sound or sound group from being evicted until it is
+            // unpinned as many times
+            void pinSound(std::string key);
+            void unpinSound(std::string key);
+            void pinSoundGroup(std::string group);
+            void unpinSoundGroup(std::string group);
+
+            CacheStats soundStats() { return mBudget.stats(kSoundAsset); }
+            CacheStats soundGroupStats() { return mBudget.stats(kSoundGroupAsset); }
+
 		private:
             ///<summary>
             /// Return the length in milliseconds of a sound effect recorded in
@@ -220,12 +256,29 @@ namespace ascii
 
 			typedef std::vector<Mix_Chunk*> SoundGroup;
 
+            // Asset types of the memory budget
+            enum
+            {
+                kSoundAsset,
+                kSoundGroupAsset
+            };
+
+            // Retrieving an evicted sound or group loads it again
             Mix_Chunk* getSound(std::string key);
             SoundGroup getSoundGroup(std::string groupKey);
 
+            // Free sounds and groups until within the memory budget, keeping
+            // the given one and any which are playing
+            void evictSounds(int keepType, const string& keepKey);
+
 			std::map<std::string, Mix_Chunk*> mSounds;
 			std::map<std::string, SoundGroup> mSoundGroups;
 
+            // Where sounds and the sounds of each group can be loaded from
+            // again after eviction
+            std::map<std::string, string> mSoundPaths;
+            std::map<std::string, std::vector<string> > mSoundGroupPaths;
+
             Mix_Music* getTrack(std::string key);
 			std::map<std::string, Mix_Music*> mTracks;
 
@@ -244,6 +297,8 @@ namespace ascii
             float mSoundVolume;
 
             bool mEnabled;
+
+            MemoryBudget mBudget;
 	};
 
 };
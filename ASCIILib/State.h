@@ -1,5 +1,9 @@
 #pragma once
 
+#include <algorithm>
+#include <vector>
+using namespace std;
+
 #include "Input.h"
 #include "Graphics.h"
 
@@ -16,8 +20,17 @@ namespace ascii
     class State
     {
         public:
+            // Every state is tracked while it exists, so the game loop can
+            // check their hints without games forwarding them
+            State() { LiveStates().push_back(this); }
+            State(const State&) { LiveStates().push_back(this); }
+
             // Virtual destructor to avoid memory leakage
-            virtual ~State() { }
+            virtual ~State()
+            {
+                vector<State*>& states = LiveStates();
+                states.erase(remove(states.begin(), states.end(), this), states.end());
+            }
 
             // Functioning loop of the state
             virtual void Update(int deltaMS)=0;
@@ -31,6 +44,19 @@ namespace ascii
             // Whether this state requires the screen be refreshed after it draws
             virtual bool MustRefreshScreen() { return false; }
 
+            // Whether any existing state requires the screen be refreshed.
+            // Keeps the game loop's idle mode from waiting
+            static bool AnyMustRefreshScreen()
+            {
+                vector<State*>& states = LiveStates();
+                for (auto it = states.begin(); it != states.end(); ++it)
+                {
+                    if ((*it)->MustRefreshScreen()) return true;
+                }
+
+                return false;
+            }
+
             // Complete this state's execution immediately if possible
             virtual void Skip() { }
 
@@ -41,5 +67,12 @@ namespace ascii
             // If the state is finished, this method will return the next state for
             // the game to run
             virtual State* NextState(Game* game)=0;
+
+        private:
+            static vector<State*>& LiveStates()
+            {
+                static vector<State*> states;
+                return states;
+            }
     };
 }
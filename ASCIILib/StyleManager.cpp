@@ -8,7 +8,12 @@ using namespace ascii;
 
 void ascii::StyleManager::LoadStyle(string key, string stylePath)
 {
-    mStyles[key] = DialogStyle::FromFile(stylePath);
+    AddStyle(key, DialogStyle::FromFile(stylePath));
+}
+
+void ascii::StyleManager::AddStyle(string key, DialogStyle* style)
+{
+    mStyles[key] = style;
 }
 
 void ascii::StyleManager::FreeStyle(string key)
@@ -15,6 +15,9 @@ class StyleManager
     public:
         // Load a dialog style with a key from the given JSON file path
         void LoadStyle(string key, string stylePath);
+        // Store a dialog style which was already parsed, taking ownership of
+        // it
+        void AddStyle(string key, DialogStyle* style);
         // Free the dialog style with the given key
         void FreeStyle(string key);
         
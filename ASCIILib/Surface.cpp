@@ -1,5 +1,7 @@
 #include "Surface.h"
 
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 #include <map>
 #include <sstream>
@@ -14,59 +16,229 @@ using namespace std;
 #include "FileReader.h"
 #include "Log.h"
 #include "StringTokenizer.h"
+#include "SurfaceKernels.h"
+#include "VirtualFS.h"
 using namespace ascii;
 
 
 const string kEmptyInfo(".");
 
-ascii::Surface::Surface(int width, int height)
-	: mWidth(width), mHeight(height), 
-		mCharacters(width, vector<UChar>(height, ' ')),
-		mBackgroundColors(width, vector<Color>(height, Color::Black)),
-		mCharacterColors(width, vector<Color>(height, Color::White)),
-		mSpecialInfo(width, vector<string>(height, ""))
+// IDs are stored in 16 bits per cell
+const size_t kMaxSpecialInfoStrings = 65536;
+
+namespace
 {
-	for (int x = 0; x < width; ++x)
-	{
-		mCellOpacity.push_back(new bool[height]);
-        
-        for (int y = 0; y < height; ++y)
+    // Orders points column by column: top to bottom, then left to right.
+    // This is the order special points have always been reported in, so
+    // getSpecialPoint() keeps returning the same point
+    bool ColumnMajorLess(const ascii::Point& a, const ascii::Point& b)
+    {
+        return a.x < b.x || (a.x == b.x && a.y < b.y);
+    }
+
+    // BINARY SURFACE FORMAT
+    //
+    // Compiled surfaces are stored little-endian in one file, so they can be
+    // mapped into memory and copied into a Surface without any parsing:
+    //
+    //   magic "SRFB", Uint16 version, Uint8 palette index size, Uint8
+    //   special info ID size, Uint32 width, height, palette size, special
+    //   info count, special info bytes, reserved
+    //   palette: r, g, b, flags for each color
+    //   characters: Uint16 per cell
+    //   background colors: palette index per cell
+    //   character colors: palette index per cell
+    //   opacity: Uint8 per cell
+    //   special info: ID per cell
+    //   special info table: Uint32 offset of each string into the string
+    //   data, plus one for the end of the last string, then the string data
+    //
+    // Cells are in row-major order. Palette indices and special info IDs take
+    // 1 byte each when there are at most 256 of them, otherwise 2. String 0
+    // is always empty
+    const char kBinaryMagic[4] = { 'S', 'R', 'F', 'B' };
+    const Uint16 kBinaryVersion = 1;
+    // Flags of a palette entry. An indexed color keeps its index in r
+    const Uint8 kPaletteNone = 1;
+    const Uint8 kPaletteIndexed = 2;
+    // Sanity limit for a surface's width or height in a binary file
+    const Uint32 kMaxBinaryDimension = 65535;
+
+    Uint16 ReadLE16(const Uint8* bytes)
+    {
+        return (Uint16) (bytes[0] | (bytes[1] << 8));
+    }
+
+    Uint32 ReadLE32(const Uint8* bytes)
+    {
+        return (Uint32) bytes[0] | ((Uint32) bytes[1] << 8)
+            | ((Uint32) bytes[2] << 16) | ((Uint32) bytes[3] << 24);
+    }
+
+    // Walks through a binary file's blocks, failing instead of reading past
+    // the end
+    struct BinaryReader
+    {
+        BinaryReader(const Uint8* data, size_t size)
+            : pos(data), end(data + size), failed(false) { }
+
+        const Uint8* take(size_t count)
+        {
+            if (failed || (size_t) (end - pos) < count)
+            {
+                failed = true;
+                return NULL;
+            }
+
+            const Uint8* block = pos;
+            pos += count;
+            return block;
+        }
+
+        Uint8 read8()
         {
-            mCellOpacity.back()[y] = true;
+            const Uint8* bytes = take(1);
+            return bytes ? bytes[0] : 0;
         }
-	}
+
+        Uint16 read16()
+        {
+            const Uint8* bytes = take(2);
+            return bytes ? ReadLE16(bytes) : 0;
+        }
+
+        Uint32 read32()
+        {
+            const Uint8* bytes = take(4);
+            return bytes ? ReadLE32(bytes) : 0;
+        }
+
+        const Uint8* pos;
+        const Uint8* end;
+        bool failed;
+    };
+
+    struct BinaryWriter
+    {
+        void write(const void* data, size_t count)
+        {
+            const Uint8* start = (const Uint8*) data;
+            bytes.insert(bytes.end(), start, start + count);
+        }
+
+        void write8(Uint8 value)
+        {
+            bytes.push_back(value);
+        }
+
+        void write16(Uint16 value)
+        {
+            bytes.push_back(value & 0xFF);
+            bytes.push_back(value >> 8);
+        }
+
+        void write32(Uint32 value)
+        {
+            write16(value & 0xFFFF);
+            write16(value >> 16);
+        }
+
+        void writeIndex(Uint32 index, Uint8 indexBytes)
+        {
+            if (indexBytes == 1)
+            {
+                write8(index);
+            }
+            else
+            {
+                write16(index);
+            }
+        }
+
+        vector<Uint8> bytes;
+    };
+
+    // Read the i-th little-endian index of a block of indexBytes-wide indices
+    Uint32 ReadIndex(const Uint8* block, size_t i, Uint8 indexBytes)
+    {
+        return indexBytes == 1 ? block[i] : ReadLE16(block + i * 2);
+    }
+
+    // Number of bytes needed to store an index into a table of the given size
+    Uint8 IndexBytes(size_t tableSize)
+    {
+        return tableSize <= 256 ? 1 : 2;
+    }
+
+    // Find the given color's index in a palette being built, adding it if it
+    // isn't there yet
+    Uint32 PaletteIndex(ascii::Color color, map<Uint32, Uint32>& indices, vector<ascii::Color>& palette)
+    {
+        Uint32 key = color.r | (color.g << 8) | (color.b << 16)
+            | ((Uint32) color.isNone << 24) | ((Uint32) color.isIndexed << 25);
+
+        auto it = indices.find(key);
+        if (it != indices.end())
+        {
+            return it->second;
+        }
+
+        Uint32 index = palette.size();
+        indices[key] = index;
+        palette.push_back(color);
+        return index;
+    }
+}
+
+//static
+const Uint16 ascii::Surface::kNoSpecialInfo;
+
+ascii::Surface::Surface(int width, int height)
+	: mWidth(width), mHeight(height), 
+		mCharacters(width * height, ' '),
+		mBackgroundColors(width * height, Color::Black),
+		mCharacterColors(width * height, Color::White),
+		mCellOpacity(width * height, true),
+		mSpecialInfo(width * height, kNoSpecialInfo),
+		mSpecialInfoTable(1, ""), mSpecialInfoPoints(1),
+		mSpecialInfoIndexed(true),
+		mDamageStart(height, 0), mDamageEnd(height, width),
+		mDamaged(true)
+{
+    mSpecialInfoIds[""] = kNoSpecialInfo;
 }
 
 ascii::Surface::Surface(int width, int height, UChar character, Color backgroundColor, Color characterColor)
 	: mWidth(width), mHeight(height),
-		mCharacters(width, vector<UChar>(height, character)),
-		mBackgroundColors(width, vector<Color>(height, backgroundColor)),
-		mCharacterColors(width, vector<Color>(height, characterColor)),
-		mSpecialInfo(width, vector<string>(height, ""))
+		mCharacters(width * height, character),
+		mBackgroundColors(width * height, backgroundColor),
+		mCharacterColors(width * height, characterColor),
+		mCellOpacity(width * height, true),
+		mSpecialInfo(width * height, kNoSpecialInfo),
+		mSpecialInfoTable(1, ""), mSpecialInfoPoints(1),
+		mSpecialInfoIndexed(true),
+		mDamageStart(height, 0), mDamageEnd(height, width),
+		mDamaged(true)
 {
-	for (int x = 0; x < width; ++x)
-	{
-		mCellOpacity.push_back(new bool[height]);
-
-        for (int y = 0; y < height; ++y)
-        {
-            mCellOpacity.back()[y] = true;
-        }
-	}
+    mSpecialInfoIds[""] = kNoSpecialInfo;
 }
 
 ascii::Surface::Surface(UChar character, Color backgroundColor, Color characterColor)
 	: mWidth(1), mHeight(1),
-		mCharacters(1, vector<UChar>(1, character)),
-		mBackgroundColors(1, vector<Color>(1, backgroundColor)),
-		mCharacterColors(1, vector<Color>(1, characterColor)),
-		mSpecialInfo(1, vector<string>(1, ""))
+		mCharacters(1, character),
+		mBackgroundColors(1, backgroundColor),
+		mCharacterColors(1, characterColor),
+		mCellOpacity(1, true),
+		mSpecialInfo(1, kNoSpecialInfo),
+		mSpecialInfoTable(1, ""), mSpecialInfoPoints(1),
+		mSpecialInfoIndexed(true),
+		mDamageStart(1, 0), mDamageEnd(1, 1),
+		mDamaged(true)
 {
-	mCellOpacity.push_back(new bool[1]);
-    mCellOpacity[0][0] = true;
+    mSpecialInfoIds[""] = kNoSpecialInfo;
 }
 
-ascii::Surface* ascii::Surface::FromFile(const char* filepath)
+ascii::Surface* ascii::Surface::FromFile(const char* filepath, Palette* palette)
 {
     FileReader file(filepath);
 
@@ -98,6 +270,12 @@ ascii::Surface* ascii::Surface::FromFile(const char* filepath)
         int bval = atoi(blue.c_str());
 
 		colors[symbol[0]] = Color(rval, gval, bval);
+
+        // Palette entries follow the order of the file's colors
+        if (palette)
+        {
+            colors[symbol[0]] = Color::Indexed(palette->add(colors[symbol[0]]));
+        }
 		
         str = file.NextLine();
 	} while (str.compare("INFO CODES")); //do-while loop used because COLORS will never be empty section
@@ -210,29 +388,344 @@ ascii::Surface* ascii::Surface::FromFile(const char* filepath)
 
 	file.NextLine(); //SPECIAL INFO
 
+    // Intern every info code up front, then index the cells using them all
+    // at once when the section has been read
+    map<char, Uint16> infoIds;
+    for (auto it = infoCodes.begin(); it != infoCodes.end(); ++it)
+    {
+        infoIds[it->first] = surface->internSpecialInfo(it->second);
+    }
+    surface->mSpecialInfoIndexed = false;
+
 	for (int r = 0; r < surface->height(); ++r) //for loop used because this section will have fixed size
 	{
         str = file.NextLine();
 
+        Uint16* specialInfo = surface->specialInfoRow(r);
+
 		int c = 0;
-		for (string::iterator it = str.begin(); it != str.end(); ++it)
+		for (string::iterator it = str.begin(); it != str.end() && c < surface->width(); ++it)
 		{
 			codesymbol = *it;
 
 			if (codesymbol != ' ')
 			{
-                string specialInfo = infoCodes[codesymbol];
-
-				surface->setSpecialInfo(c, r, specialInfo);
+				specialInfo[c] = infoIds[codesymbol];
 			}
 
 			++c;
 		}
 	}
 
+    surface->buildSpecialInfoIndex();
+
 	return surface;
 }
 
+ascii::Surface* ascii::Surface::FromBinaryFile(const char* filepath, Palette* palette)
+{
+    VirtualFile file(filepath);
+
+    if (!file.isOpen())
+    {
+        Log::Error(string("Tried to open nonexistent binary surface: ") + filepath);
+        return NULL;
+    }
+
+    BinaryReader reader(file.data(), file.size());
+
+    // HEADER
+    const Uint8* magic = reader.take(4);
+    if (!magic || memcmp(magic, kBinaryMagic, 4) != 0)
+    {
+        Log::Error(string("File is not a binary surface: ") + filepath);
+        return NULL;
+    }
+
+    Uint16 version = reader.read16();
+    Uint8 colorBytes = reader.read8();
+    Uint8 infoBytes = reader.read8();
+    Uint32 width = reader.read32();
+    Uint32 height = reader.read32();
+    Uint32 paletteSize = reader.read32();
+    Uint32 infoCount = reader.read32();
+    Uint32 infoDataSize = reader.read32();
+    reader.read32(); // reserved
+
+    if (version != kBinaryVersion)
+    {
+        Log::Error(string("Binary surface was compiled for a different version of the format: ") + filepath);
+        return NULL;
+    }
+
+    if (reader.failed || width == 0 || height == 0
+        || width > kMaxBinaryDimension || height > kMaxBinaryDimension
+        || paletteSize == 0 || colorBytes != IndexBytes(paletteSize)
+        || infoCount == 0 || infoBytes != IndexBytes(infoCount)
+        || paletteSize > 65536 || infoCount > kMaxSpecialInfoStrings)
+    {
+        Log::Error(string("Binary surface has a malformed header: ") + filepath);
+        return NULL;
+    }
+
+    size_t cells = (size_t) width * height;
+
+    // Find every block before touching any of them, so a truncated file is
+    // caught up front
+    const Uint8* paletteEntries = reader.take(paletteSize * 4);
+    const Uint8* characters = reader.take(cells * 2);
+    const Uint8* backgroundColors = reader.take(cells * colorBytes);
+    const Uint8* characterColors = reader.take(cells * colorBytes);
+    const Uint8* opacity = reader.take(cells);
+    const Uint8* specialInfo = reader.take(cells * infoBytes);
+    const Uint8* infoOffsets = reader.take((infoCount + 1) * 4);
+    const Uint8* infoData = reader.take(infoDataSize);
+
+    if (reader.failed)
+    {
+        Log::Error(string("Binary surface is truncated: ") + filepath);
+        return NULL;
+    }
+
+    vector<Color> colors(paletteSize);
+    for (Uint32 i = 0; i < paletteSize; ++i)
+    {
+        const Uint8* entry = paletteEntries + i * 4;
+
+        if (entry[3] & kPaletteNone)
+        {
+            colors[i] = Color::None;
+        }
+        else if (entry[3] & kPaletteIndexed)
+        {
+            colors[i] = Color::Indexed(entry[0]);
+        }
+        else
+        {
+            colors[i] = Color(entry[0], entry[1], entry[2]);
+
+            if (palette)
+            {
+                colors[i] = Color::Indexed(palette->add(colors[i]));
+            }
+        }
+    }
+
+    Surface* surface = new Surface(width, height);
+
+    // Characters and opacity are stored exactly as the surface holds them
+    memcpy(surface->mCharacters.data(), characters, cells * 2);
+    memcpy(surface->mCellOpacity.data(), opacity, cells);
+
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+    for (size_t i = 0; i < cells; ++i)
+    {
+        surface->mCharacters[i] = SDL_SwapLE16(surface->mCharacters[i]);
+    }
+#endif
+
+    // Colors are expanded from the palette, and IDs are widened
+    for (size_t i = 0; i < cells; ++i)
+    {
+        Uint32 background = ReadIndex(backgroundColors, i, colorBytes);
+        Uint32 character = ReadIndex(characterColors, i, colorBytes);
+        Uint32 info = ReadIndex(specialInfo, i, infoBytes);
+
+        if (background >= paletteSize || character >= paletteSize || info >= infoCount)
+        {
+            Log::Error(string("Binary surface refers past the end of its palette or special info: ") + filepath);
+            delete surface;
+            return NULL;
+        }
+
+        surface->mBackgroundColors[i] = colors[background];
+        surface->mCharacterColors[i] = colors[character];
+        surface->mSpecialInfo[i] = info;
+    }
+
+    // SPECIAL INFO TABLE
+    surface->mSpecialInfoTable.resize(infoCount);
+    surface->mSpecialInfoIds.clear();
+
+    for (Uint32 i = 0; i < infoCount; ++i)
+    {
+        Uint32 start = ReadLE32(infoOffsets + i * 4);
+        Uint32 end = ReadLE32(infoOffsets + (i + 1) * 4);
+
+        if (start > end || end > infoDataSize || (i == kNoSpecialInfo && start != end))
+        {
+            Log::Error(string("Binary surface has a malformed special info table: ") + filepath);
+            delete surface;
+            return NULL;
+        }
+
+        string value((const char*) infoData + start, end - start);
+        surface->mSpecialInfoTable[i] = value;
+
+        if (surface->mSpecialInfoIds.find(value) == surface->mSpecialInfoIds.end())
+        {
+            surface->mSpecialInfoIds[value] = i;
+        }
+    }
+
+    surface->mSpecialInfoIndexed = false;
+    surface->buildSpecialInfoIndex();
+
+    return surface;
+}
+
+bool ascii::Surface::saveBinaryFile(const char* filepath)
+{
+    size_t cells = (size_t) mWidth * mHeight;
+
+    // Build a palette of the colors actually in use
+    map<Uint32, Uint32> paletteIndices;
+    vector<Color> palette;
+    vector<Uint32> backgroundIndices(cells);
+    vector<Uint32> characterIndices(cells);
+
+    for (size_t i = 0; i < cells; ++i)
+    {
+        backgroundIndices[i] = PaletteIndex(mBackgroundColors[i], paletteIndices, palette);
+        characterIndices[i] = PaletteIndex(mCharacterColors[i], paletteIndices, palette);
+    }
+
+    if (palette.size() > 65536)
+    {
+        Log::Error(string("Surface has too many colors to store in a binary file: ") + filepath);
+        return false;
+    }
+
+    Uint8 colorBytes = IndexBytes(palette.size());
+    Uint8 infoBytes = IndexBytes(mSpecialInfoTable.size());
+
+    string infoData;
+    for (size_t i = 0; i < mSpecialInfoTable.size(); ++i)
+    {
+        infoData += mSpecialInfoTable[i];
+    }
+
+    BinaryWriter writer;
+
+    // HEADER
+    writer.write(kBinaryMagic, 4);
+    writer.write16(kBinaryVersion);
+    writer.write8(colorBytes);
+    writer.write8(infoBytes);
+    writer.write32(mWidth);
+    writer.write32(mHeight);
+    writer.write32(palette.size());
+    writer.write32(mSpecialInfoTable.size());
+    writer.write32(infoData.size());
+    writer.write32(0); // reserved
+
+    // PALETTE
+    for (size_t i = 0; i < palette.size(); ++i)
+    {
+        Uint8 flags = (palette[i].isNone ? kPaletteNone : 0) | (palette[i].isIndexed ? kPaletteIndexed : 0);
+        Uint8 entry[4] = { palette[i].r, palette[i].g, palette[i].b, flags };
+        writer.write(entry, 4);
+    }
+
+    // CHANNELS
+    for (size_t i = 0; i < cells; ++i)
+    {
+        writer.write16(mCharacters[i]);
+    }
+    for (size_t i = 0; i < cells; ++i)
+    {
+        writer.writeIndex(backgroundIndices[i], colorBytes);
+    }
+    for (size_t i = 0; i < cells; ++i)
+    {
+        writer.writeIndex(characterIndices[i], colorBytes);
+    }
+    for (size_t i = 0; i < cells; ++i)
+    {
+        writer.write8(mCellOpacity[i] ? 1 : 0);
+    }
+    for (size_t i = 0; i < cells; ++i)
+    {
+        writer.writeIndex(mSpecialInfo[i], infoBytes);
+    }
+
+    // SPECIAL INFO TABLE
+    Uint32 offset = 0;
+    for (size_t i = 0; i < mSpecialInfoTable.size(); ++i)
+    {
+        writer.write32(offset);
+        offset += mSpecialInfoTable[i].size();
+    }
+    writer.write32(offset);
+    writer.write(infoData.data(), infoData.size());
+
+    FILE* file = fopen(filepath, "wb");
+    if (!file)
+    {
+        Log::Error(string("Binary surface could not be opened for writing: ") + filepath);
+        return false;
+    }
+
+    bool written = fwrite(writer.bytes.data(), 1, writer.bytes.size(), file) == writer.bytes.size();
+    written = fclose(file) == 0 && written;
+
+    if (!written)
+    {
+        Log::Error(string("Failed to write binary surface: ") + filepath);
+    }
+
+    return written;
+}
+
+string ascii::Surface::BinaryPath(string filepath)
+{
+    // Replace the extension, if the file name has one
+    size_t dotIndex = filepath.find_last_of('.');
+    size_t slashIndex = filepath.find_last_of("/\\");
+
+    if (dotIndex != string::npos && (slashIndex == string::npos || dotIndex > slashIndex))
+    {
+        filepath = filepath.substr(0, dotIndex);
+    }
+
+    return filepath + ".surfb";
+}
+
+void ascii::Surface::indexColors(Palette* palette)
+{
+    vector<Color>* channels[2] = { &mBackgroundColors, &mCharacterColors };
+
+    // Neighboring cells usually share a color, so remember the last one
+    // instead of searching the palette for every cell
+    Color lastColor = Color::None;
+    Color lastIndexed = Color::None;
+
+    for (int channel = 0; channel < 2; ++channel)
+    {
+        vector<Color>& colors = *channels[channel];
+
+        for (size_t i = 0; i < colors.size(); ++i)
+        {
+            Color color = colors[i];
+
+            if (color.isNone || color.isIndexed)
+            {
+                continue;
+            }
+
+            if (!(color == lastColor) || lastColor.isNone)
+            {
+                lastColor = color;
+                lastIndexed = Color::Indexed(palette->add(color));
+            }
+
+            colors[i] = lastIndexed;
+        }
+    }
+
+    markAllDamaged();
+}
+
 void ascii::Surface::clear()
 {
 	fill(' ', Color::Black, Color::White);
@@ -240,50 +733,48 @@ void ascii::Surface::clear()
 
 void ascii::Surface::clearTransparent()
 {
-	for (int x = 0; x < mWidth; ++x)
-	{
-		for (int y = 0; y < mHeight; ++y)
-		{
-			setCellOpacity(x, y, false);
-		}
-	}
+    std::fill(mCellOpacity.begin(), mCellOpacity.end(), false);
+    markAllDamaged();
 }
 
 void ascii::Surface::clearOpaque()
 {
-	for (int x = 0; x < mWidth; ++x)
-	{
-		for (int y = 0; y < mHeight; ++y)
-		{
-			setCellOpacity(x, y, true);
-		}
-	}
+    std::fill(mCellOpacity.begin(), mCellOpacity.end(), true);
+    markAllDamaged();
 }
 
 void ascii::Surface::fill(UChar character, Color backgroundColor, Color characterColor)
 {
-	for (int x = 0; x < mWidth; ++x)
-	{
-		for (int y = 0; y < mHeight; ++y)
-		{
-			setCharacter(x, y, character);
-			setBackgroundColor(x, y, backgroundColor);
-			setCharacterColor(x, y, characterColor);
-		}
-	}
+    // The buffer is contiguous, so the whole surface fills as one long row
+    int cells = mWidth * mHeight;
+    FillRow(mCharacters.data(), character, cells);
+    FillRow(mBackgroundColors.data(), backgroundColor, cells);
+    FillRow(mCharacterColors.data(), characterColor, cells);
+
+    markAllDamaged();
 }
 
 void ascii::Surface::fillRect(Rectangle destination, UChar character, Color backgroundColor, Color characterColor)
 {
-	for (int x = destination.left(); x < destination.right(); ++x)
+    // Clip the rectangle to the surface once, then fill it row by row
+    int left = max(destination.left(), 0);
+    int right = min(destination.right(), mWidth);
+    int top = max(destination.top(), 0);
+    int bottom = min(destination.bottom(), mHeight);
+
+    if (left >= right)
+    {
+        return;
+    }
+
+	for (int y = top; y < bottom; ++y)
 	{
-		for (int y = destination.top(); y < destination.bottom(); ++y)
-		{
-			setCharacter(x, y, character);
-			setBackgroundColor(x, y, backgroundColor);
-			setCharacterColor(x, y, characterColor);
-		}
+        FillRow(characterRow(y) + left, character, right - left);
+        FillRow(backgroundColorRow(y) + left, backgroundColor, right - left);
+        FillRow(characterColorRow(y) + left, characterColor, right - left);
 	}
+
+    markDamaged(Rectangle(left, top, right - left, bottom - top));
 }
 
 void ascii::Surface::drawBorder(UChar character, Color backgroundColor, Color characterColor)
@@ -354,109 +845,250 @@ void ascii::Surface::drawRect(Rectangle destination, UChar character, Color back
 
 void ascii::Surface::copySurface(Surface* surface, int x, int y)
 {
-	//copy cell info from the other surface
-	for (int destx = x, srcx = 0; destx < mWidth && srcx < surface->mWidth; ++destx, ++srcx)
-	{
-		for (int desty = y, srcy = 0; desty < mHeight && srcy < surface->mHeight; ++desty, ++srcy)
-		{
-			if (destx >= 0 && desty >= 0)
-			{
-				mCharacters[destx][desty] = surface->mCharacters[srcx][srcy];
-				mBackgroundColors[destx][desty] = surface->mBackgroundColors[srcx][srcy];
-				mCharacterColors[destx][desty] = surface->mCharacterColors[srcx][srcy];
-				mSpecialInfo[destx][desty] = surface->mSpecialInfo[srcx][srcy];
-				mCellOpacity[destx][desty] = surface->mCellOpacity[srcx][srcy];
-			}
-		}
-	}
+    copyRegion(surface, Rectangle(0, 0, surface->mWidth, surface->mHeight), x, y, false);
 }
 
 void ascii::Surface::copySurface(Surface* surface, Rectangle source, int x, int y)
 {
-	//copy cell info from the other surface
-	for (int destx = x, srcx = source.x; destx < mWidth && srcx < source.right(); ++destx, ++srcx)
-	{
-		for (int desty = y, srcy = source.y; desty < mHeight && srcy < source.bottom(); ++desty, ++srcy)
-		{
-			if (destx >= 0 && desty >= 0)
-			{
-				mCharacters[destx][desty] = surface->mCharacters[srcx][srcy];
-				mBackgroundColors[destx][desty] = surface->mBackgroundColors[srcx][srcy];
-				mCharacterColors[destx][desty] = surface->mCharacterColors[srcx][srcy];
-				mSpecialInfo[destx][desty] = surface->mSpecialInfo[srcx][srcy];
-				mCellOpacity[destx][desty] = surface->mCellOpacity[srcx][srcy];
-			}
-		}
-	}
+    copyRegion(surface, source, x, y, false);
 }
 
 void ascii::Surface::blitSurface(Surface* surface, int x, int y)
 {
-	//blit the opaque cells from the other surface
-	for (int destx = x, srcx = 0; destx < mWidth && srcx < surface->mWidth; ++destx, ++srcx)
-	{
-		for (int desty = y, srcy = 0; desty < mHeight && srcy < surface->mHeight; ++desty, ++srcy)
-		{
-			if (destx >= 0 && desty >= 0 && surface->isCellOpaque(srcx, srcy))
-			{
-				mCharacters[destx][desty] = surface->mCharacters[srcx][srcy];
-				mBackgroundColors[destx][desty] = surface->mBackgroundColors[srcx][srcy];
-				mCharacterColors[destx][desty] = surface->mCharacterColors[srcx][srcy];
-				mSpecialInfo[destx][desty] = surface->mSpecialInfo[srcx][srcy];
-
-				mCellOpacity[destx][desty] = true; //Cover transparent cells in the lower surface with opaque ones
-			}
-		}
-	}
+    copyRegion(surface, Rectangle(0, 0, surface->mWidth, surface->mHeight), x, y, true);
 }
 
 void ascii::Surface::blitSurface(Surface* surface, Rectangle source, int x, int y)
 {
-	//blit the opaque cells from the other surface
-	for (int destx = x, srcx = source.x; destx < mWidth && srcx < source.right(); ++destx, ++srcx)
-	{
-		for (int desty = y, srcy = source.y; desty < mHeight && srcy < source.bottom(); ++desty, ++srcy)
-		{
-			if (destx >= 0 && desty >= 0 && surface->isCellOpaque(srcx, srcy))
-			{
-				mCharacters[destx][desty] = surface->mCharacters[srcx][srcy];
-				mBackgroundColors[destx][desty] = surface->mBackgroundColors[srcx][srcy];
-				mCharacterColors[destx][desty] = surface->mCharacterColors[srcx][srcy];
-				mSpecialInfo[destx][desty] = surface->mSpecialInfo[srcx][srcy];
+    copyRegion(surface, source, x, y, true);
+}
 
-				mCellOpacity[destx][desty] = true; //Cover transparent cells in the lower surface with opaque ones
-			}
-		}
-	}
+void ascii::Surface::copyRegion(Surface* surface, Rectangle source, int x, int y, bool masked)
+{
+    // Clip the source rectangle to the source surface, moving the
+    // destination along with it
+    if (source.x < 0)
+    {
+        x -= source.x;
+        source.width += source.x;
+        source.x = 0;
+    }
+    if (source.y < 0)
+    {
+        y -= source.y;
+        source.height += source.y;
+        source.y = 0;
+    }
+    source.width = min(source.width, surface->mWidth - source.x);
+    source.height = min(source.height, surface->mHeight - source.y);
+
+    // Then clip it against this surface
+    int skipX = max(0, -x);
+    int skipY = max(0, -y);
+    int cols = min(source.width, mWidth - x) - skipX;
+    int rows = min(source.height, mHeight - y) - skipY;
+
+    if (cols <= 0 || rows <= 0)
+    {
+        return;
+    }
+
+    int srcX = source.x + skipX;
+    int destX = x + skipX;
+
+    markDamaged(Rectangle(destX, y + skipY, cols, rows));
+
+    // Special info only needs touching if either surface has any. Source IDs
+    // are translated into this surface's table as they are encountered
+    bool sourceHasInfo = surface->mSpecialInfoTable.size() > 1;
+    bool copyInfo = sourceHasInfo || mSpecialInfoTable.size() > 1;
+    vector<int> infoMap(surface->mSpecialInfoTable.size(), -1);
+    infoMap[kNoSpecialInfo] = kNoSpecialInfo;
+    bool infoChanged = false;
+
+    for (int r = 0; r < rows; ++r)
+    {
+        int srcY = source.y + skipY + r;
+        int destY = y + skipY + r;
+
+        UChar* srcCharacters = surface->characterRow(srcY) + srcX;
+        Color* srcBackgroundColors = surface->backgroundColorRow(srcY) + srcX;
+        Color* srcCharacterColors = surface->characterColorRow(srcY) + srcX;
+        Uint8* srcOpacity = surface->opacityRow(srcY) + srcX;
+        Uint16* srcSpecialInfo = surface->specialInfoRow(srcY) + srcX;
+
+        UChar* destCharacters = characterRow(destY) + destX;
+        Color* destBackgroundColors = backgroundColorRow(destY) + destX;
+        Color* destCharacterColors = characterColorRow(destY) + destX;
+        Uint8* destOpacity = opacityRow(destY) + destX;
+        Uint16* destSpecialInfo = specialInfoRow(destY) + destX;
+
+        if (copyInfo)
+        {
+            for (int c = 0; c < cols; ++c)
+            {
+                if (masked && !srcOpacity[c])
+                {
+                    continue;
+                }
+
+                Uint16 id = srcSpecialInfo[c];
+                if (infoMap[id] < 0)
+                {
+                    infoMap[id] = internSpecialInfo(surface->mSpecialInfoTable[id]);
+                }
+
+                if (destSpecialInfo[c] != infoMap[id])
+                {
+                    destSpecialInfo[c] = infoMap[id];
+                    infoChanged = true;
+                }
+            }
+        }
+
+        if (!masked)
+        {
+            copy(srcCharacters, srcCharacters + cols, destCharacters);
+            copy(srcBackgroundColors, srcBackgroundColors + cols, destBackgroundColors);
+            copy(srcCharacterColors, srcCharacterColors + cols, destCharacterColors);
+            copy(srcOpacity, srcOpacity + cols, destOpacity);
+            continue;
+        }
+
+        //blit the opaque cells from the other surface, using the source
+        //opacity as a mask across the whole row
+        BlendRow(destCharacters, srcCharacters, srcOpacity, cols);
+        BlendRow(destBackgroundColors, srcBackgroundColors, srcOpacity, cols);
+        BlendRow(destCharacterColors, srcCharacterColors, srcOpacity, cols);
+
+        //Cover transparent cells in the lower surface with opaque ones
+        MergeOpacityRow(destOpacity, srcOpacity, cols);
+    }
+
+    // Bulk changes to special info are reindexed lazily, on the next lookup
+    if (infoChanged)
+    {
+        mSpecialInfoIndexed = false;
+    }
 }
 
 void ascii::Surface::transposeSpecialInfo(Surface* surface, int x, int y)
 {
 	// everywhere where special info exists on the other surface, add it to
 	// this one
-	for (int destx = x, srcx = 0; destx < mWidth && srcx < surface->mWidth; ++destx, ++srcx)
+	for (int desty = y, srcy = 0; desty < mHeight && srcy < surface->mHeight; ++desty, ++srcy)
 	{
-		for (int desty = y, srcy = 0; desty < mHeight && srcy < surface->mHeight; ++desty, ++srcy)
+		for (int destx = x, srcx = 0; destx < mWidth && srcx < surface->mWidth; ++destx, ++srcx)
 		{
-			if (destx >= 0 && desty >= 0 && !surface->mSpecialInfo[srcx][srcy].empty())
+            Uint16 id = surface->mSpecialInfo[surface->cellIndex(srcx, srcy)];
+
+			if (destx >= 0 && desty >= 0 && id != kNoSpecialInfo)
 			{
-				mSpecialInfo[destx][desty] = surface->mSpecialInfo[srcx][srcy];
+				setSpecialInfo(destx, desty, surface->mSpecialInfoTable[id]);
 			}
 		}
 	}
 }
 
+void ascii::Surface::setSpecialInfo(int x, int y, string value)
+{
+    Uint16 id = internSpecialInfo(value);
+    Uint16& cell = mSpecialInfo[cellIndex(x, y)];
+
+    if (cell == id)
+    {
+        return;
+    }
+
+    // Keep the index up to date by moving the cell from its old ID's list of
+    // points to the new one's
+    if (mSpecialInfoIndexed)
+    {
+        Point point(x, y);
+
+        if (cell != kNoSpecialInfo)
+        {
+            vector<Point>& oldPoints = mSpecialInfoPoints[cell];
+            auto it = lower_bound(oldPoints.begin(), oldPoints.end(), point, ColumnMajorLess);
+            oldPoints.erase(it);
+        }
+
+        if (id != kNoSpecialInfo)
+        {
+            vector<Point>& newPoints = mSpecialInfoPoints[id];
+            newPoints.insert(lower_bound(newPoints.begin(), newPoints.end(), point, ColumnMajorLess), point);
+        }
+    }
+
+    cell = id;
+}
+
+Uint16 ascii::Surface::internSpecialInfo(string value)
+{
+    auto it = mSpecialInfoIds.find(value);
+
+    if (it != mSpecialInfoIds.end())
+    {
+        return it->second;
+    }
+
+    if (mSpecialInfoTable.size() >= kMaxSpecialInfoStrings)
+    {
+        Log::Error("Surface has too many unique special info strings to store: " + value);
+        return kNoSpecialInfo;
+    }
+
+    Uint16 id = mSpecialInfoTable.size();
+    mSpecialInfoTable.push_back(value);
+    mSpecialInfoPoints.push_back(vector<Point>());
+    mSpecialInfoIds[value] = id;
+
+    return id;
+}
+
+void ascii::Surface::buildSpecialInfoIndex()
+{
+    if (mSpecialInfoIndexed)
+    {
+        return;
+    }
+
+    mSpecialInfoPoints.assign(mSpecialInfoTable.size(), vector<Point>());
+
+    for (int y = 0; y < mHeight; ++y)
+    {
+        Uint16* specialInfo = specialInfoRow(y);
+
+        for (int x = 0; x < mWidth; ++x)
+        {
+            if (specialInfo[x] != kNoSpecialInfo)
+            {
+                mSpecialInfoPoints[specialInfo[x]].push_back(Point(x, y));
+            }
+        }
+    }
+
+    // The buffer is walked row by row for locality, so sort each list into
+    // column-major order afterwards
+    for (size_t i = 0; i < mSpecialInfoPoints.size(); ++i)
+    {
+        sort(mSpecialInfoPoints[i].begin(), mSpecialInfoPoints[i].end(), ColumnMajorLess);
+    }
+
+    mSpecialInfoIndexed = true;
+}
+
 void ascii::Surface::applyMask(Surface* surface, int x, int y)
 {
 	// Set cells on this surface opaque if an opaque cell from the given
     // surface would cover them
-	for (int destx = x, srcx = 0; destx < mWidth && srcx < surface->width(); ++destx, ++srcx)
+	for (int desty = y, srcy = 0; desty < mHeight && srcy < surface->height(); ++desty, ++srcy)
 	{
-		for (int desty = y, srcy = 0; desty < mHeight && srcy < surface->height(); ++desty, ++srcy)
+		for (int destx = x, srcx = 0; destx < mWidth && srcx < surface->width(); ++destx, ++srcx)
 		{
 			if (destx >= 0 && desty >= 0 && surface->isCellOpaque(srcx, srcy))
 			{
-				mCellOpacity[destx][desty] = true;
+				setCellOpacity(destx, desty, true);
 			}
 		}
 	}
@@ -588,16 +1220,16 @@ ascii::Point ascii::Surface::findCharacter(UChar character, Point searchStart)
     // start
     for (int y = searchStart.y; y < height(); ++y)
     {
-        for (int x = searchStart.x; x < width(); ++x)
-        {
-            // Only begin the x-wise search at that starting coordinate for the
-            // first row checked!
-            searchStart.x = 0;
+        UChar* row = characterRow(y);
+        UChar* match = find(row + searchStart.x, row + width(), character);
 
-            if (mCharacters[x][y] == character)
-            {
-                return Point(x, y);
-            }
+        // Only begin the x-wise search at that starting coordinate for the
+        // first row checked!
+        searchStart.x = 0;
+
+        if (match != row + width())
+        {
+            return Point(match - row, y);
         }
     }
 
@@ -720,39 +1352,40 @@ void ascii::Surface::highlightAllTokens(UnicodeString text, ascii::Color color)
 
 vector<ascii::Point> ascii::Surface::getSpecialPoints(string key)
 {
-    vector<Point> correspondingPoints;
+    buildSpecialInfoIndex();
 
     // Find the cells that correspond to the given special key
-    for (int x = 0; x < width(); ++x)
+    auto it = mSpecialInfoIds.find("POINT_" + key);
+
+    if (it == mSpecialInfoIds.end())
     {
-        for (int y = 0; y < height(); ++y)
-        {
-            string specialInfo = mSpecialInfo[x][y];
-            
-            if (specialInfo.compare(""))
-                Log::Print(specialInfo);
-            
-            if (!specialInfo.compare("POINT_" + key))
-            {
-                Log::Print("Found a point! " + key);
-                correspondingPoints.push_back(Point(x, y));
-            }
-        }
+        return vector<Point>();
     }
 
-    return correspondingPoints;
+    return mSpecialInfoPoints[it->second];
 }
 
 void ascii::Surface::removeSpecialRectangle(string key)
 {
-    vector<Point> correspondingPoints = getSpecialPoints(key);
+    buildSpecialInfoIndex();
+
+    auto it = mSpecialInfoIds.find("POINT_" + key);
+
+    if (it == mSpecialInfoIds.end())
+    {
+        return;
+    }
+
+    vector<Point>& correspondingPoints = mSpecialInfoPoints[it->second];
 
     for (int i = 0; i < correspondingPoints.size(); ++i)
     {
         Point point = correspondingPoints[i];
 
-        mSpecialInfo[point.x][point.y] = "";
+        mSpecialInfo[cellIndex(point.x, point.y)] = kNoSpecialInfo;
     }
+
+    correspondingPoints.clear();
 }
 
 ascii::Rectangle ascii::Surface::getSpecialRectangle(string key)
@@ -787,24 +1420,23 @@ ascii::Rectangle ascii::Surface::getSpecialRectangle(string key)
 
 map<string, ascii::Rectangle> ascii::Surface::getSpecialRectangles()
 {
+    buildSpecialInfoIndex();
+
     map<string, Rectangle> specialRectangles;
-    for (int x = 0; x < width(); ++x)
+    for (Uint16 id = 1; id < mSpecialInfoTable.size(); ++id)
     {
-        for (int y = 0; y < height(); ++y)
+        string specialInfo = mSpecialInfoTable[id];
+
+        if (specialInfo.size() > 6 && !mSpecialInfoPoints[id].empty())
         {
-            string specialInfo = mSpecialInfo[x][y];
+            string prefix = specialInfo.substr(0, 6);
 
-            if (specialInfo.size() > 6)
+            if (!prefix.compare("POINT_"))
             {
-                string prefix = specialInfo.substr(0, 6);
+                string key = specialInfo.substr(6);
 
-                if (!prefix.compare("POINT_"))
-                {
-                    string key = specialInfo.substr(6);
-
-                    Rectangle specialRectangle = getSpecialRectangle(key);
-                    specialRectangles[key] = specialRectangle;
-                }
+                Rectangle specialRectangle = getSpecialRectangle(key);
+                specialRectangles[key] = specialRectangle;
             }
         }
     }
@@ -816,12 +1448,81 @@ ascii::Point ascii::Surface::getSpecialPoint(string key)
 {
     vector<Point> correspondingPoints = getSpecialPoints(key);
 
-    Log::Print("Matching points: ", false);
-    Log::Print(correspondingPoints.size());
-    
+    if (correspondingPoints.empty())
+    {
+        Log::Error("Tried to retrieve nonexistent special point: " + key);
+        return Point::Undefined;
+    }
+
     return correspondingPoints[0];
 }
 
+void ascii::Surface::markDamaged(Rectangle cells)
+{
+    int left = max(cells.left(), 0);
+    int right = min(cells.right(), mWidth);
+    int top = max(cells.top(), 0);
+    int bottom = min(cells.bottom(), mHeight);
+
+    if (left >= right || top >= bottom)
+    {
+        return;
+    }
+
+    for (int y = top; y < bottom; ++y)
+    {
+        mDamageStart[y] = min(mDamageStart[y], left);
+        mDamageEnd[y] = max(mDamageEnd[y], right);
+    }
+
+    mDamaged = true;
+}
+
+void ascii::Surface::markAllDamaged()
+{
+    std::fill(mDamageStart.begin(), mDamageStart.end(), 0);
+    std::fill(mDamageEnd.begin(), mDamageEnd.end(), mWidth);
+    mDamaged = true;
+}
+
+bool ascii::Surface::getDamagedSpan(int y, int* outStartX, int* outEndX)
+{
+    *outStartX = mDamageStart[y];
+    *outEndX = mDamageEnd[y];
+
+    return mDamageStart[y] < mDamageEnd[y];
+}
+
+ascii::Rectangle ascii::Surface::damageBounds()
+{
+    int left = mWidth, right = 0, top = mHeight, bottom = 0;
+
+    for (int y = 0; y < mHeight; ++y)
+    {
+        if (mDamageStart[y] < mDamageEnd[y])
+        {
+            left = min(left, mDamageStart[y]);
+            right = max(right, mDamageEnd[y]);
+            top = min(top, y);
+            bottom = y + 1;
+        }
+    }
+
+    if (left >= right)
+    {
+        return Rectangle(0, 0, 0, 0);
+    }
+
+    return Rectangle(left, top, right - left, bottom - top);
+}
+
+void ascii::Surface::resetDamage()
+{
+    std::fill(mDamageStart.begin(), mDamageStart.end(), mWidth);
+    std::fill(mDamageEnd.begin(), mDamageEnd.end(), 0);
+    mDamaged = false;
+}
+
 void ascii::Surface::printContents()
 {
     Log::Print("Number of special rectangles: ", false);
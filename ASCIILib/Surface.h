@@ -15,6 +15,7 @@ using namespace icu;
 #include "Rectangle.h"
 #include "Point.h"
 #include "ImageCache.h"
+#include "Palette.h"
 
 namespace ascii
 {
@@ -43,22 +44,83 @@ namespace ascii
 			///<summary>
 			/// Loads a surface from a text file.
 			///</summary>
-			static Surface* FromFile(const char* filepath);
+			///<param name="palette">If given, the colors of the file are added to this palette and the surface uses indexed colors.</param>
+			static Surface* FromFile(const char* filepath, Palette* palette=NULL);
+
+			///<summary>
+			/// Loads a surface from a compiled binary (.surfb) file. Returns NULL if the file is missing or malformed.
+			///</summary>
+			///<param name="palette">If given, the colors of the file are added to this palette and the surface uses indexed colors.</param>
+			static Surface* FromBinaryFile(const char* filepath, Palette* palette=NULL);
+
+			///<summary>
+			/// Writes this surface to a compiled binary (.surfb) file.
+			///</summary>
+			bool saveBinaryFile(const char* filepath);
+
+			///<summary>
+			/// The path of the binary file compiled from the given surface text file.
+			///</summary>
+			static string BinaryPath(string filepath);
 
 			int width() { return mWidth; }
 			int height() { return mHeight; }
 
-			UChar getCharacter(int x, int y) { return mCharacters[x][y]; }
-			Color getBackgroundColor(int x, int y) { return mBackgroundColors[x][y]; }
-			Color getCharacterColor(int x, int y) { return mCharacterColors[x][y]; }
-			bool isCellOpaque(int x, int y) { return mCellOpacity[x][y]; }
-			string getSpecialInfo(int x, int y) { return mSpecialInfo[x][y]; }
-
-			void setCharacter(int x, int y, UChar value) { mCharacters[x][y] = value; }
-			void setBackgroundColor(int x, int y, Color value) { mBackgroundColors[x][y] = value; }
-			void setCharacterColor(int x, int y, Color value) { mCharacterColors[x][y] = value; }
-			void setCellOpacity(int x, int y, bool value) { mCellOpacity[x][y] = value; }
-			void setSpecialInfo(int x, int y, string value) { mSpecialInfo[x][y] = value; }
+			UChar getCharacter(int x, int y) { return mCharacters[cellIndex(x, y)]; }
+			Color getBackgroundColor(int x, int y) { return mBackgroundColors[cellIndex(x, y)]; }
+			Color getCharacterColor(int x, int y) { return mCharacterColors[cellIndex(x, y)]; }
+			bool isCellOpaque(int x, int y) { return mCellOpacity[cellIndex(x, y)] != 0; }
+			string getSpecialInfo(int x, int y) { return mSpecialInfoTable[mSpecialInfo[cellIndex(x, y)]]; }
+
+			void setCharacter(int x, int y, UChar value) { mCharacters[cellIndex(x, y)] = value; markDamaged(x, y); }
+			void setBackgroundColor(int x, int y, Color value) { mBackgroundColors[cellIndex(x, y)] = value; markDamaged(x, y); }
+			void setCharacterColor(int x, int y, Color value) { mCharacterColors[cellIndex(x, y)] = value; markDamaged(x, y); }
+			void setCellOpacity(int x, int y, bool value) { mCellOpacity[cellIndex(x, y)] = value; markDamaged(x, y); }
+			void setSpecialInfo(int x, int y, string value);
+
+            // Row spans: each returns a pointer to the first cell of row y in
+            // one channel of the buffer, followed by the rest of the row's
+            // width() cells. Writing through them does not mark damage
+            UChar* characterRow(int y) { return mCharacters.data() + y * mWidth; }
+            Color* backgroundColorRow(int y) { return mBackgroundColors.data() + y * mWidth; }
+            Color* characterColorRow(int y) { return mCharacterColors.data() + y * mWidth; }
+            Uint8* opacityRow(int y) { return mCellOpacity.data() + y * mWidth; }
+            Uint16* specialInfoRow(int y) { return mSpecialInfo.data() + y * mWidth; }
+
+            // Special info is stored per cell as an ID into a table of
+            // strings owned by the surface. ID 0 is always the empty string
+            static const Uint16 kNoSpecialInfo = 0;
+
+            // Retrieve the ID for the given special info string, adding it to
+            // this surface's table if necessary
+            Uint16 internSpecialInfo(string value);
+            // Retrieve the string stored in the table under the given ID
+            const string& specialInfoString(Uint16 id) { return mSpecialInfoTable[id]; }
+
+            // Damage: every call which changes how the surface looks marks
+            // the cells it touched as damaged, kept as one span of columns
+            // per row, until the damage is reset. Graphics uses this to
+            // redraw only the parts of the window which may have changed
+            void markDamaged(int x, int y)
+            {
+                if (x < mDamageStart[y]) mDamageStart[y] = x;
+                if (x >= mDamageEnd[y]) mDamageEnd[y] = x + 1;
+                mDamaged = true;
+            }
+            void markDamaged(Rectangle cells);
+            void markAllDamaged();
+
+            bool isDamaged() { return mDamaged; }
+            // Retrieve the damaged columns [outStartX, outEndX) of row y.
+            // Returns false if no cells in the row are damaged
+            bool getDamagedSpan(int y, int* outStartX, int* outEndX);
+            // Smallest rectangle containing all damaged cells
+            Rectangle damageBounds();
+            void resetDamage();
+
+            // Replace every color of the surface with an indexed color, adding
+            // the colors to the given palette as needed
+            void indexColors(Palette* palette);
 
 			///<summary>
 			/// Clears the surface of all characters and non-black colors.
@@ -215,17 +277,43 @@ namespace ascii
 
             vector<Point> getSpecialPoints(string key);
 
+            // Build the index from special info IDs to the cells which hold
+            // them, if it has been invalidated by a bulk change
+            void buildSpecialInfoIndex();
+
+            // Copy the cells of the given source rectangle of another surface
+            // onto this one at the given location, clipped to both surfaces.
+            // If masked, only opaque source cells are copied and they make
+            // the cells they cover opaque; otherwise opacity is copied too
+            void copyRegion(Surface* surface, Rectangle source, int x, int y, bool masked);
+
+            // Index of the cell (x, y) in every channel of the buffer
+            int cellIndex(int x, int y) { return y * mWidth + x; }
+
             // FIELDS
 			int mWidth, mHeight;
 
-            // Buffer
-			vector<vector<UChar> > mCharacters;
-			vector<vector<Color> > mBackgroundColors;
-			vector<vector<Color> > mCharacterColors;
-			vector<bool*> mCellOpacity;
-			vector<vector<string> > mSpecialInfo;
+            // Buffer, stored as one contiguous row-major array per channel
+			vector<UChar> mCharacters;
+			vector<Color> mBackgroundColors;
+			vector<Color> mCharacterColors;
+			vector<Uint8> mCellOpacity;
+			vector<Uint16> mSpecialInfo;
+
+            // Interned special info strings, and their IDs
+            vector<string> mSpecialInfoTable;
+            map<string, Uint16> mSpecialInfoIds;
+            // The cells holding each special info ID, in column-major order. Only
+            // trustworthy while mSpecialInfoIndexed is true
+            vector<vector<Point> > mSpecialInfoPoints;
+            bool mSpecialInfoIndexed;
             // Special rectangles
             map<string, Rectangle> mSpecialRectangles;
+
+            // Damaged columns [start, end) of each row
+            vector<int> mDamageStart;
+            vector<int> mDamageEnd;
+            bool mDamaged;
 	};
 
 }
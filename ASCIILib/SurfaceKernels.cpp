@@ -0,0 +1,321 @@
+#include "SurfaceKernels.h"
+
+#include <cstring>
+
+// SIMD kernels are only built for x86 targets. Everything else uses the
+// portable versions
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define ASCIILIB_X86_KERNELS
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+// GCC and Clang need to be told which functions may use instructions beyond
+// the baseline the library is compiled for. MSVC allows intrinsics anywhere
+#if defined(__GNUC__) || defined(__clang__)
+#define KERNEL_TARGET(isa) __attribute__((target(isa)))
+#else
+#define KERNEL_TARGET(isa)
+#endif
+
+using namespace ascii;
+
+
+namespace
+{
+    // Colors are composited as raw 32-bit values
+    static_assert(sizeof(Color) == 4, "Color must pack into 32 bits");
+    static_assert(sizeof(UChar) == 2, "UChar must be 16 bits");
+
+    // The kernels work on raw bytes, using memcpy for single cells so that
+    // they don't depend on how the cell types alias each other
+    struct KernelSet
+    {
+        const char* name;
+        void (*fill16)(void* dest, Uint16 value, int count);
+        void (*fill32)(void* dest, Uint32 value, int count);
+        void (*blend16)(void* dest, const void* src, const Uint8* mask, int count);
+        void (*blend32)(void* dest, const void* src, const Uint8* mask, int count);
+        void (*mergeOpacity)(Uint8* dest, const Uint8* src, int count);
+    };
+
+    // PORTABLE KERNELS
+
+    template<typename T> void ScalarFill(void* dest, T value, int count)
+    {
+        Uint8* d = (Uint8*) dest;
+        for (int i = 0; i < count; ++i)
+        {
+            memcpy(d + i * sizeof(T), &value, sizeof(T));
+        }
+    }
+
+    template<typename T> void ScalarBlend(void* dest, const void* src, const Uint8* mask, int count)
+    {
+        Uint8* d = (Uint8*) dest;
+        const Uint8* s = (const Uint8*) src;
+        for (int i = 0; i < count; ++i)
+        {
+            if (mask[i])
+            {
+                memcpy(d + i * sizeof(T), s + i * sizeof(T), sizeof(T));
+            }
+        }
+    }
+
+    void ScalarMergeOpacity(Uint8* dest, const Uint8* src, int count)
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            dest[i] |= src[i];
+        }
+    }
+
+    const KernelSet kScalarKernels = {
+        "scalar",
+        &ScalarFill<Uint16>,
+        &ScalarFill<Uint32>,
+        &ScalarBlend<Uint16>,
+        &ScalarBlend<Uint32>,
+        &ScalarMergeOpacity
+    };
+
+#ifdef ASCIILIB_X86_KERNELS
+
+    // SSE2 KERNELS
+
+    KERNEL_TARGET("sse2") void SSE2Fill16(void* dest, Uint16 value, int count)
+    {
+        Uint8* d = (Uint8*) dest;
+        __m128i v = _mm_set1_epi16((short) value);
+        int i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            _mm_storeu_si128((__m128i*) (d + i * 2), v);
+        }
+        ScalarFill<Uint16>(d + i * 2, value, count - i);
+    }
+
+    KERNEL_TARGET("sse2") void SSE2Fill32(void* dest, Uint32 value, int count)
+    {
+        Uint8* d = (Uint8*) dest;
+        __m128i v = _mm_set1_epi32((int) value);
+        int i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            _mm_storeu_si128((__m128i*) (d + i * 4), v);
+        }
+        ScalarFill<Uint32>(d + i * 4, value, count - i);
+    }
+
+    KERNEL_TARGET("sse2") void SSE2Blend16(void* dest, const void* src, const Uint8* mask, int count)
+    {
+        Uint8* d = (Uint8*) dest;
+        const Uint8* s = (const Uint8*) src;
+        __m128i zero = _mm_setzero_si128();
+        int i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            // Widen 8 mask bytes into 8 lanes which are all ones wherever the
+            // source cell is transparent
+            __m128i m = _mm_loadl_epi64((const __m128i*) (mask + i));
+            __m128i keep = _mm_cmpeq_epi8(m, zero);
+            keep = _mm_unpacklo_epi8(keep, keep);
+
+            __m128i sv = _mm_loadu_si128((const __m128i*) (s + i * 2));
+            __m128i dv = _mm_loadu_si128((const __m128i*) (d + i * 2));
+            __m128i result = _mm_or_si128(_mm_and_si128(keep, dv), _mm_andnot_si128(keep, sv));
+            _mm_storeu_si128((__m128i*) (d + i * 2), result);
+        }
+        ScalarBlend<Uint16>(d + i * 2, s + i * 2, mask + i, count - i);
+    }
+
+    KERNEL_TARGET("sse2") void SSE2Blend32(void* dest, const void* src, const Uint8* mask, int count)
+    {
+        Uint8* d = (Uint8*) dest;
+        const Uint8* s = (const Uint8*) src;
+        __m128i zero = _mm_setzero_si128();
+        int i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            int maskBytes;
+            memcpy(&maskBytes, mask + i, 4);
+
+            __m128i keep = _mm_cmpeq_epi8(_mm_cvtsi32_si128(maskBytes), zero);
+            keep = _mm_unpacklo_epi8(keep, keep);
+            keep = _mm_unpacklo_epi16(keep, keep);
+
+            __m128i sv = _mm_loadu_si128((const __m128i*) (s + i * 4));
+            __m128i dv = _mm_loadu_si128((const __m128i*) (d + i * 4));
+            __m128i result = _mm_or_si128(_mm_and_si128(keep, dv), _mm_andnot_si128(keep, sv));
+            _mm_storeu_si128((__m128i*) (d + i * 4), result);
+        }
+        ScalarBlend<Uint32>(d + i * 4, s + i * 4, mask + i, count - i);
+    }
+
+    KERNEL_TARGET("sse2") void SSE2MergeOpacity(Uint8* dest, const Uint8* src, int count)
+    {
+        int i = 0;
+        for (; i + 16 <= count; i += 16)
+        {
+            __m128i sv = _mm_loadu_si128((const __m128i*) (src + i));
+            __m128i dv = _mm_loadu_si128((const __m128i*) (dest + i));
+            _mm_storeu_si128((__m128i*) (dest + i), _mm_or_si128(dv, sv));
+        }
+        ScalarMergeOpacity(dest + i, src + i, count - i);
+    }
+
+    const KernelSet kSSE2Kernels = {
+        "SSE2",
+        &SSE2Fill16,
+        &SSE2Fill32,
+        &SSE2Blend16,
+        &SSE2Blend32,
+        &SSE2MergeOpacity
+    };
+
+    // AVX2 KERNELS
+
+    KERNEL_TARGET("avx2") void AVX2Fill16(void* dest, Uint16 value, int count)
+    {
+        Uint8* d = (Uint8*) dest;
+        __m256i v = _mm256_set1_epi16((short) value);
+        int i = 0;
+        for (; i + 16 <= count; i += 16)
+        {
+            _mm256_storeu_si256((__m256i*) (d + i * 2), v);
+        }
+        SSE2Fill16(d + i * 2, value, count - i);
+    }
+
+    KERNEL_TARGET("avx2") void AVX2Fill32(void* dest, Uint32 value, int count)
+    {
+        Uint8* d = (Uint8*) dest;
+        __m256i v = _mm256_set1_epi32((int) value);
+        int i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            _mm256_storeu_si256((__m256i*) (d + i * 4), v);
+        }
+        SSE2Fill32(d + i * 4, value, count - i);
+    }
+
+    KERNEL_TARGET("avx2") void AVX2Blend16(void* dest, const void* src, const Uint8* mask, int count)
+    {
+        Uint8* d = (Uint8*) dest;
+        const Uint8* s = (const Uint8*) src;
+        __m256i zero = _mm256_setzero_si256();
+        int i = 0;
+        for (; i + 16 <= count; i += 16)
+        {
+            __m128i m = _mm_loadu_si128((const __m128i*) (mask + i));
+            __m256i keep = _mm256_cmpeq_epi16(_mm256_cvtepu8_epi16(m), zero);
+
+            __m256i sv = _mm256_loadu_si256((const __m256i*) (s + i * 2));
+            __m256i dv = _mm256_loadu_si256((const __m256i*) (d + i * 2));
+            _mm256_storeu_si256((__m256i*) (d + i * 2), _mm256_blendv_epi8(sv, dv, keep));
+        }
+        SSE2Blend16(d + i * 2, s + i * 2, mask + i, count - i);
+    }
+
+    KERNEL_TARGET("avx2") void AVX2Blend32(void* dest, const void* src, const Uint8* mask, int count)
+    {
+        Uint8* d = (Uint8*) dest;
+        const Uint8* s = (const Uint8*) src;
+        __m256i zero = _mm256_setzero_si256();
+        int i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            __m128i m = _mm_loadl_epi64((const __m128i*) (mask + i));
+            __m256i keep = _mm256_cmpeq_epi32(_mm256_cvtepu8_epi32(m), zero);
+
+            __m256i sv = _mm256_loadu_si256((const __m256i*) (s + i * 4));
+            __m256i dv = _mm256_loadu_si256((const __m256i*) (d + i * 4));
+            _mm256_storeu_si256((__m256i*) (d + i * 4), _mm256_blendv_epi8(sv, dv, keep));
+        }
+        SSE2Blend32(d + i * 4, s + i * 4, mask + i, count - i);
+    }
+
+    KERNEL_TARGET("avx2") void AVX2MergeOpacity(Uint8* dest, const Uint8* src, int count)
+    {
+        int i = 0;
+        for (; i + 32 <= count; i += 32)
+        {
+            __m256i sv = _mm256_loadu_si256((const __m256i*) (src + i));
+            __m256i dv = _mm256_loadu_si256((const __m256i*) (dest + i));
+            _mm256_storeu_si256((__m256i*) (dest + i), _mm256_or_si256(dv, sv));
+        }
+        SSE2MergeOpacity(dest + i, src + i, count - i);
+    }
+
+    const KernelSet kAVX2Kernels = {
+        "AVX2",
+        &AVX2Fill16,
+        &AVX2Fill32,
+        &AVX2Blend16,
+        &AVX2Blend32,
+        &AVX2MergeOpacity
+    };
+
+#endif
+
+    const KernelSet& SelectKernels()
+    {
+#ifdef ASCIILIB_X86_KERNELS
+        if (SDL_HasAVX2())
+        {
+            return kAVX2Kernels;
+        }
+        if (SDL_HasSSE2())
+        {
+            return kSSE2Kernels;
+        }
+#endif
+        return kScalarKernels;
+    }
+
+    const KernelSet& Kernels()
+    {
+        // Detect the CPU's features only once
+        static const KernelSet& kernels = SelectKernels();
+        return kernels;
+    }
+
+    Uint32 ColorBits(Color color)
+    {
+        Uint32 bits;
+        memcpy(&bits, &color, sizeof(bits));
+        return bits;
+    }
+}
+
+
+void ascii::FillRow(UChar* dest, UChar value, int count)
+{
+    Kernels().fill16(dest, (Uint16) value, count);
+}
+
+void ascii::FillRow(Color* dest, Color value, int count)
+{
+    Kernels().fill32(dest, ColorBits(value), count);
+}
+
+void ascii::BlendRow(UChar* dest, const UChar* src, const Uint8* mask, int count)
+{
+    Kernels().blend16(dest, src, mask, count);
+}
+
+void ascii::BlendRow(Color* dest, const Color* src, const Uint8* mask, int count)
+{
+    Kernels().blend32(dest, src, mask, count);
+}
+
+void ascii::MergeOpacityRow(Uint8* dest, const Uint8* src, int count)
+{
+    Kernels().mergeOpacity(dest, src, count);
+}
+
+const char* ascii::SurfaceKernelName()
+{
+    return Kernels().name;
+}
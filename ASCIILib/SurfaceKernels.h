@@ -0,0 +1,32 @@
+#pragma once
+
+#include "unicode/utypes.h"
+
+#include <SDL.h>
+
+#include "Color.h"
+
+namespace ascii
+{
+
+// Row kernels used by Surface to fill and composite whole spans of cells at
+// once. Each one picks the widest instruction set available on the running
+// CPU the first time it is called (AVX2, then SSE2, then plain C++), so
+// callers never need to care which version they get.
+
+// Set count cells of a row to the same value
+void FillRow(UChar* dest, UChar value, int count);
+void FillRow(Color* dest, Color value, int count);
+
+// Copy each cell from src to dest wherever the matching opacity mask byte is
+// nonzero, leaving the other cells of dest untouched
+void BlendRow(UChar* dest, const UChar* src, const Uint8* mask, int count);
+void BlendRow(Color* dest, const Color* src, const Uint8* mask, int count);
+
+// Make every cell of dest opaque which is opaque in src
+void MergeOpacityRow(Uint8* dest, const Uint8* src, int count);
+
+// Name of the kernel set in use, for logging
+const char* SurfaceKernelName();
+
+}
@@ -3,12 +3,39 @@
 #include "Log.h"
 using namespace ascii;
 
-#include "FilePaths.h"
+#include "VirtualFS.h"
 
 
-void ascii::SurfaceManager::LoadSurface(string key, string surfaceFile)
+void ascii::SurfaceManager::LoadSurface(string key, string surfaceFile, Palette* palette)
 {
-    mSurfaces[key] = Surface::FromFile(surfaceFile.c_str());
+    AddSurface(key, LoadSurfaceFile(surfaceFile, palette));
+}
+
+void ascii::SurfaceManager::AddSurface(string key, Surface* surface)
+{
+    mSurfaces[key] = surface;
+}
+
+Surface* ascii::SurfaceManager::LoadSurfaceFile(string surfaceFile, Palette* palette)
+{
+    string binaryFile = Surface::BinaryPath(surfaceFile);
+
+    // A binary file older than its text file was compiled before the last
+    // edit, so it can't be trusted
+    Sint64 binaryTime = VirtualFS::ModifiedTime(binaryFile);
+    if (binaryTime != -1 && binaryTime >= VirtualFS::ModifiedTime(surfaceFile))
+    {
+        Surface* surface = Surface::FromBinaryFile(binaryFile.c_str(), palette);
+
+        if (surface)
+        {
+            return surface;
+        }
+
+        Log::Warning("Falling back on surface text file: " + surfaceFile);
+    }
+
+    return Surface::FromFile(surfaceFile.c_str(), palette);
 }
 
 Surface* ascii::SurfaceManager::CreateSurface(string key, int width, int height)
@@ -15,8 +15,11 @@ namespace ascii
 class SurfaceManager
 {
     public:
-        // Load a surface into memory with the given key
-        void LoadSurface(string key, string surfaceFile);
+        // Load a surface into memory with the given key. If a palette is
+        // given, the surface uses indexed colors from it
+        void LoadSurface(string key, string surfaceFile, Palette* palette=NULL);
+        // Store a surface which was already loaded, taking ownership of it
+        void AddSurface(string key, Surface* surface);
         // Free the surface with the given key from memory
         void FreeSurface(string key);
 
@@ -28,6 +31,10 @@ class SurfaceManager
         // Create a new surface in memory
         Surface* CreateSurface(string key, int width, int height);
 
+        // Load a surface file, preferring its compiled binary version when
+        // one exists and is up to date
+        static Surface* LoadSurfaceFile(string surfaceFile, Palette* palette=NULL);
+
     private:
         map<string, Surface*> mSurfaces;
 };
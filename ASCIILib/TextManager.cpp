@@ -63,19 +63,27 @@ UnicodeString ascii::TextManager::GetRandomText(int minLength)
 }
 
 void ascii::TextManager::LoadFile(Handle fileHandle)
+{
+    string textPath = FilePath(fileHandle);
+
+    Log::Print("Loading text file: " + textPath);
+
+    // Parse JSON data from those paths
+    AddFile(fileHandle, Json::Load(textPath));
+}
+
+string ascii::TextManager::FilePath(Handle fileHandle)
 {
     // Construct the paths to the JSON files for text by searching the directory
     // for the currently selected language
     string textPath = TEXT_DIR + mpLanguageManager->CurrentPack().directory
         + "/" + fileHandle;
 
-    textPath = FileAccessPath(textPath);
-
-    Log::Print("Loading text file: " + textPath);
-
-    // Parse JSON data from those paths
-    Json::Value* textJson = Json::Load(textPath);
+    return FileAccessPath(textPath);
+}
 
+void ascii::TextManager::AddFile(Handle fileHandle, Json::Value* textJson)
+{
     // Save keys of every string we load, so we can unload the file later.
     vector<string> textKeys;
 
@@ -28,6 +28,11 @@ class TextManager
 
         // Load desired text file in the proper language
         void LoadFile(Handle fileHandle);
+        // Path of a text file in the current language
+        string FilePath(Handle fileHandle);
+        // Store the text of a file whose JSON was already parsed, such as by
+        // a loading thread. Deletes the JSON when done with it
+        void AddFile(Handle fileHandle, Json::Value* textJson);
         // Unload text from the desired text file
         void UnloadFile(Handle fileHandle);
         // Reload all files in the currently selected language
@@ -3,6 +3,8 @@
 #include <algorithm>
 using std::max;
 
+#include "FrameScheduler.h"
+
 ascii::Tween::Tween(Surface* surface, Point source, Point dest, unsigned int totalMS)
     : mSurface(surface), mCurrentPos(source), mDestPos(dest), mElapsedMS(0)
 {
@@ -23,6 +25,9 @@ ascii::Tween::Tween(Surface* surface, Point source, Point dest, unsigned int tot
 
     // Calculate the time per step
     mStepMS = totalMS / steps;
+
+    // Keep an idle game loop running for the first step
+    FrameScheduler::ScheduleWakeup(mStepMS);
 }
 
 void ascii::Tween::Update(int deltaMS)
@@ -40,6 +45,13 @@ void ascii::Tween::Update(int deltaMS)
         if (mCurrentPos.y != mDestPos.y)
             mCurrentPos.y += mStepY;
     }
+
+    // Only one step is taken per update, so the next one needs a frame of
+    // its own
+    if (!IsFinished())
+    {
+        FrameScheduler::ScheduleWakeup(mStepMS - mElapsedMS);
+    }
 }
 
 void ascii::Tween::Draw(Graphics& graphics)
@@ -0,0 +1,218 @@
+#include "VirtualFS.h"
+
+#include <atomic>
+#include <sstream>
+
+#include "FilePaths.h"
+#include "GlobalArgs.h"
+#include "Log.h"
+
+
+namespace
+{
+    // Cached result of checking for the "loose-files" global arg
+    atomic<bool> sLooseFilesFirst(false);
+    atomic<int> sLooseFilesGeneration(-1);
+}
+
+vector<ascii::Archive*> ascii::VirtualFS::sArchives;
+string ascii::VirtualFS::sRootPrefix;
+
+//static
+bool ascii::VirtualFS::Mount(string archivePath)
+{
+    if (FileModifiedTime(archivePath) == -1)
+    {
+        return false;
+    }
+
+    Archive* archive = new Archive(archivePath);
+
+    if (!archive->isOpen())
+    {
+        Log::Error("Failed to mount content archive: " + archivePath);
+        delete archive;
+        return false;
+    }
+
+    // Paths reach the VirtualFS already made absolute by FileAccessPath on
+    // some systems, but are packed relative to the working directory
+    sRootPrefix = FileAccessPath("");
+
+    sArchives.push_back(archive);
+
+    stringstream message;
+    message << "Mounted content archive with " << archive->size() << " files: " << archivePath;
+    Log::Print(message.str());
+    return true;
+}
+
+//static
+void ascii::VirtualFS::UnmountAll()
+{
+    for (size_t i = 0; i < sArchives.size(); ++i)
+    {
+        delete sArchives[i];
+    }
+    sArchives.clear();
+}
+
+//static
+SDL_RWops* ascii::VirtualFS::Open(string path)
+{
+    const Uint8* data;
+    size_t size;
+
+    bool looseFirst = LooseFilesFirst();
+
+    if (looseFirst)
+    {
+        SDL_RWops* file = SDL_RWFromFile(path.c_str(), "rb");
+        if (file)
+        {
+            return file;
+        }
+    }
+
+    if (FindPacked(path, &data, &size))
+    {
+        return SDL_RWFromConstMem(data, (int) size);
+    }
+
+    if (!looseFirst)
+    {
+        return SDL_RWFromFile(path.c_str(), "rb");
+    }
+
+    SDL_SetError("Couldn't open %s", path.c_str());
+    return NULL;
+}
+
+//static
+bool ascii::VirtualFS::Exists(string path)
+{
+    return ModifiedTime(path) != -1;
+}
+
+//static
+Sint64 ascii::VirtualFS::ModifiedTime(string path)
+{
+    const Uint8* data;
+    size_t size;
+    Sint64 modifiedTime;
+
+    bool looseFirst = LooseFilesFirst();
+
+    if (looseFirst)
+    {
+        modifiedTime = FileModifiedTime(path);
+        if (modifiedTime != -1)
+        {
+            return modifiedTime;
+        }
+    }
+
+    if (FindPacked(path, &data, &size, &modifiedTime))
+    {
+        return modifiedTime;
+    }
+
+    return looseFirst ? -1 : FileModifiedTime(path);
+}
+
+//static
+bool ascii::VirtualFS::FindPacked(string path, const Uint8** outData, size_t* outSize,
+        Sint64* outModifiedTime)
+{
+    if (sArchives.empty())
+    {
+        return false;
+    }
+
+    string archivePath = ArchivePath(path);
+
+    for (int i = (int) sArchives.size() - 1; i >= 0; --i)
+    {
+        if (sArchives[i]->find(archivePath, outData, outSize, outModifiedTime))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+//static
+bool ascii::VirtualFS::LooseFilesFirst()
+{
+    // Only search the global args again when they have changed
+    int generation = GlobalArgs::Generation();
+
+    if (generation != sLooseFilesGeneration.load(memory_order_relaxed))
+    {
+        sLooseFilesFirst.store(GlobalArgs::Enabled("loose-files"), memory_order_relaxed);
+        sLooseFilesGeneration.store(generation, memory_order_relaxed);
+    }
+
+    // Without an archive, every file is loose
+    return sArchives.empty() || sLooseFilesFirst.load(memory_order_relaxed);
+}
+
+//static
+string ascii::VirtualFS::ArchivePath(string path)
+{
+    if (!sRootPrefix.empty() && path.compare(0, sRootPrefix.size(), sRootPrefix) == 0)
+    {
+        path.erase(0, sRootPrefix.size());
+    }
+
+    for (size_t i = 0; i < path.size(); ++i)
+    {
+        if (path[i] == '\\')
+        {
+            path[i] = '/';
+        }
+    }
+
+    while (path.compare(0, 2, "./") == 0)
+    {
+        path.erase(0, 2);
+    }
+
+    return path;
+}
+
+ascii::VirtualFile::VirtualFile(string path)
+    : mOpen(false), mpData(NULL), mSize(0), mpLooseFile(NULL)
+{
+    bool looseFirst = VirtualFS::LooseFilesFirst();
+
+    if (!looseFirst && VirtualFS::FindPacked(path, &mpData, &mSize))
+    {
+        mOpen = true;
+        return;
+    }
+
+    mpLooseFile = new MappedFile(path);
+
+    if (mpLooseFile->isOpen())
+    {
+        mOpen = true;
+        mpData = mpLooseFile->data();
+        mSize = mpLooseFile->size();
+        return;
+    }
+
+    delete mpLooseFile;
+    mpLooseFile = NULL;
+
+    if (looseFirst && VirtualFS::FindPacked(path, &mpData, &mSize))
+    {
+        mOpen = true;
+    }
+}
+
+ascii::VirtualFile::~VirtualFile()
+{
+    delete mpLooseFile;
+}
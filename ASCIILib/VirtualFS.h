@@ -0,0 +1,83 @@
+#pragma once
+
+#include <string>
+#include <vector>
+using namespace std;
+
+#include <SDL.h>
+
+#include "Archive.h"
+#include "MappedFile.h"
+
+namespace ascii
+{
+
+    // Resolves content paths against mounted archives and loose files on
+    // disk. Paths are the same ones handed to FileAccessPath, so callers
+    // don't need to know where a file really lives.
+    //
+    // A file which is packed is served straight from its archive's mapping.
+    // A loose file is only used for paths no archive has, unless the
+    // "loose-files" global arg is given, in which case loose files override
+    // packed ones so content can be edited without repacking
+    class VirtualFS
+    {
+        public:
+            // Mount a content archive. Archives mounted later take
+            // precedence. Returns false if the archive doesn't exist or
+            // isn't valid. A mounted archive must outlive every asset which
+            // streams from it, such as music
+            static bool Mount(string archivePath);
+            static void UnmountAll();
+
+            // Open a file for reading. The caller owns the returned stream,
+            // which is NULL if the file doesn't exist
+            static SDL_RWops* Open(string path);
+
+            static bool Exists(string path);
+
+            // When the file was last modified, in seconds since the epoch,
+            // or -1 if it doesn't exist. Packed files report the time they
+            // had when they were packed
+            static Sint64 ModifiedTime(string path);
+
+            // Look up a packed file, ignoring loose files
+            static bool FindPacked(string path, const Uint8** outData, size_t* outSize,
+                    Sint64* outModifiedTime=NULL);
+
+            // Whether loose files should be checked before archives
+            static bool LooseFilesFirst();
+
+        private:
+            // The path a file would be packed under
+            static string ArchivePath(string path);
+
+            static vector<Archive*> sArchives;
+            static string sRootPrefix;
+    };
+
+    // The whole contents of a file found through the VirtualFS. Packed files
+    // aren't copied, and loose files are mapped rather than read
+    class VirtualFile
+    {
+        public:
+            VirtualFile(string path);
+            ~VirtualFile();
+
+            bool isOpen() { return mOpen; }
+
+            // NULL if the file is empty or couldn't be opened
+            const Uint8* data() { return mpData; }
+            size_t size() { return mSize; }
+
+        private:
+            VirtualFile(const VirtualFile&);
+            VirtualFile& operator=(const VirtualFile&);
+
+            bool mOpen;
+            const Uint8* mpData;
+            size_t mSize;
+            MappedFile* mpLooseFile;
+    };
+
+}
@@ -0,0 +1,109 @@
+#include "WorkerPool.h"
+
+#include <algorithm>
+
+#include "Log.h"
+#include "Profiler.h"
+
+
+namespace
+{
+    // More threads than this mostly fight over the disk
+    const int kMaxThreads = 4;
+}
+
+
+ascii::WorkerPool::WorkerPool(int threads)
+    : mStopping(false)
+{
+    mpLock = SDL_CreateMutex();
+    mpWake = SDL_CreateCond();
+
+    if (threads <= 0)
+    {
+        threads = min(max(SDL_GetCPUCount() - 1, 1), kMaxThreads);
+    }
+
+    for (int i = 0; i < threads; ++i)
+    {
+        SDL_Thread* thread = SDL_CreateThread(ThreadMain, "Worker", this);
+
+        if (!thread)
+        {
+            Log::Error("Failed to start a worker thread.");
+            Log::SDLError();
+            break;
+        }
+
+        mThreads.push_back(thread);
+    }
+}
+
+ascii::WorkerPool::~WorkerPool()
+{
+    SDL_LockMutex(mpLock);
+    mStopping = true;
+    mJobs.clear();
+    SDL_CondBroadcast(mpWake);
+    SDL_UnlockMutex(mpLock);
+
+    for (size_t i = 0; i < mThreads.size(); ++i)
+    {
+        SDL_WaitThread(mThreads[i], NULL);
+    }
+
+    SDL_DestroyCond(mpWake);
+    SDL_DestroyMutex(mpLock);
+}
+
+void ascii::WorkerPool::Submit(function<void()> job)
+{
+    // Without any threads, the caller has to do the work itself
+    if (mThreads.empty())
+    {
+        job();
+        return;
+    }
+
+    SDL_LockMutex(mpLock);
+    mJobs.push_back(job);
+    SDL_CondSignal(mpWake);
+    SDL_UnlockMutex(mpLock);
+}
+
+int ascii::WorkerPool::ThreadMain(void* data)
+{
+    ((WorkerPool*) data)->Work();
+    return 0;
+}
+
+void ascii::WorkerPool::Work()
+{
+    SDL_LockMutex(mpLock);
+
+    while (true)
+    {
+        while (mJobs.empty() && !mStopping)
+        {
+            SDL_CondWait(mpWake, mpLock);
+        }
+
+        if (mStopping)
+        {
+            break;
+        }
+
+        function<void()> job = mJobs.front();
+        mJobs.pop_front();
+        SDL_UnlockMutex(mpLock);
+
+        {
+            PROFILE_SCOPE("WorkerPool::Job");
+            job();
+        }
+
+        SDL_LockMutex(mpLock);
+    }
+
+    SDL_UnlockMutex(mpLock);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <vector>
+using namespace std;
+
+#include <SDL.h>
+
+namespace ascii
+{
+    // A few threads which run jobs in the order they are submitted. Jobs
+    // report their own results, so the pool only needs to run them
+    class WorkerPool
+    {
+        public:
+            // Start the given number of threads, or one for each CPU but the
+            // one running the game if threads is 0
+            WorkerPool(int threads=0);
+            // Drop jobs which haven't started, and wait for the rest
+            ~WorkerPool();
+
+            void Submit(function<void()> job);
+
+            // Number of threads which actually started
+            int threads() { return (int) mThreads.size(); }
+
+        private:
+            static int ThreadMain(void* data);
+            void Work();
+
+            vector<SDL_Thread*> mThreads;
+            SDL_mutex* mpLock;
+            SDL_cond* mpWake;
+
+            // Guarded by mpLock
+            deque<function<void()> > mJobs;
+            bool mStopping;
+    };
+}
@@ -1,6 +1,7 @@
 #include "content.h"
 
 #include <iterator>
+#include <unordered_set>
 
 #include "Log.h"
 using namespace ascii;
@@ -143,10 +144,50 @@ ContentGroup ParseContentGroup(Json::Value& groupJson, bool locked)
     return group;
 }
 
+void HandleRegistry::Acquire(const HandleList& handles, HandleList* outAcquired)
+{
+    for (auto it = handles.begin(); it != handles.end(); ++it)
+    {
+        if (++mCounts[*it] == 1)
+        {
+            outAcquired->push_back(*it);
+        }
+    }
+}
+
+void HandleRegistry::Release(const HandleList& handles, HandleList* outReleased)
+{
+    for (auto it = handles.begin(); it != handles.end(); ++it)
+    {
+        auto count = mCounts.find(*it);
+
+        if (count == mCounts.end())
+        {
+            Log::Warning("Released a content handle which was never required: " + *it);
+            continue;
+        }
+
+        if (--count->second == 0)
+        {
+            mCounts.erase(count);
+            outReleased->push_back(*it);
+        }
+    }
+}
+
 HandleList& operator+=(HandleList& a, HandleList& b)
 {
-    // Add all elements from b to a that do not already exist in a
-    remove_copy_if(b.begin(), b.end(), back_inserter(a), IsDuplicate(a));
+    // Add all elements from b to a that do not already exist in a, looking
+    // them up in a hash set rather than searching a for each one
+    unordered_set<Handle> present(a.begin(), a.end());
+
+    for (auto it = b.begin(); it != b.end(); ++it)
+    {
+        if (present.insert(*it).second)
+        {
+            a.push_back(*it);
+        }
+    }
 
     // Return the sum (now contained in a)
     return a;
@@ -37,6 +37,7 @@
 #include <algorithm>
 #include <cstddef>
 #include <string>
+#include <unordered_map>
 using namespace std;
 
 #include "json.h"
@@ -114,6 +115,28 @@ struct IsDuplicate
     }
 };
 
+// Counts how many loaded content groups reference each handle of one type
+// of asset, so that an asset is loaded by the first group to require it and
+// freed along with the last group to release it
+class HandleRegistry
+{
+    public:
+        // Count a reference to every handle in the list. Handles which
+        // weren't referenced before are added to outAcquired
+        void Acquire(const HandleList& handles, HandleList* outAcquired);
+        // Drop a reference to every handle in the list. Handles which are no
+        // longer referenced are added to outReleased
+        void Release(const HandleList& handles, HandleList* outReleased);
+
+        // Whether any group references the handle
+        bool Contains(const Handle& handle) const { return mCounts.find(handle) != mCounts.end(); }
+        // Number of handles referenced
+        size_t size() const { return mCounts.size(); }
+
+    private:
+        unordered_map<Handle, int> mCounts;
+};
+
 // Combine two handle lists without duplicates
 HandleList& operator+=(HandleList& a, HandleList& b);
 
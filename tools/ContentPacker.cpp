@@ -0,0 +1,165 @@
+// Packs content files into one archive, which the game mounts in place of
+// the loose files when it finds content.pak in its working directory.
+//
+// Usage: content-packer <output archive> <directory or file>...
+//
+// Directories are packed recursively. Run from the game's working directory
+// so that every file is stored under the path the game loads it by, like
+// "content/images/title.png"
+
+#define SDL_MAIN_HANDLED
+
+#include <stdio.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+using namespace std;
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+#include "Archive.h"
+#include "Log.h"
+using namespace ascii;
+
+
+namespace
+{
+    // Add a file, or every file under a directory, to the list to pack.
+    // Hidden files are left out
+    bool CollectFiles(string path, vector<string>& files)
+    {
+#ifdef _WIN32
+        DWORD attributes = GetFileAttributesA(path.c_str());
+        if (attributes == INVALID_FILE_ATTRIBUTES)
+        {
+            return false;
+        }
+
+        if (!(attributes & FILE_ATTRIBUTE_DIRECTORY))
+        {
+            files.push_back(path);
+            return true;
+        }
+
+        WIN32_FIND_DATAA entry;
+        HANDLE search = FindFirstFileA((path + "\\*").c_str(), &entry);
+        if (search == INVALID_HANDLE_VALUE)
+        {
+            return true;
+        }
+
+        bool collected = true;
+        do
+        {
+            if (entry.cFileName[0] != '.')
+            {
+                collected = CollectFiles(path + "/" + entry.cFileName, files) && collected;
+            }
+        } while (FindNextFileA(search, &entry));
+
+        FindClose(search);
+        return collected;
+#else
+        struct stat info;
+        if (stat(path.c_str(), &info) != 0)
+        {
+            return false;
+        }
+
+        if (!S_ISDIR(info.st_mode))
+        {
+            files.push_back(path);
+            return true;
+        }
+
+        DIR* directory = opendir(path.c_str());
+        if (!directory)
+        {
+            return false;
+        }
+
+        bool collected = true;
+        struct dirent* entry;
+        while ((entry = readdir(directory)) != NULL)
+        {
+            if (entry->d_name[0] != '.')
+            {
+                collected = CollectFiles(path + "/" + entry->d_name, files) && collected;
+            }
+        }
+
+        closedir(directory);
+        return collected;
+#endif
+    }
+
+    // Store paths the way the game asks for them
+    string NormalizePath(string path)
+    {
+        replace(path.begin(), path.end(), '\\', '/');
+
+        while (path.compare(0, 2, "./") == 0)
+        {
+            path.erase(0, 2);
+        }
+
+        return path;
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "Usage: %s <output archive> <directory or file>...\n", argv[0]);
+        return 1;
+    }
+
+    string archivePath(argv[1]);
+    vector<string> files;
+
+    for (int i = 2; i < argc; ++i)
+    {
+        string path(argv[i]);
+
+        // Don't pack trailing slashes into the paths
+        while (path.size() > 1 && (path[path.size() - 1] == '/' || path[path.size() - 1] == '\\'))
+        {
+            path.erase(path.size() - 1);
+        }
+
+        if (!CollectFiles(path, files))
+        {
+            fprintf(stderr, "Failed to read %s\n", path.c_str());
+            Log::Shutdown();
+            return 1;
+        }
+    }
+
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        files[i] = NormalizePath(files[i]);
+    }
+
+    // Sorted paths make the archive the same from one run to the next, and
+    // an archive never packs an older copy of itself
+    sort(files.begin(), files.end());
+    files.erase(unique(files.begin(), files.end()), files.end());
+    files.erase(remove(files.begin(), files.end(), NormalizePath(archivePath)), files.end());
+
+    bool written = Archive::Write(archivePath, files);
+
+    if (written)
+    {
+        printf("Packed %d files into %s\n", (int) files.size(), archivePath.c_str());
+    }
+
+    Log::Shutdown();
+    return written ? 0 : 1;
+}
@@ -0,0 +1,50 @@
+// Compiles surface text files into the binary .surfb format, which
+// SurfaceManager loads in preference to the text files they came from.
+//
+// Usage: surface-compiler <surface file>...
+//
+// Each binary file is written next to its text file, with the extension
+// replaced by .surfb
+
+#define SDL_MAIN_HANDLED
+
+#include <stdio.h>
+
+#include "Log.h"
+#include "Surface.h"
+using namespace ascii;
+
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s <surface file>...\n", argv[0]);
+        return 1;
+    }
+
+    int failures = 0;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        string textPath(argv[i]);
+        string binaryPath = Surface::BinaryPath(textPath);
+
+        Surface* surface = Surface::FromFile(textPath.c_str());
+
+        if (surface && surface->saveBinaryFile(binaryPath.c_str()))
+        {
+            printf("%s -> %s\n", textPath.c_str(), binaryPath.c_str());
+        }
+        else
+        {
+            fprintf(stderr, "Failed to compile %s\n", textPath.c_str());
+            ++failures;
+        }
+
+        delete surface;
+    }
+
+    Log::Shutdown();
+    return failures == 0 ? 0 : 1;
+}